@@ -0,0 +1,94 @@
+//
+// Arena Allocator Module
+// - chunks are kept in a list, newest first; only the newest one is
+//   filled, and a request that does not fit starts a new chunk
+// - a request bigger than the chunk size gets a chunk of its own
+//
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+
+// alignment of arenaAlloc() memory and of chunk sizes
+#define ARENAALIGN 16
+#define ALIGNUP(n) (((n) + ARENAALIGN-1) & ~(size_t) (ARENAALIGN-1))
+// chunk data starts this far after the chunk header
+#define HEADERSIZE ALIGNUP(sizeof(ArenaChunk))
+
+// Set up an empty arena (no chunks are allocated until needed)
+void initArena(Arena* arena, size_t chunkSize)
+{
+   arena->head = 0;
+   arena->chunkSize = ALIGNUP(chunkSize);
+   arena->bytesUsed = 0;
+   arena->numChunks = 0;
+}
+
+// Allocate bytes from the arena, starting at a multiple of align
+// (a power of two no bigger than ARENAALIGN)
+static void* allocAligned(Arena* arena, size_t bytes, size_t align)
+{
+   ArenaChunk* chunk = arena->head;
+   size_t start = 0;
+   void* mem;
+   if (chunk)
+      start = (chunk->used + align-1) & ~(align-1);
+   if (!chunk || start + bytes > chunk->size) {
+      size_t size = bytes > arena->chunkSize ? ALIGNUP(bytes) : arena->chunkSize;
+      chunk = (ArenaChunk*) malloc(HEADERSIZE + size);
+      if (!chunk)
+         return 0;
+      chunk->size = size;
+      chunk->used = 0;
+      chunk->next = arena->head;
+      arena->head = chunk;
+      arena->numChunks++;
+      start = 0;
+   }
+   mem = (char*) chunk + HEADERSIZE + start;
+   arena->bytesUsed += start + bytes - chunk->used;
+   chunk->used = start + bytes;
+   return mem;
+}
+
+// Allocate bytes from the arena
+// - returns NULL only if a new chunk cannot be allocated
+void* arenaAlloc(Arena* arena, size_t bytes)
+{
+   return allocAligned(arena, bytes ? bytes : 1, ARENAALIGN);
+}
+
+// Copy len chars of str into the arena, with a null terminator
+// - strings are packed with no alignment padding
+char* arenaStrndup(Arena* arena, const char* str, size_t len)
+{
+   char* copy = (char*) allocAligned(arena, len + 1, 1);
+   if (!copy)
+      return 0;
+   memcpy(copy, str, len);
+   copy[len] = '\0';
+   return copy;
+}
+
+// Free every chunk; the arena is left empty and can be used again
+void freeArena(Arena* arena)
+{
+   ArenaChunk* chunk;
+   while ((chunk = arena->head)) {
+      arena->head = chunk->next;
+      free(chunk);
+   }
+   arena->bytesUsed = 0;
+   arena->numChunks = 0;
+}
+
+// Total bytes handed out by the arena (including alignment padding)
+size_t arenaBytesUsed(Arena* arena)
+{
+   return arena->bytesUsed;
+}
+
+// Number of chunks the arena holds
+unsigned int arenaChunkCount(Arena* arena)
+{
+   return arena->numChunks;
+}
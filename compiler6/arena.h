@@ -0,0 +1,32 @@
+//
+// Arena Allocator Interface
+// - an arena hands out memory by bumping a pointer through big
+//   chunks; nothing is freed on its own, the whole arena is freed
+//   at once, which costs one free() per chunk
+// - memory from arenaAlloc() is aligned for any basic type
+//
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+typedef struct arenachunk_s {
+   struct arenachunk_s* next; // next older chunk
+   size_t size, used;         // bytes of data, bytes handed out
+} ArenaChunk;                 // chunk data follows the header
+
+typedef struct {
+   ArenaChunk* head;          // newest chunk (the one being filled)
+   size_t chunkSize;          // data size of a normal chunk
+   size_t bytesUsed;          // total bytes handed out
+   unsigned int numChunks;
+} Arena;
+
+void initArena(Arena* arena, size_t chunkSize);
+void* arenaAlloc(Arena* arena, size_t bytes);
+char* arenaStrndup(Arena* arena, const char* str, size_t len);
+void freeArena(Arena* arena);
+size_t arenaBytesUsed(Arena* arena);
+unsigned int arenaChunkCount(Arena* arena);
+
+#endif
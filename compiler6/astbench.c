@@ -0,0 +1,210 @@
+//
+// AST Layout Benchmark
+// - builds a pointer AST for a program of N statements (a mix of
+//   assignments, calls and while loops, on local variables), compacts it, and compares
+//   the two layouts: bytes per statement, and the time for a full
+//   walk over every node (the same visiting order the code
+//   generator uses: node, children, next sibling)
+// - then builds the program again with the hash-consing factory,
+//   making calls in the order the parser would, and reports how many
+//   nodes were shared and the bytes per statement that leaves
+// - build with "make astbench", run as "./astbench [statements]"
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "astree.h"
+
+#define REPS 5
+
+static Atom aX, aY, aI, aPrint;
+static int useCons; // build expressions with the consAST*() factory
+
+static double now()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static ASTNode* varRef(Atom name)
+{
+   ASTNode* n;
+   if (useCons)
+      return consASTVarRef(name, V_LOCAL, 0, 0);
+   n = newASTNode(AST_VARREF);
+   n->name = name;
+   n->varKind = V_LOCAL;
+   return n;
+}
+
+static ASTNode* constant(int value)
+{
+   ASTNode* n;
+   if (useCons)
+      return consASTConstant(value, T_INT);
+   n = newASTNode(AST_CONSTANT);
+   n->ival = value;
+   return n;
+}
+
+static ASTNode* binop(int op, ASTNode* left, ASTNode* right)
+{
+   ASTNode* n;
+   if (useCons)
+      return consASTExpression(op, left, right);
+   n = newASTNode(AST_EXPRESSION);
+   n->ival = op;
+   n->child[0] = left;
+   n->child[1] = right;
+   return n;
+}
+
+static ASTNode* assign(Atom name, ASTNode* rhs)
+{
+   ASTNode* n = newASTNode(AST_ASSIGNMENT);
+   n->name = name;
+   n->child[0] = rhs;
+   if (useCons)
+      consASTStore(name);
+   return n;
+}
+
+// Statement number i: cycles through four statement shapes
+static ASTNode* statement(int i)
+{
+   ASTNode *n, *c;
+   switch (i % 4) {
+    case 0: // x = x + i;
+       return assign(aX, binop('+', varRef(aX), constant(i)));
+    case 1: // call printInt(x - 1);
+       n = newASTNode(AST_FUNCALL);
+       n->name = aPrint;
+       n->child[0] = newASTNode(AST_ARGUMENT);
+       n->child[0]->child[0] = binop('-', varRef(aX), constant(1));
+       if (useCons)
+          consASTCall();
+       return n;
+    case 2: // y = x - 1;
+       return assign(aY, binop('-', varRef(aX), constant(1)));
+    default: // while (i < 10) do { i = i + 1; }
+       n = newASTNode(AST_WHILE);
+       c = newASTNode(AST_RELEXPR);
+       c->ival = '<';
+       c->child[0] = varRef(aI);
+       c->child[1] = constant(10);
+       n->child[0] = c;
+       if (useCons)
+          consASTReset();
+       n->child[1] = assign(aI, binop('+', varRef(aI), constant(1)));
+       if (useCons)
+          consASTReset();
+       return n;
+   }
+}
+
+// Build the whole program of n statements
+static ASTNode* program(int n)
+{
+   ASTNode *tree, *last = 0, *s;
+   int i;
+   tree = newASTNode(AST_PROGRAM);
+   for (i=0; i < n; i++) {
+      s = statement(i);
+      if (last)
+         last->next = s;
+      else
+         tree->child[2] = s;
+      last = s;
+   }
+   return tree;
+}
+
+// Walk a pointer tree: returns a checksum and counts the nodes
+static long walkPointer(ASTNode* node, long* count)
+{
+   long sum = 0;
+   int i;
+   for (; node; node = node->next) {
+      (*count)++;
+      sum += node->ival + node->type;
+      for (i=0; i < ASTNUMCHILDREN; i++)
+         if (node->child[i])
+            sum += walkPointer(node->child[i], count);
+   }
+   return sum;
+}
+
+// Walk a compact tree in the same order (same results)
+static long walkCompact(CompactAST* ast, CNodeId id, long* count)
+{
+   long sum = 0;
+   CNode* node;
+   int i;
+   for (; id != CNONE; id = node->next) {
+      node = &ast->nodes[id];
+      (*count)++;
+      sum += node->ival + node->type;
+      for (i=0; i < ASTNUMCHILDREN; i++)
+         if (node->child[i] != CNONE)
+            sum += walkCompact(ast, node->child[i], count);
+   }
+   return sum;
+}
+
+int main(int argc, char* argv[])
+{
+   int n = argc > 1 ? atoi(argv[1]) : 1000000;
+   ASTNode* tree;
+   CompactAST* ast;
+   double t, tPtr = 1e9, tCompact = 1e9, tBuild;
+   long sumPtr = 0, sumCompact = 0, nodes = 0, count;
+   int i;
+   aX = internAtom("x", 1);
+   aY = internAtom("y", 1);
+   aI = internAtom("i", 1);
+   aPrint = internAtom("printInt", 8);
+   tree = program(n);
+   t = now();
+   ast = compactASTree(tree);
+   tBuild = now() - t;
+   for (i=0; i < REPS; i++) {
+      count = 0;
+      t = now();
+      sumPtr = walkPointer(tree, &count);
+      t = now() - t;
+      nodes = count;
+      if (t < tPtr)
+         tPtr = t;
+      count = 0;
+      t = now();
+      sumCompact = walkCompact(ast, ast->root, &count);
+      t = now() - t;
+      if (t < tCompact)
+         tCompact = t;
+   }
+   if (sumPtr != sumCompact || count != nodes)
+      printf("Error: walks do not match\n");
+   printf("%d statements, %ld nodes\n", n, nodes);
+   printf("%-8s %10s %12s %12s %12s\n", "layout", "node size",
+          "bytes/stmt", "walk ms", "ns/node");
+   printf("%-8s %10lu %12.1f %12.2f %12.2f\n", "pointer",
+          (unsigned long) sizeof(ASTNode), (double) astBytesUsed() / n,
+          tPtr * 1e3, tPtr * 1e9 / nodes);
+   printf("%-8s %10lu %12.1f %12.2f %12.2f\n", "compact",
+          (unsigned long) sizeof(CNode), (double) compactASTBytes(ast) / n,
+          tCompact * 1e3, tCompact * 1e9 / nodes);
+   printf("compacting took %.2f ms\n", tBuild * 1e3);
+   freeCompactAST(ast);
+   freeASTree(tree);
+   useCons = 1;
+   tree = program(n);
+   ast = compactASTree(tree);
+   printf("%-8s %10lu %12.1f   (%u nodes shared, %u compact nodes)\n", "consed",
+          (unsigned long) sizeof(ASTNode), (double) astBytesUsed() / n,
+          consASTShared(), ast->numNodes - 1);
+   freeCompactAST(ast);
+   freeASTree(tree);
+   freeAtoms();
+   return 0;
+}
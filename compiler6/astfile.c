@@ -0,0 +1,264 @@
+//
+// Binary AST File Module
+// - see astfile.h for the file layout
+// - loading maps the file read-only and points the CompactAST's
+//   node, string and pool arrays straight into the mapping; the
+//   header and string table are checked, and one linear pass checks
+//   that every node's ids and enums are in range, since the walkers
+//   follow them as they are (nothing is decoded or copied)
+// - if the atom table already holds other names when a file is
+//   loaded, atoms come out numbered differently, and then (only
+//   then) the nodes are copied and their names renumbered
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "atoms.h"
+#include "astfile.h"
+
+#define ASTMAGIC   0x5453414A   // "JAST" in little-endian byte order
+#define ASTVERSION 1
+
+typedef struct {
+   unsigned int magic, version;
+   unsigned int nodeSize;       // sizeof(CNode) when written
+   unsigned int numNodes, root, numStrings, numNames, poolLen;
+   unsigned long long nodesOff, stringsOff, poolOff, namesOff, fileSize;
+} ASTFileHeader;
+
+// Write a compact AST to a file
+// - returns 0 on success, any other on failure
+int writeASTFile(CompactAST* ast, const char* fileName)
+{
+   ASTFileHeader hdr;
+   unsigned int i;
+   size_t namesLen = 0;
+   FILE* f;
+   int err;
+   for (i=0; i < atomCount(); i++)
+      namesLen += strlen(atomName(i)) + 1;
+   memset(&hdr, 0, sizeof(hdr));
+   hdr.magic = ASTMAGIC;
+   hdr.version = ASTVERSION;
+   hdr.nodeSize = sizeof(CNode);
+   hdr.numNodes = ast->numNodes;
+   hdr.root = ast->root;
+   hdr.numStrings = ast->numStrings;
+   hdr.numNames = atomCount();
+   hdr.poolLen = ast->poolLen;
+   hdr.nodesOff = sizeof(hdr);
+   hdr.stringsOff = hdr.nodesOff + (unsigned long long) ast->numNodes * sizeof(CNode);
+   hdr.poolOff = hdr.stringsOff + ast->numStrings * sizeof(unsigned int);
+   hdr.namesOff = hdr.poolOff + ast->poolLen;
+   hdr.fileSize = hdr.namesOff + namesLen;
+   f = fopen(fileName, "wb");
+   if (!f)
+      return -1;
+   err = fwrite(&hdr, sizeof(hdr), 1, f) != 1;
+   err |= fwrite(ast->nodes, sizeof(CNode), ast->numNodes, f) != ast->numNodes;
+   if (ast->numStrings)
+      err |= fwrite(ast->strOffsets, sizeof(unsigned int), ast->numStrings, f)
+             != ast->numStrings;
+   if (ast->poolLen)
+      err |= fwrite(ast->strPool, ast->poolLen, 1, f) != 1;
+   for (i=0; i < hdr.numNames; i++)
+      err |= fputs(atomName(i), f) == EOF || fputc('\0', f) == EOF;
+   err |= fclose(f) != 0;
+   if (err)
+      unlink(fileName);
+   return err;
+}
+
+// Check that a mapped file has a sane header and string table
+static int checkHeader(ASTFileHeader* hdr, const char* map, size_t size)
+{
+   unsigned int* strOffsets;
+   unsigned int i;
+   if (hdr->magic != ASTMAGIC || hdr->version != ASTVERSION ||
+       hdr->nodeSize != sizeof(CNode) || hdr->fileSize != size ||
+       hdr->numNodes < 1 || hdr->root >= hdr->numNodes ||
+       hdr->nodesOff != sizeof(ASTFileHeader) ||
+       hdr->stringsOff != hdr->nodesOff + (unsigned long long) hdr->numNodes * sizeof(CNode) ||
+       hdr->poolOff != hdr->stringsOff + (unsigned long long) hdr->numStrings * sizeof(unsigned int) ||
+       hdr->namesOff != hdr->poolOff + hdr->poolLen || hdr->namesOff > size)
+      return -1;
+   if (hdr->poolLen && map[hdr->poolOff + hdr->poolLen - 1] != '\0')
+      return -1;
+   if (hdr->numNames && (hdr->namesOff == size || map[size-1] != '\0'))
+      return -1;
+   strOffsets = (unsigned int*) (map + hdr->stringsOff);
+   for (i=0; i < hdr->numStrings; i++)
+      if (strOffsets[i] > hdr->poolLen)
+         return -1;
+   return 0;
+}
+
+// Can a node be shared, that is, be the child of more than one node?
+// - only the hash-consed kinds (see astree.h) are, and never with a
+//   next sibling
+static int shareable(CNode* node)
+{
+   return (node->type == AST_EXPRESSION || node->type == AST_VARREF ||
+           (node->type == AST_CONSTANT && node->valType != T_STRING)) &&
+          node->next == CNONE;
+}
+
+// Check that no node can reach itself through child links
+// - a depth-first search off an explicit stack, where a child still
+//   on the stack (state 1) closes a cycle; nodes already finished
+//   (state 2) are shared subtrees and are not searched again
+static int checkAcyclic(CNode* nodes, unsigned int numNodes)
+{
+   unsigned char* state = (unsigned char*) calloc(numNodes, 1);
+   CNodeId* stack = (CNodeId*) malloc(numNodes * sizeof(CNodeId));
+   unsigned char* next = (unsigned char*) malloc(numNodes);
+   unsigned int i, top, k;
+   CNodeId id, c;
+   int err = 0;
+   for (i=1; i < numNodes && !err; i++) {
+      if (state[i])
+         continue;
+      top = 0;
+      stack[top++] = i;
+      state[i] = 1;
+      next[i] = 0;
+      while (top > 0 && !err) {
+         id = stack[top-1];
+         k = next[id]++;
+         if (k == ASTNUMCHILDREN) {
+            state[id] = 2;
+            top--;
+            continue;
+         }
+         c = nodes[id].child[k];
+         if (c == CNONE || state[c] == 2)
+            continue;
+         if (state[c] == 1) {
+            err = -1;
+            break;
+         }
+         state[c] = 1;
+         next[c] = 0;
+         stack[top++] = c;
+      }
+   }
+   free(state);
+   free(stack);
+   free(next);
+   return err;
+}
+
+// Check that every node's fields are in range: its child and next
+// ids, its type, data type and variable kind, its name (0 or an
+// atom in the file), and a string constant's string id
+// - nodes are stored in visiting order (a node, its children's
+//   subtrees, then its next sibling), so a next id, and a child id
+//   the first time that child is used, are above the node's own; a
+//   lower child id can only be a later use of a shared node
+// - a cycle would send code generation round a loop forever, so the
+//   child links are also checked for one
+static int checkNodes(ASTFileHeader* hdr, const char* map)
+{
+   CNode* nodes = (CNode*) (map + hdr->nodesOff);
+   CNode* node;
+   unsigned int i, k;
+   CNodeId c;
+   for (i=0; i < hdr->numNodes; i++) {
+      node = &nodes[i];
+      if (node->next >= hdr->numNodes || node->type > AST_RELEXPR ||
+          node->valType > T_RETURNVAL || node->varKind > V_GLARRAY ||
+          (node->name != 0 && node->name >= hdr->numNames))
+         return -1;
+      if (node->next != CNONE && node->next <= i)
+         return -1;
+      if (node->type == AST_CONSTANT && node->valType == T_STRING &&
+          (unsigned int) node->ival >= hdr->numStrings)
+         return -1;
+   }
+   // second loop, so that a shared child's own fields are checked
+   for (i=0; i < hdr->numNodes; i++) {
+      for (k=0; k < ASTNUMCHILDREN; k++) {
+         c = nodes[i].child[k];
+         if (c >= hdr->numNodes || c == i ||
+             (c != CNONE && c < i && !shareable(&nodes[c])))
+            return -1;
+      }
+   }
+   return checkAcyclic(nodes, hdr->numNodes);
+}
+
+// Map a binary AST file and return it as a compact AST
+// - returns NULL if the file cannot be read or is not a valid
+//   AST file for this build
+// - freeCompactAST() unmaps it
+CompactAST* loadASTFile(const char* fileName)
+{
+   struct stat st;
+   ASTFileHeader* hdr;
+   CompactAST* ast;
+   const char *name, *end;
+   Atom* atoms;
+   char* map;
+   size_t size;
+   unsigned int i;
+   int renumber = 0;
+   int fd = open(fileName, O_RDONLY);
+   if (fd < 0)
+      return 0;
+   if (fstat(fd, &st) < 0 || st.st_size < (off_t) sizeof(ASTFileHeader)) {
+      close(fd);
+      return 0;
+   }
+   size = st.st_size;
+   map = mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+   close(fd);
+   if (map == MAP_FAILED)
+      return 0;
+   hdr = (ASTFileHeader*) map;
+   if (checkHeader(hdr, map, size) != 0 || checkNodes(hdr, map) != 0) {
+      munmap(map, size);
+      return 0;
+   }
+   // intern the names in atom order; names are checked to end in the
+   // file, and the last one ends at the last byte (see checkHeader)
+   atoms = (Atom*) malloc((hdr->numNames+1) * sizeof(Atom));
+   name = map + hdr->namesOff;
+   end = map + size;
+   for (i=0; i < hdr->numNames; i++) {
+      size_t len = name < end ? strlen(name) : 0;
+      if (name >= end) {
+         free(atoms);
+         munmap(map, size);
+         return 0;
+      }
+      atoms[i] = internAtom(name, len);
+      renumber |= atoms[i] != i;
+      name += len + 1;
+   }
+   ast = (CompactAST*) calloc(1, sizeof(CompactAST));
+   ast->nodes = (CNode*) (map + hdr->nodesOff);
+   ast->numNodes = hdr->numNodes;
+   ast->capNodes = 0; // not owned: the nodes are in the mapping
+   ast->strOffsets = (unsigned int*) (map + hdr->stringsOff);
+   ast->numStrings = ast->capStrings = hdr->numStrings;
+   ast->strPool = map + hdr->poolOff;
+   ast->poolLen = ast->poolCap = hdr->poolLen;
+   ast->root = hdr->root;
+   ast->map = map;
+   ast->mapSize = size;
+   if (renumber) {
+      CNode* nodes = (CNode*) malloc(ast->numNodes * sizeof(CNode));
+      memcpy(nodes, ast->nodes, ast->numNodes * sizeof(CNode));
+      for (i=0; i < ast->numNodes; i++)
+         if (nodes[i].name < hdr->numNames)
+            nodes[i].name = atoms[nodes[i].name];
+      ast->nodes = nodes;
+      ast->capNodes = ast->numNodes;
+   }
+   free(atoms);
+   return ast;
+}
@@ -0,0 +1,34 @@
+//
+// Binary AST File Interface
+// - saves a compact AST (see astree.h) in a file (file.jast) that a
+//   later run can map into memory and generate code from directly,
+//   without scanning or parsing, and without decoding the nodes (one
+//   pass only checks that their fields are in range and that their
+//   links make no cycle)
+// - the node array is stored exactly as it is in memory; node names
+//   are atoms, so the file also holds the text of every atom in atom
+//   order, and loading interns them in that order (into an empty
+//   atom table that gives every atom its old number back)
+// - the file is in host byte order and struct layout; the header
+//   records the layout it was written with and a file that does not
+//   match is rejected
+//
+// File layout (all offsets are from the start of the file):
+//   header:  a fixed struct with the magic "JAST", version, CNode
+//            size, counts, and the offset of each section below
+//   nodes:   numNodes CNode structs in visiting order (node 0 is the
+//            unused CNONE)
+//   strings: numStrings unsigned ints, each the pool offset+1 of a
+//            string constant's text (0 if there is no such string)
+//   pool:    string constant text, each null terminated
+//   names:   numNames null terminated atom names, atom 0 first
+//
+#ifndef ASTFILE_H
+#define ASTFILE_H
+
+#include "astree.h"
+
+int writeASTFile(CompactAST* ast, const char* fileName);
+CompactAST* loadASTFile(const char* fileName);
+
+#endif
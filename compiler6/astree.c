@@ -8,12 +8,27 @@
 // - a special "child" node (the AST is a tree) uses
 //   the "next" pointer to point to a "sibling"-type
 //   node that is the next in a list (such as statements)
+// - all nodes and their strings are allocated from one arena, so
+//   freeing the tree is a single arena release
 //
 // Copyright (C) 2024 Jonathan Cook
 //
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "arena.h"
 #include "astree.h"
+#include "vcode.h"
+#include "ir.h"
+#include "iropt.h"
+#include "passes.h"
+
+#define ASTCHUNKSIZE 262144
+#define INITCNODES 1024
+
+// arena that holds every node and node string of this compilation
+static Arena astArena = { 0, ASTCHUNKSIZE, 0, 0 };
 
 // Create a new AST node 
 // - allocates space and initializes node type, zeros other stuff out
@@ -21,21 +36,240 @@
 ASTNode* newASTNode(ASTNodeType type)
 {
    int i;
-   ASTNode* node = (ASTNode*) malloc(sizeof(ASTNode));
+   ASTNode* node = (ASTNode*) arenaAlloc(&astArena, sizeof(ASTNode));
    if (node == NULL)
       return NULL;
    node->type = type;
    node->valType = T_INT;
    node->varKind = V_GLOBAL;
    node->ival = 0;
+   node->name = 0;
+   node->consed = 0;
    node->strval = 0;
-   node->strNeedsFreed = 0;
    node->next = 0;
    for (i=0; i < ASTNUMCHILDREN; i++)
       node->child[i] = 0;
    return node;
 }
 
+// Copy len chars of str into the tree's arena (null terminated)
+// - use this for a node's strval; it is freed along with the tree
+char* newASTString(const char* str, int len)
+{
+   return arenaStrndup(&astArena, str, len);
+}
+
+// Reverse a sibling list (linked by next) in place
+// - returns the new first node (the old last one)
+ASTNode* reverseASTList(ASTNode* list)
+{
+   ASTNode *prev = 0, *next;
+   while (list) {
+      next = list->next;
+      list->next = prev;
+      prev = list;
+      list = next;
+   }
+   return prev;
+}
+
+// Hash-consing factory state
+// - live nodes are kept in a dense entry array, indexed by an open
+//   addressing table of entry numbers (-1 is empty); each entry has a
+//   mask of the variables its value reads, one bit per atom number
+//   mod 62, plus bits for globals and for the last call's return
+//   value, so a store or call only has to drop entries whose mask
+//   overlaps (extra drops from shared bits just lose some sharing)
+// - the table is capped at CONSMAX entries and simply starts over
+//   when full, which also bounds the cost of each drop
+#define CONSMAX 512
+#define CONSSLOTS (2*CONSMAX)   // power of two
+#define READSGLOBAL  1ULL
+#define READSRETURN  2ULL
+#define READSVAR(name) (4ULL << ((name) % 62))
+
+typedef struct {
+   unsigned int hash;
+   ASTNode* node;
+   unsigned long long reads;
+} ConsEntry;
+
+static ConsEntry consEntries[CONSMAX];
+static int consSlots[CONSSLOTS];
+static int consUsed = -1;  // -1 until consSlots is first cleared
+static unsigned long long consReads; // union of all entry masks
+static unsigned int consShared;
+
+// Forget every consed node, so none is handed out again
+// - call at each block boundary (see astree.h)
+void consASTReset()
+{
+   if (consUsed == 0)
+      return;
+   memset(consSlots, -1, sizeof(consSlots));
+   consUsed = 0;
+   consReads = 0;
+}
+
+// Number of times the factory handed back an existing node
+unsigned int consASTShared()
+{
+   return consShared;
+}
+
+static unsigned int consHash(ASTNode* n)
+{
+   unsigned long h = n->type;
+   h = h * 31 + n->valType;
+   h = h * 31 + n->varKind;
+   h = h * 31 + (unsigned int) n->ival;
+   h = h * 31 + n->name;
+   h = h * 31 + (unsigned long) n->child[0];
+   h = h * 31 + (unsigned long) n->child[1];
+   return (unsigned int) (h ^ (h >> 29));
+}
+
+static int consEqual(ASTNode* a, ASTNode* b)
+{
+   return a->type == b->type && a->valType == b->valType &&
+          a->varKind == b->varKind && a->ival == b->ival &&
+          a->name == b->name && a->child[0] == b->child[0] &&
+          a->child[1] == b->child[1];
+}
+
+// Put entry e in its slot
+static void consInsertSlot(int e)
+{
+   unsigned int i = consEntries[e].hash & (CONSSLOTS-1);
+   while (consSlots[i] >= 0)
+      i = (i+1) & (CONSSLOTS-1);
+   consSlots[i] = e;
+}
+
+// Return the live node equal to the key node, or make one
+// - key is a filled in node on the stack; reads is its read mask
+static ASTNode* consNode(ASTNode* key, unsigned long long reads)
+{
+   unsigned int hash = consHash(key);
+   unsigned int i = hash & (CONSSLOTS-1);
+   ASTNode* node;
+   int e;
+   if (consUsed < 0 || consUsed == CONSMAX) {
+      consUsed = -1;
+      consASTReset();
+   }
+   while ((e = consSlots[i]) >= 0) {
+      if (consEntries[e].hash == hash && consEqual(consEntries[e].node, key)) {
+         consShared++;
+         return consEntries[e].node;
+      }
+      i = (i+1) & (CONSSLOTS-1);
+   }
+   node = newASTNode(key->type);
+   *node = *key;
+   node->consed = 1;
+   e = consUsed++;
+   consEntries[e].hash = hash;
+   consEntries[e].node = node;
+   consEntries[e].reads = reads;
+   consSlots[i] = e;
+   consReads |= reads;
+   return node;
+}
+
+// Drop every entry whose value reads something in kill
+static void consKill(unsigned long long kill)
+{
+   int e, live = 0;
+   if (consUsed <= 0 || !(consReads & kill))
+      return;
+   consReads = 0;
+   for (e=0; e < consUsed; e++) {
+      if (consEntries[e].reads & kill)
+         continue;
+      consEntries[live++] = consEntries[e];
+      consReads |= consEntries[e].reads;
+   }
+   consUsed = live;
+   memset(consSlots, -1, sizeof(consSlots));
+   for (e=0; e < consUsed; e++)
+      consInsertSlot(e);
+}
+
+// Mask of what a consed node's value reads (0 for other nodes)
+static unsigned long long consReadsOf(ASTNode* node)
+{
+   unsigned long long reads;
+   if (!node || !node->consed)
+      return 0;
+   switch (node->type) {
+    case AST_VARREF:
+       reads = READSVAR(node->name) | consReadsOf(node->child[0]);
+       if (node->varKind == V_GLOBAL || node->varKind == V_GLARRAY)
+          reads |= READSGLOBAL;
+       return reads;
+    case AST_CONSTANT:
+       return node->valType == T_RETURNVAL ? READSRETURN : 0;
+    default:
+       return consReadsOf(node->child[0]) | consReadsOf(node->child[1]);
+   }
+}
+
+// Make (or share) an int constant or return value node
+// - type is T_INT or T_RETURNVAL
+ASTNode* consASTConstant(int value, DataType type)
+{
+   ASTNode key;
+   memset(&key, 0, sizeof(key));
+   key.type = AST_CONSTANT;
+   key.valType = type;
+   key.varKind = V_GLOBAL;
+   key.ival = value;
+   return consNode(&key, type == T_RETURNVAL ? READSRETURN : 0);
+}
+
+// Make (or share) a variable read; index is the array index
+// expression for an array element, or NULL
+ASTNode* consASTVarRef(Atom name, VariableKind kind, int offset, ASTNode* index)
+{
+   ASTNode key;
+   memset(&key, 0, sizeof(key));
+   key.type = AST_VARREF;
+   key.valType = T_INT;
+   key.varKind = kind;
+   key.ival = offset;
+   key.name = name;
+   key.child[0] = index;
+   return consNode(&key, consReadsOf(index) | READSVAR(name) |
+                         (kind == V_GLOBAL || kind == V_GLARRAY ? READSGLOBAL : 0));
+}
+
+// Make (or share) a binary expression node; op is the ADDOP char
+ASTNode* consASTExpression(int op, ASTNode* left, ASTNode* right)
+{
+   ASTNode key;
+   memset(&key, 0, sizeof(key));
+   key.type = AST_EXPRESSION;
+   key.valType = T_INT;
+   key.varKind = V_GLOBAL;
+   key.ival = op;
+   key.child[0] = left;
+   key.child[1] = right;
+   return consNode(&key, consReadsOf(left) | consReadsOf(right));
+}
+
+// Note a store to variable name (or an element of array name)
+void consASTStore(Atom name)
+{
+   consKill(READSVAR(name));
+}
+
+// Note a function call, which may change globals and the return value
+void consASTCall()
+{
+   consKill(READSGLOBAL | READSRETURN);
+}
+
 // Generate an indentation string prefix
 // - this is a helper function for use in printing the abstract
 //   syntax tree with indentation used to indicate tree depth.
@@ -52,153 +286,1486 @@ static char* levelPrefix(int level)
 }
 
 // Free an entire ASTree, along with string data it has
-// - a node must have strNeedsFreed to non-zero in order 
-//   for its strval to be freed
+// - releases the whole arena, so this frees every node made since
+//   the last call, not just the nodes under the given one
 void freeASTree(ASTNode* node)
 {
-   if (!node)
+   freeArena(&astArena);
+}
+
+// Bytes the pointer trees (nodes and strings) use right now
+size_t astBytesUsed()
+{
+   return arenaBytesUsed(&astArena);
+}
+
+// Append a zeroed node to a compact AST and return its index
+// - may move the node array, so do not hold CNode pointers across it
+static CNodeId newCNode(CompactAST* ast)
+{
+   if (ast->numNodes == ast->capNodes) {
+      ast->capNodes *= 2;
+      ast->nodes = (CNode*) realloc(ast->nodes, ast->capNodes * sizeof(CNode));
+   }
+   memset(&ast->nodes[ast->numNodes], 0, sizeof(CNode));
+   return ast->numNodes++;
+}
+
+// Put the text of string id sid in the compact AST's string table
+static void setCompactString(CompactAST* ast, int sid, const char* str)
+{
+   unsigned int len = strlen(str) + 1;
+   if (sid < 0)
+      return;
+   if (sid >= ast->numStrings) {
+      if (sid >= ast->capStrings) {
+         while (sid >= ast->capStrings)
+            ast->capStrings = ast->capStrings ? ast->capStrings * 2 : 64;
+         ast->strOffsets = (unsigned int*) realloc(ast->strOffsets,
+                                      ast->capStrings * sizeof(unsigned int));
+      }
+      memset(ast->strOffsets + ast->numStrings, 0,
+             (sid+1 - ast->numStrings) * sizeof(unsigned int));
+      ast->numStrings = sid+1;
+   }
+   if (ast->poolLen + len > ast->poolCap) {
+      while (ast->poolLen + len > ast->poolCap)
+         ast->poolCap = ast->poolCap ? ast->poolCap * 2 : 4096;
+      ast->strPool = (char*) realloc(ast->strPool, ast->poolCap);
+   }
+   memcpy(ast->strPool + ast->poolLen, str, len);
+   ast->strOffsets[sid] = ast->poolLen + 1;
+   ast->poolLen += len;
+}
+
+// Copy a pointer tree into the compact AST, returning the index of
+// its first node (or CNONE)
+// - works off an explicit stack of lists still to copy, each with
+//   the index (owner) and field (child slot, or LINKNEXT) that must
+//   point to it; the stack only grows with nesting depth, since the
+//   rest of a sibling list is one entry no matter how long it is
+// - lists are popped so that nodes come out in visiting order: a
+//   node, its children's subtrees in order, then its next sibling
+#define LINKNEXT ASTNUMCHILDREN
+typedef struct {
+   ASTNode* node;
+   CNodeId owner;
+   int link;
+} FlattenItem;
+
+// Compact copies of consed nodes already made, by node address,
+// so a shared node is copied only once (open addressing, grown at
+// half full)
+typedef struct {
+   ASTNode** nodes;
+   CNodeId* ids;
+   unsigned int size, used;
+} SharedCopies;
+
+static unsigned int sharedSlot(SharedCopies* m, ASTNode* node)
+{
+   unsigned int i = (unsigned int) (((unsigned long) node >> 4) * 2654435761u);
+   i &= m->size - 1;
+   while (m->nodes[i] && m->nodes[i] != node)
+      i = (i+1) & (m->size - 1);
+   return i;
+}
+
+static void addSharedCopy(SharedCopies* m, ASTNode* node, CNodeId id)
+{
+   unsigned int i, j, oldSize = m->size;
+   ASTNode** oldNodes = m->nodes;
+   CNodeId* oldIds = m->ids;
+   if (2 * (m->used+1) > m->size) {
+      m->size = m->size ? m->size * 2 : 256;
+      m->nodes = (ASTNode**) calloc(m->size, sizeof(ASTNode*));
+      m->ids = (CNodeId*) malloc(m->size * sizeof(CNodeId));
+      for (i=0; i < oldSize; i++) {
+         if (!oldNodes[i])
+            continue;
+         j = sharedSlot(m, oldNodes[i]);
+         m->nodes[j] = oldNodes[i];
+         m->ids[j] = oldIds[i];
+      }
+      free(oldNodes);
+      free(oldIds);
+   }
+   i = sharedSlot(m, node);
+   m->nodes[i] = node;
+   m->ids[i] = id;
+   m->used++;
+}
+
+static CNodeId findSharedCopy(SharedCopies* m, ASTNode* node)
+{
+   unsigned int i;
+   if (!m->size)
+      return CNONE;
+   i = sharedSlot(m, node);
+   return m->nodes[i] ? m->ids[i] : CNONE;
+}
+
+static CNodeId flattenTree(CompactAST* ast, ASTNode* tree)
+{
+   FlattenItem* stack;
+   int top = 0, cap = 64, i;
+   FlattenItem item;
+   SharedCopies shared = { 0, 0, 0, 0 };
+   ASTNode* node;
+   CNodeId id, first = CNONE;
+   CNode* c;
+   int copied;
+   if (!tree)
+      return CNONE;
+   stack = (FlattenItem*) malloc(cap * sizeof(FlattenItem));
+   stack[top].node = tree;
+   stack[top].owner = CNONE;
+   stack[top++].link = LINKNEXT;
+   while (top > 0) {
+      item = stack[--top];
+      node = item.node;
+      id = node->consed ? findSharedCopy(&shared, node) : CNONE;
+      copied = id != CNONE;
+      if (!copied) {
+         id = newCNode(ast);
+         c = &ast->nodes[id];
+         c->type = node->type;
+         c->valType = node->valType;
+         c->varKind = node->varKind;
+         c->ival = node->ival;
+         c->name = node->name;
+         if (node->type == AST_CONSTANT && node->valType == T_STRING && node->strval)
+            setCompactString(ast, node->ival, node->strval);
+         if (node->consed)
+            addSharedCopy(&shared, node, id);
+      }
+      if (item.owner == CNONE)
+         first = id;
+      else if (item.link == LINKNEXT)
+         ast->nodes[item.owner].next = id;
+      else
+         ast->nodes[item.owner].child[item.link] = id;
+      if (copied)
+         continue; // its subtree is already there
+      if (top + ASTNUMCHILDREN+1 > cap) {
+         cap *= 2;
+         stack = (FlattenItem*) realloc(stack, cap * sizeof(FlattenItem));
+      }
+      // push in reverse of the order they are to be copied in
+      if (node->next) {
+         stack[top].node = node->next;
+         stack[top].owner = id;
+         stack[top++].link = LINKNEXT;
+      }
+      for (i=ASTNUMCHILDREN-1; i >= 0; i--) {
+         if (!node->child[i])
+            continue;
+         stack[top].node = node->child[i];
+         stack[top].owner = id;
+         stack[top++].link = i;
+      }
+   }
+   free(stack);
+   free(shared.nodes);
+   free(shared.ids);
+   return first;
+}
+
+// Make a compact copy of a pointer tree (see astree.h)
+// - the pointer tree is not changed and can be freed afterwards
+// - tree may be NULL, which gives an empty compact AST
+CompactAST* compactASTree(ASTNode* tree)
+{
+   CompactAST* ast = (CompactAST*) calloc(1, sizeof(CompactAST));
+   ast->capNodes = INITCNODES;
+   ast->nodes = (CNode*) malloc(ast->capNodes * sizeof(CNode));
+   newCNode(ast); // index 0 is CNONE
+   ast->root = flattenTree(ast, tree);
+   return ast;
+}
+
+// Free a compact AST and everything in it
+void freeCompactAST(CompactAST* ast)
+{
+   if (!ast)
+      return;
+   if (ast->map) {
+      if (ast->capNodes)
+         free(ast->nodes);
+      munmap(ast->map, ast->mapSize);
+   } else {
+      free(ast->nodes);
+      free(ast->strOffsets);
+      free(ast->strPool);
+   }
+   free(ast);
+}
+
+// Bytes a compact AST uses (counting only the parts in use)
+size_t compactASTBytes(CompactAST* ast)
+{
+   return sizeof(CompactAST) + ast->numNodes * sizeof(CNode) +
+          ast->numStrings * sizeof(unsigned int) + ast->poolLen;
+}
+
+// Text of string constant sid ("" if there is no such string)
+const char* compactASTString(CompactAST* ast, int sid)
+{
+   if (sid < 0 || sid >= ast->numStrings || !ast->strOffsets[sid])
+      return "";
+   return ast->strPool + ast->strOffsets[sid] - 1;
+}
+
+// Explicit stack for the tree walkers below
+// - each frame is a node being worked on, and phase counts how many
+//   of its parts (children, and the output between them) are done
+// - when a node is done, its frame moves on to the node's next
+//   sibling, so the stack grows with nesting depth, not list length
+typedef struct {
+   CNodeId id;
+   int hval;   // level when printing, helper value in code generation
+   int phase;
+   int label1, label2;
+} WalkFrame;
+
+typedef struct {
+   WalkFrame* frames;
+   int top, cap;
+} WalkStack;
+
+// Push a frame to start on node id (nothing is pushed for CNONE)
+// - may move the frames, so do not hold WalkFrame pointers across it
+static void pushWalk(WalkStack* ws, CNodeId id, int hval)
+{
+   WalkFrame* f;
+   if (id == CNONE)
+      return;
+   if (ws->top == ws->cap) {
+      ws->cap = ws->cap ? ws->cap * 2 : 64;
+      ws->frames = (WalkFrame*) realloc(ws->frames, ws->cap * sizeof(WalkFrame));
+   }
+   f = &ws->frames[ws->top++];
+   f->id = id;
+   f->hval = hval;
+   f->phase = 0;
+   f->label1 = f->label2 = 0;
+}
+
+// Finish the top frame's node: move on to its next sibling (with
+// helper value hval), or pop the frame at the end of the list
+static void nextWalk(WalkStack* ws, CNode* node, int hval)
+{
+   WalkFrame* f = &ws->frames[ws->top-1];
+   if (node->next == CNONE) {
+      ws->top--;
       return;
-   freeASTree(node->child[0]);
-   freeASTree(node->child[1]);
-   freeASTree(node->child[2]);
-   freeASTree(node->next);
-   if (node->strNeedsFreed && node->strval) 
-      free(node->strval);
-   free(node);
+   }
+   f->id = node->next;
+   f->hval = hval;
+   f->phase = 0;
 }
 
 // Print the abstract syntax tree starting at the given node
-// - this is a recursive function, your initial call should 
-//   pass 0 in for the level parameter
+// - your initial call should pass 0 in for the level parameter
 // - comments in code indicate types of nodes and where they
 //   are expected; this helps you understand what the AST looks like
 // - "out" is the file to output to, can be "stdout" or other file handle
-void printASTree(ASTNode* node, int level, FILE *out)
+// - children are printed by pushing them on the walk stack and
+//   coming back to the node (in its next phase) when they are done
+void printASTree(CompactAST* ast, CNodeId id, int level, FILE *out)
+{
+   WalkStack ws = { 0, 0, 0 };
+   WalkFrame* f;
+   CNode* node;
+   pushWalk(&ws,id,level);
+   while (ws.top > 0) {
+      f = &ws.frames[ws.top-1];
+      node = &ast->nodes[f->id];
+      level = f->hval;
+      if (f->phase == 0)
+         fprintf(out,"%s",levelPrefix(level)); // note: no newline printed here!
+      switch (node->type) {
+       case AST_PROGRAM:
+          if (f->phase == 0) {
+             fprintf(out,"Whole Program AST:\n");
+             fprintf(out,"%s--globalvars--\n",levelPrefix(level+1));
+             f->phase = 1;
+             pushWalk(&ws,node->child[0],level+1);  // child 0 is global var decls
+             continue;
+          }
+          if (f->phase == 1) {
+             fprintf(out,"%s--functions--\n",levelPrefix(level+1));
+             f->phase = 2;
+             pushWalk(&ws,node->child[1],level+1);  // child 1 is function defs
+             continue;
+          }
+          if (f->phase == 2) {
+             fprintf(out,"%s--program--\n",levelPrefix(level+1));
+             f->phase = 3;
+             pushWalk(&ws,node->child[2],level+1);  // child 2 is program
+             continue;
+          }
+          break;
+       case AST_VARDECL:
+          fprintf(out,"Variable declaration (%s)",atomName(node->name)); // var name
+          if (node->valType == T_INT)
+             if (node->varKind != V_GLARRAY)
+                fprintf(out," type int\n");
+             else
+                fprintf(out," type int array size %d\n",node->ival);
+          else if (node->valType == T_LONG)
+             fprintf(out," type long\n");
+          else if (node->valType == T_STRING)
+             fprintf(out," type string\n");
+          else
+             fprintf(out," type unknown (%d)\n", node->valType);
+          break;
+       case AST_FUNCTION:
+          if (f->phase == 0) {
+             fprintf(out,"Function def (%s)\n",atomName(node->name)); // function name
+             fprintf(out,"%s--params--\n",levelPrefix(level+1));
+             f->phase = 1;
+             pushWalk(&ws,node->child[0],level+1); // child 0 is param list
+             continue;
+          }
+          if (f->phase == 1) {
+             fprintf(out,"%s--locals--\n",levelPrefix(level+1));
+             f->phase = 2;
+             pushWalk(&ws,node->child[2],level+1); // child 2 is local vars
+             continue;
+          }
+          if (f->phase == 2) {
+             fprintf(out,"%s--body--\n",levelPrefix(level+1));
+             f->phase = 3;
+             pushWalk(&ws,node->child[1],level+1); // child 1 is body (stmt list)
+             continue;
+          }
+          break;
+       case AST_SBLOCK:
+          if (f->phase == 0) {
+             fprintf(out,"Statement block\n"); // we don't use this type
+             f->phase = 1;
+             pushWalk(&ws,node->child[0],level+1);  // child 0 is statement list
+             continue;
+          }
+          break;
+       case AST_FUNCALL:
+          if (f->phase == 0) {
+             fprintf(out,"Function call (%s)\n",atomName(node->name)); // func name
+             f->phase = 1;
+             pushWalk(&ws,node->child[0],level+1);  // child 0 is argument list
+             continue;
+          }
+          break;
+       case AST_ARGUMENT:
+          if (f->phase == 0) {
+             fprintf(out,"Funcall argument\n");
+             f->phase = 1;
+             pushWalk(&ws,node->child[0],level+1);  // child 0 is argument expr
+             continue;
+          }
+          break;
+       case AST_ASSIGNMENT:
+          if (f->phase == 0) {
+             fprintf(out,"Assignment to (%s) ", atomName(node->name));
+             f->phase = 1;
+             if (node->varKind == V_GLARRAY) { //child[1]) {
+                fprintf(out,"array var\n");
+                fprintf(out,"%s--index--\n",levelPrefix(level+1));
+                pushWalk(&ws,node->child[1],level+1);
+                continue;
+             } else
+                fprintf(out,"simple var\n");
+          }
+          if (f->phase == 1) {
+             fprintf(out,"%s--right hand side--\n",levelPrefix(level+1));
+             f->phase = 2;
+             pushWalk(&ws,node->child[0],level+1);  // child 0 is right hand side
+             continue;
+          }
+          break;
+       case AST_WHILE:
+          if (f->phase == 0) {
+             fprintf(out,"While loop\n");
+             f->phase = 1;
+             pushWalk(&ws,node->child[0],level+1);  // child 0 is condition expr
+             continue;
+          }
+          if (f->phase == 1) {
+             fprintf(out,"%s--body--\n",levelPrefix(level+1));
+             f->phase = 2;
+             pushWalk(&ws,node->child[1],level+1);  // child 1 is loop body
+             continue;
+          }
+          break;
+       case AST_IFTHEN:
+          if (f->phase == 0) {
+             fprintf(out,"If then\n");
+             f->phase = 1;
+             pushWalk(&ws,node->child[0],level+1);  // child 0 is condition expr
+             continue;
+          }
+          if (f->phase == 1) {
+             fprintf(out,"%s--ifpart--\n",levelPrefix(level+1));
+             f->phase = 2;
+             pushWalk(&ws,node->child[1],level+1);  // child 1 is if body
+             continue;
+          }
+          if (f->phase == 2) {
+             fprintf(out,"%s--elsepart--\n",levelPrefix(level+1));
+             f->phase = 3;
+             pushWalk(&ws,node->child[2],level+1);  // child 2 is else body
+             continue;
+          }
+          break;
+       case AST_EXPRESSION: // only for binary op expression
+       case AST_RELEXPR: // only for relational op expression
+          if (f->phase == 0) {
+             if (node->type == AST_EXPRESSION)
+                fprintf(out,"Expression (op %d,%c)\n",node->ival,node->ival);
+             else
+                fprintf(out,"Relational Expression (op %d,%c)\n",node->ival,node->ival);
+             f->phase = 1;
+             pushWalk(&ws,node->child[0],level+1);  // child 0 is left side
+             continue;
+          }
+          if (f->phase == 1) {
+             f->phase = 2;
+             pushWalk(&ws,node->child[1],level+1);  // child 1 is right side
+             continue;
+          }
+          break;
+       case AST_VARREF:
+          if (f->phase == 0) {
+             fprintf(out,"Variable ref (%s)",atomName(node->name)); // var name
+             if (node->varKind == V_GLARRAY) { //child[0]) {
+                fprintf(out," array ref\n");
+                f->phase = 1;
+                pushWalk(&ws,node->child[0],level+1);
+                continue;
+             } else 
+                fprintf(out,"\n");
+          }
+          break;
+       case AST_CONSTANT: // for both int and string constants
+          if (node->valType == T_INT)
+             fprintf(out,"Int Constant = %d\n",node->ival);
+          else if (node->valType == T_STRING)
+             fprintf(out,"String Constant = (%s)\n",compactASTString(ast,node->ival));
+          else if (node->valType == T_RETURNVAL)
+             fprintf(out, "Return Value\n");
+          else 
+             fprintf(out,"Unknown Constant\n");
+          break;
+       default:
+          fprintf(out,"Unknown AST node!\n");
+      }
+      // IMPORTANT: walks down sibling list (for nodes that form lists, like
+      // declarations, functions, parameters, arguments, and statements)
+      nextWalk(&ws,node,level);
+   }
+   free(ws.frames);
+}
+
+//
+// Below here is code for generating our output assembly code from
+// an AST. You will probably want to move some things from the
+// grammar file (.y file) over here, since you will no longer be 
+// generating code in the grammar file. You may have some global 
+// stuff that needs accessed from both, in which case declare it in
+// one and then use "extern" to reference it in the other.
+
+// Used for labels inside code, for loops and conditionals
+int getUniqueLabelID()
+{
+   static int lid = 100; // you can start at 0, it really doesn't matter
+   return lid++;
+}
+
+static unsigned int codeGenFlags = 0;
+static IRGlobals* irGlobals = 0; // globals known program-wide, for sccp
+
+// Set the code generator options (CG_ bits, see astree.h)
+void setCodeGenFlags(unsigned int flags)
+{
+   codeGenFlags = flags;
+}
+
+//
+// Stack frames: fp points at the saved ra, the caller's fp is at
+// 4(fp), and parameters and locals follow, one word each, in the
+// order they were declared (their ival); a frame is only as big as
+// its function needs (see frameSize())
+// - a slot past the reach of a load or store's 12-bit offset is
+//   addressed by adding its offset to fp in a register
+// - a small leaf function (no calls) has no frame at all, with
+//   CG_LEAF: each slot lives in a register instead (its home), a
+//   parameter that is never assigned in its argument register, and
+//   the others in t6, t5, ... t2 (see framelessLeaf())
+//
+#define FRAMEOFFSET(slot) (((slot)+2)*4)
+#define MAXIMM 2047   // largest 12-bit immediate
+
+#define MAXHOMES 8    // slots a frameless leaf can have
+#define LEAFTEMPS 5   // t6-t2, the homes of slots not in an a register
+
+// Print "op reg, <slot>" for a load or store of a frame slot
+// - a slot with a home register (home != 0) is a move instead
+// - scratch is a register free to use for the address
+static void frameAccess(const char* op, const char* reg, int slot, int home,
+                        const char* scratch, FILE* out)
 {
-   if (!node)
+   int offset = FRAMEOFFSET(slot);
+   if (home) {
+      if (op[0] == 'l')
+         fprintf(out, "\tmv\t%s, %s\n", reg, vcodeRegName(home));
+      else
+         fprintf(out, "\tmv\t%s, %s\n", vcodeRegName(home), reg);
       return;
-   fprintf(out,"%s",levelPrefix(level)); // note: no newline printed here!
-   switch (node->type) {
-    case AST_PROGRAM:
-       fprintf(out,"Whole Program AST:\n");
-       fprintf(out,"%s--globalvars--\n",levelPrefix(level+1));
-       printASTree(node->child[0],level+1,out);  // child 0 is global var decls
-       fprintf(out,"%s--functions--\n",levelPrefix(level+1));
-       printASTree(node->child[1],level+1,out);  // child 1 is function defs
-       fprintf(out,"%s--program--\n",levelPrefix(level+1));
-       printASTree(node->child[2],level+1,out);  // child 2 is program
-       break;
-    case AST_VARDECL:
-       fprintf(out,"Variable declaration (%s)",node->strval); // var name
-       if (node->valType == T_INT)
-          if (node->varKind != V_GLARRAY)
-             fprintf(out," type int\n");
+   }
+   if (offset <= MAXIMM) {
+      fprintf(out, "\t%s\t%s, %d(fp)\n", op, reg, offset);
+      return;
+   }
+   fprintf(out, "\tli\t%s, %d\n\tadd\t%s, fp, %s\n", scratch, offset, scratch, scratch);
+   fprintf(out, "\t%s\t%s, 0(%s)\n", op, reg, scratch);
+}
+
+//
+// Expression code with virtual registers (CG_REGALLOC)
+// - each assignment, argument and condition is lowered as a whole
+//   into a VCode buffer (see vcode.h), allocated, and printed, in
+//   place of the push/pop stack code in genCodeFromASTree()
+// - operands are evaluated in the same order as the stack code,
+//   or with CG_SETHIULLMAN, the operand that needs more registers
+//   (by its Sethi-Ullman number) first; the expressions have no
+//   side effects, so the order does not change what they compute
+//
+
+// Lowering state: the buffer, an explicit stack for walking
+// expression trees, and the registers statements may use
+typedef struct {
+   CNodeId id;
+   int phase;
+   int first;      // register of the operand done first, once done
+   int rightFirst; // the right operand is done first
+} ExprFrame;
+
+typedef struct {
+   VCode vc;
+   ExprFrame* frames;
+   int top, cap;
+   unsigned int pool;
+   int numHomes;        // slots kept in registers (a frameless leaf)
+   unsigned char homes[MAXHOMES]; // and the register of each
+   unsigned char* need; // Sethi-Ullman number per node (0 = not yet),
+                        // or NULL for left to right order
+} ExprGen;
+
+static void pushExpr(ExprGen* eg, CNodeId id)
+{
+   if (eg->top == eg->cap) {
+      eg->cap = eg->cap ? eg->cap * 2 : 64;
+      eg->frames = (ExprFrame*) realloc(eg->frames, eg->cap * sizeof(ExprFrame));
+   }
+   eg->frames[eg->top].id = id;
+   eg->frames[eg->top++].phase = 0;
+}
+
+// Give every node of expression id its Sethi-Ullman number: the
+// registers its code needs with the needier operand done first
+// (1 for a leaf; the larger of the two operands' needs, or one
+// more than that if they are equal; an array element needs two, for
+// its index and base address, or what its index needs)
+// - nodes may be shared, so a node already numbered is skipped
+static void labelExpr(ExprGen* eg, CompactAST* ast, CNodeId id)
+{
+   unsigned char* need = eg->need;
+   ExprFrame* f;
+   CNode* node;
+   int i, l, r, n;
+   eg->top = 0;
+   pushExpr(eg, id);
+   while (eg->top > 0) {
+      f = &eg->frames[eg->top-1];
+      node = &ast->nodes[f->id];
+      if (need[f->id]) {
+         eg->top--;
+         continue;
+      }
+      if (f->phase == 0) {
+         f->phase = 1;
+         for (i=0, id=f->id; i < 2; i++)
+            if (node->child[i] != CNONE && !need[node->child[i]])
+               pushExpr(eg, node->child[i]);
+         if (eg->frames[eg->top-1].id != id)
+            continue;
+      }
+      l = node->child[0] != CNONE ? need[node->child[0]] : 0;
+      r = node->child[1] != CNONE ? need[node->child[1]] : 0;
+      if (node->type == AST_EXPRESSION)
+         n = l == r ? l+1 : l > r ? l : r;
+      else if (node->type == AST_VARREF && node->varKind == V_GLARRAY)
+         n = l > 2 ? l : 2;
+      else
+         n = 1;
+      need[f->id] = n < 255 ? n : 255;
+      eg->top--;
+   }
+}
+
+// Should b be lowered before a (it needs more registers)?
+static int needsMore(ExprGen* eg, CNodeId b, CNodeId a)
+{
+   return eg->need && eg->need[b] > eg->need[a];
+}
+
+// Add a frame slot's address to the buffer, as a base register
+// (fp when the slot is in reach) and an offset from it
+static int lowerFrameAddr(ExprGen* eg, int slot, int* offset)
+{
+   int off, addr;
+   *offset = FRAMEOFFSET(slot);
+   if (*offset <= MAXIMM)
+      return R_FP;
+   off = newVReg(&eg->vc);
+   addr = newVReg(&eg->vc);
+   emitVInstr(&eg->vc, VI_LI, off, 0, 0, *offset, 0);
+   emitVInstr(&eg->vc, VI_ADD, addr, R_FP, off, 0, 0);
+   *offset = 0;
+   return addr;
+}
+
+// Add the address of name[index] to the buffer; returns its register
+static int lowerElementAddr(ExprGen* eg, Atom name, int index)
+{
+   int offset = newVReg(&eg->vc), base = newVReg(&eg->vc), addr = newVReg(&eg->vc);
+   emitVInstr(&eg->vc, VI_SLLI, offset, index, 0, 2, 0);
+   emitVInstr(&eg->vc, VI_LA, base, 0, 0, 0, name);
+   emitVInstr(&eg->vc, VI_ADD, addr, base, offset, 0, 0);
+   return addr;
+}
+
+// Add the code for expression id to the buffer
+// - returns the virtual register that holds its value
+// - retReg is the register a return value constant is read from
+static int lowerExpr(ExprGen* eg, CompactAST* ast, CNodeId id, int retReg)
+{
+   ExprFrame* f;
+   CNode* node;
+   int result = R_ZERO, r, base, offset;
+   if (eg->need)
+      labelExpr(eg, ast, id);
+   eg->top = 0;
+   pushExpr(eg, id);
+   while (eg->top > 0) {
+      f = &eg->frames[eg->top-1];
+      node = &ast->nodes[f->id];
+      switch (node->type) {
+       case AST_EXPRESSION:
+          if (f->phase == 0) {
+             f->phase = 1;
+             f->rightFirst = needsMore(eg, node->child[1], node->child[0]);
+             pushExpr(eg, node->child[f->rightFirst ? 1 : 0]);
+             continue;
+          }
+          if (f->phase == 1) {
+             f->first = result;
+             f->phase = 2;
+             pushExpr(eg, node->child[f->rightFirst ? 0 : 1]);
+             continue;
+          }
+          r = newVReg(&eg->vc);
+          if (f->rightFirst)
+             emitVInstr(&eg->vc, node->ival == '+' ? VI_ADD : VI_SUB, r, result, f->first, 0, 0);
           else
-             fprintf(out," type int array size %d\n",node->ival);
-       else if (node->valType == T_LONG)
-          fprintf(out," type long\n");
-       else if (node->valType == T_STRING)
-          fprintf(out," type string\n");
+             emitVInstr(&eg->vc, node->ival == '+' ? VI_ADD : VI_SUB, r, f->first, result, 0, 0);
+          result = r;
+          break;
+       case AST_VARREF:
+          if (node->varKind == V_GLARRAY) {
+             if (f->phase == 0) {
+                f->phase = 1;
+                pushExpr(eg, node->child[0]);
+                continue;
+             }
+             result = lowerElementAddr(eg, node->name, result);
+             r = newVReg(&eg->vc);
+             emitVInstr(&eg->vc, VI_LW, r, result, 0, 0, 0);
+          } else if ((node->varKind == V_PARAM || node->varKind == V_LOCAL) &&
+                     node->ival < eg->numHomes) {
+             result = eg->homes[node->ival]; // read in place
+             break;
+          } else if (node->varKind == V_PARAM || node->varKind == V_LOCAL) {
+             base = lowerFrameAddr(eg, node->ival, &offset);
+             r = newVReg(&eg->vc);
+             emitVInstr(&eg->vc, VI_LW, r, base, 0, offset, 0);
+          } else {
+             r = newVReg(&eg->vc);
+             emitVInstr(&eg->vc, VI_LWG, r, 0, 0, 0, node->name);
+          }
+          result = r;
+          break;
+       default: // AST_CONSTANT
+          r = newVReg(&eg->vc);
+          if (node->valType == T_STRING)
+             emitVInstr(&eg->vc, VI_LASTR, r, 0, 0, node->ival, 0);
+          else if (node->valType == T_RETURNVAL)
+             emitVInstr(&eg->vc, VI_MV, r, retReg, 0, 0, 0);
+          else
+             emitVInstr(&eg->vc, VI_LI, r, 0, 0, node->ival, 0);
+          result = r;
+          break;
+      }
+      eg->top--;
+   }
+   return result;
+}
+
+// Allocate the buffer's registers and print it
+// - busy is the set of registers holding values that must be kept
+static void finishExprCode(ExprGen* eg, unsigned int busy, FILE* out)
+{
+   allocVRegs(&eg->vc, eg->pool & ~busy & ~vcodeRealRegs(&eg->vc));
+   printVCode(&eg->vc, out);
+   resetVCode(&eg->vc);
+}
+
+// Code for an assignment statement
+static void genAssignment(ExprGen* eg, CompactAST* ast, CNode* node, FILE* out)
+{
+   int value, index, base, offset;
+   if (node->varKind == V_GLARRAY) {
+      if (eg->need) {
+         labelExpr(eg, ast, node->child[0]);
+         labelExpr(eg, ast, node->child[1]);
+      }
+      if (needsMore(eg, node->child[1], node->child[0])) {
+         index = lowerExpr(eg, ast, node->child[1], R_A(0));
+         value = lowerExpr(eg, ast, node->child[0], R_A(0));
+      } else {
+         value = lowerExpr(eg, ast, node->child[0], R_A(0));
+         index = lowerExpr(eg, ast, node->child[1], R_A(0));
+      }
+      emitVInstr(&eg->vc, VI_SW, 0, value, lowerElementAddr(eg, node->name, index), 0, 0);
+      finishExprCode(eg, 0, out);
+      return;
+   }
+   value = lowerExpr(eg, ast, node->child[0], R_A(0));
+   if ((node->varKind == V_PARAM || node->varKind == V_LOCAL) &&
+       node->ival < eg->numHomes) {
+      emitVInstr(&eg->vc, VI_MV, eg->homes[node->ival], value, 0, 0, 0);
+   } else if (node->varKind == V_PARAM || node->varKind == V_LOCAL) {
+      base = lowerFrameAddr(eg, node->ival, &offset);
+      emitVInstr(&eg->vc, VI_SW, 0, value, base, offset, 0);
+   } else {
+      emitVInstr(&eg->vc, VI_SWG, 0, value, newVReg(&eg->vc), 0, node->name);
+   }
+   finishExprCode(eg, 0, out);
+}
+
+// Code for argument number argNum of a call: its value goes in
+// register a<argNum>, and the earlier arguments' registers are kept
+static void genArgument(ExprGen* eg, CompactAST* ast, CNode* node, int argNum,
+                        FILE* out)
+{
+   int value = lowerExpr(eg, ast, node->child[0], R_A(argNum));
+   emitVInstr(&eg->vc, VI_MV, R_A(argNum), value, 0, 0, 0);
+   finishExprCode(eg, ((1u << argNum) - 1) << R_A(0), out);
+}
+
+// Code for a condition: branch to label if it holds
+static void genCondition(ExprGen* eg, CompactAST* ast, CNode* node, int label,
+                         FILE* out)
+{
+   int left, right;
+   VOp op;
+   if (eg->need) {
+      labelExpr(eg, ast, node->child[0]);
+      labelExpr(eg, ast, node->child[1]);
+   }
+   if (needsMore(eg, node->child[1], node->child[0])) {
+      right = lowerExpr(eg, ast, node->child[1], R_A(0));
+      left = lowerExpr(eg, ast, node->child[0], R_A(0));
+   } else {
+      left = lowerExpr(eg, ast, node->child[0], R_A(0));
+      right = lowerExpr(eg, ast, node->child[1], R_A(0));
+   }
+   switch (node->ival) {
+     case '!': op = VI_BNE; break;
+     case '>': op = VI_BGT; break;
+     case '<': op = VI_BLT; break;
+     default: op = VI_BEQ;
+   }
+   emitVInstr(&eg->vc, op, 0, left, right, label, 0);
+   finishExprCode(eg, 0, out);
+}
+
+// What a statement list reads, as far as code generation cares
+typedef struct {
+   int returnValue;      // reads a return value somewhere
+   unsigned int params;  // bit k set if it reads parameter k
+   unsigned int assigns; // bit k set if it assigns parameter or local k
+   int calls;            // makes a call (is not a leaf)
+} BodyReads;
+
+// Find what a statement list reads
+// - if the program block reads no return value, it may use a0-a7
+//   as temporaries, since a return value is only read from them by
+//   such a read
+// - a parameter that is never read need not be saved on entry
+static void scanBodyReads(CompactAST* ast, CNodeId id, BodyReads* reads)
+{
+   CNodeId* stack;
+   int top = 0, cap = 64, i;
+   CNode* node;
+   reads->returnValue = 0;
+   reads->params = 0;
+   reads->assigns = 0;
+   reads->calls = 0;
+   if (id == CNONE)
+      return;
+   stack = (CNodeId*) malloc(cap * sizeof(CNodeId));
+   stack[top++] = id;
+   while (top > 0) {
+      node = &ast->nodes[stack[--top]];
+      if (node->type == AST_CONSTANT && node->valType == T_RETURNVAL)
+         reads->returnValue = 1;
+      else if (node->type == AST_VARREF && node->varKind == V_PARAM && node->ival < 32)
+         reads->params |= 1u << node->ival;
+      else if (node->type == AST_FUNCALL)
+         reads->calls = 1;
+      else if (node->type == AST_ASSIGNMENT && node->ival < 32 &&
+               (node->varKind == V_PARAM || node->varKind == V_LOCAL))
+         reads->assigns |= 1u << node->ival;
+      if (top + ASTNUMCHILDREN+1 > cap) {
+         cap *= 2;
+         stack = (CNodeId*) realloc(stack, cap * sizeof(CNodeId));
+      }
+      if (node->next != CNONE)
+         stack[top++] = node->next;
+      for (i=0; i < ASTNUMCHILDREN; i++)
+         if (node->child[i] != CNONE)
+            stack[top++] = node->child[i];
+   }
+   free(stack);
+}
+
+// Is a while condition a constant that always holds? Constant
+// folding leaves one in place of a condition it finds always true
+int alwaysTrue(CompactAST* ast, CNodeId cond)
+{
+   return ast->nodes[cond].type == AST_CONSTANT && ast->nodes[cond].ival != 0;
+}
+
+// Registers the expression code of a statement list may use
+// - a0-a7 only in the program block, and only if it never reads a
+//   return value; a function's caller may read any of them as its
+//   return value, so a function body must leave them as they are
+static unsigned int exprRegPool(BodyReads* reads, int inFunction)
+{
+   return inFunction || reads->returnValue ? TREGS : TREGS | AREGS;
+}
+
+// Number of nodes in a list
+static int listLength(CompactAST* ast, CNodeId id)
+{
+   int n;
+   for (n=0; id != CNONE; id = ast->nodes[id].next)
+      n++;
+   return n;
+}
+
+// Bytes of stack frame a function needs: ra, the caller's fp, and a
+// word for each parameter and local, rounded up to the ABI's 16 byte
+// stack alignment
+static int frameSize(int slots)
+{
+   return ((2 + slots)*4 + 15) & ~15;
+}
+
+// Can a function do without a frame? If so, give its slots homes
+// - it must make no call, so ra survives and nothing needs its
+//   slots in memory, and must read no return value (a0-a7)
+// - a0-a7 must still hold the arguments when it returns, since the
+//   caller may read them as its return value, so only a parameter
+//   that is never assigned stays in its argument register; the
+//   other slots take t6 down to t2, leaving t0 and t1 to the stack
+//   code, and must all fit
+// - a parameter moved out of its argument register is copied on
+//   entry
+static int framelessLeaf(int params, int slots, BodyReads* reads,
+                         ExprGen* eg, FILE* out)
+{
+   static const unsigned char temps[LEAFTEMPS] = { 31, 30, 29, 28, 7 }; // t6-t2
+   int k, t = 0;
+   eg->numHomes = 0;
+   if (!(codeGenFlags & CG_LEAF) || reads->calls || reads->returnValue ||
+       slots > MAXHOMES)
+      return 0;
+   for (k=0; k < slots; k++) {
+      if (k < params && !(reads->assigns & (1u << k)))
+         eg->homes[k] = R_A(k);
+      else if (t < (int) sizeof(temps))
+         eg->homes[k] = temps[t++];
+      else
+         return 0;
+   }
+   for (k=0; k < params; k++)
+      if (eg->homes[k] != R_A(k) && (reads->params & (1u << k)))
+         fprintf(out, "\tmv\t%s, a%d\n", vcodeRegName(eg->homes[k]), k);
+   eg->numHomes = slots;
+   return 1;
+}
+
+// Home register of a slot (0 if it is in the frame)
+static int slotHome(ExprGen* eg, int slot)
+{
+   return slot < eg->numHomes ? eg->homes[slot] : 0;
+}
+
+// Move sp by amount bytes (an addi if it fits in its immediate)
+static void adjustStack(int amount, FILE* out)
+{
+   if (amount >= -2048 && amount <= MAXIMM)
+      fprintf(out, "\taddi\tsp, sp, %d\n", amount);
+   else
+      fprintf(out, "\tli\tt0, %d\n\tadd\tsp, sp, t0\n", amount);
+}
+
+//
+// Code from the IR (CG_IR)
+// - a function body, or the program block, is lowered to the IR
+//   (ir.h) and its blocks printed in layout order, in place of the
+//   walk over its statements; the frame around it is made as before
+// - without CG_REGALLOC the stack emitter prints the same code the
+//   walk prints; with it, a statement's instructions go into the
+//   VCode buffer, like lowerExpr()'s do
+//
+
+// Find what an IR body reads (see scanBodyReads())
+static void scanIRReads(IRFunc* fn, BodyReads* reads)
+{
+   IRInstr* in;
+   IRVar* v;
+   int i, j;
+   memset(reads, 0, sizeof(*reads));
+   for (i=0; i < fn->numBlocks; i++) {
+      for (j=0; j < fn->blocks[i].len; j++) {
+         in = &fn->blocks[i].code[j];
+         v = in->op == IR_LOAD || in->op == IR_STORE ? &fn->vars[in->var] : 0;
+         if (in->op == IR_RETVAL)
+            reads->returnValue = 1;
+         else if (in->op == IR_CALL)
+            reads->calls = 1;
+         else if (!v || v->kind == V_GLOBAL || v->slot >= 32)
+            continue;
+         else if (in->op == IR_LOAD && v->slot < fn->numParams)
+            reads->params |= 1u << v->slot;
+         else if (in->op == IR_STORE)
+            reads->assigns |= 1u << v->slot;
+      }
+   }
+}
+
+// Give a label to each block that is reached other than by
+// falling into it from the block before
+static void labelIRTargets(IRFunc* fn)
+{
+   IRBlock* b;
+   int i, j, s, jumps;
+   for (i=0; i < fn->numBlocks; i++) {
+      b = &fn->blocks[i];
+      jumps = b->len > 0 && b->code[b->len-1].op == IR_JUMP;
+      for (j=0; j < 2; j++) {
+         s = b->succ[j];
+         if (s >= 0 && !fn->blocks[s].label && (j == 1 || jumps || s != i+1))
+            fn->blocks[s].label = getUniqueLabelID();
+      }
+   }
+}
+
+// Start a block: its label, if it has one
+static void irBlockHead(IRFunc* fn, int i, FILE* out)
+{
+   if (fn->blocks[i].label)
+      fprintf(out, ".LL%d:\n", fn->blocks[i].label);
+}
+
+// End a block: jump to its fall through successor if that is not
+// the next block
+static void irBlockTail(IRFunc* fn, int i, FILE* out)
+{
+   IRBlock* b = &fn->blocks[i];
+   if ((b->len == 0 || b->code[b->len-1].op != IR_JUMP) &&
+       b->succ[0] >= 0 && b->succ[0] != i+1)
+      fprintf(out, "\tb\t.LL%d\n", fn->blocks[b->succ[0]].label);
+}
+
+// Print a listing comment, as the AST walk prints it
+static void printIRNote(IRInstr* in, FILE* out)
+{
+   static const char* text[] = {
+      "\t#--assignment--\n", "\t#--funcall to %s--\n", "\t#--While loop--\n",
+      "\t#--body--\n", "\t#--condition--\n", "\t#--endloop--\n",
+      "\t#--ifthenelse--\n", "\t#--elsepart--\n", "\t#--ifpart--\n",
+      "\t#--endif--\n", "", "", "\t#--ArrayReference--\n"
+   };
+   if (in->imm == N_BINOP)
+      fprintf(out, "\t#--Binary OP Expression: (%c)--\n", in->var == '+' ? '+' : '-');
+   else if (in->imm == N_RELEXPR)
+      fprintf(out, "\t# Relational Expression (op %d,%c)\n", in->var, in->var);
+   else if (in->imm == N_FUNCALL)
+      fprintf(out, text[N_FUNCALL], atomName(in->name));
+   else
+      fprintf(out, "%s", text[in->imm]);
+}
+
+static const char* irBranchCode[] = { "beq", "bne", "bgt", "blt" };
+
+static int irUses(IRInstr* in, int temp)
+{
+   return (in->a.kind == IV_TEMP && in->a.val == temp) ||
+          (in->b.kind == IV_TEMP && in->b.val == temp);
+}
+
+// Stack code state: the temp in t0, the temps pushed on the stack,
+// and for each temp the instruction of its block that uses it
+typedef struct {
+   IRFunc* fn;
+   ExprGen* eg;
+   FILE* out;
+   int inT0;
+   int* pushed;
+   int top;
+   int* user;
+} StackEmit;
+
+// Push the temp in t0 unless the instruction in uses it
+// - an array element's value is pushed under its index, as the
+//   walk does, with the same comments
+static void stackSpill(StackEmit* se, IRBlock* b, IRInstr* in)
+{
+   IRInstr* user;
+   int t = se->inT0;
+   if (!t || irUses(in, t))
+      return;
+   se->inT0 = 0;
+   if (se->user[t] < 0)
+      return; // never used
+   user = &b->code[se->user[t]];
+   if (user->op == IR_STOREELEM && user->a.kind == IV_TEMP && user->a.val == t)
+      fprintf(se->out, "\t#--Array--\n\t#--index: %d--\n", user->imm);
+   fprintf(se->out, "\taddi\tsp, sp, -4\n\tsw\tt0, 0(sp)\n");
+   se->pushed[se->top++] = t;
+}
+
+// Get an operand into reg (t0 or t1): it is in t0, on top of the
+// stack, or a constant
+// - a temp that is none of these is a bug in the lowering or a pass,
+//   so it stops the compiler rather than print wrong code
+static void stackFetch(StackEmit* se, IRValue v, const char* reg)
+{
+   if (v.kind == IV_CONST) {
+      fprintf(se->out, "\tli\t%s, %d\n", reg, v.val);
+   } else if (v.kind == IV_TEMP && v.val == se->inT0) {
+      if (strcmp(reg, "t0"))
+         fprintf(se->out, "\tmv\t%s, t0\n", reg);
+      se->inT0 = 0;
+   } else if (v.kind == IV_TEMP && se->top > 0 && se->pushed[se->top-1] == v.val) {
+      fprintf(se->out, "\tlw\t%s, 0(sp)\n\taddi\tsp, sp, 4\n", reg);
+      se->top--;
+   } else {
+      fprintf(stderr, "Error: internal: operand t%d of %s is not in t0 or on the stack\n",
+              v.val, se->fn->name ? atomName(se->fn->name) : "program");
+      abort();
+   }
+}
+
+// Get a binary operation's operands: a into t1 and b into t0
+static void stackFetchPair(StackEmit* se, IRInstr* in)
+{
+   if (in->a.kind == IV_TEMP && in->a.val == se->inT0) {
+      stackFetch(se, in->a, "t1");
+      stackFetch(se, in->b, "t0");
+   } else {
+      stackFetch(se, in->b, "t0");
+      stackFetch(se, in->a, "t1");
+   }
+}
+
+// Put the address of an element op's element in t1, from the index
+// in t0 and the array's address (by la, or from its variable)
+static void stackElementAddr(StackEmit* se, IRInstr* in)
+{
+   FILE* out = se->out;
+   IRVar* v;
+   int home;
+   fprintf(out, "\tslli\tt0, t0, 2\n");
+   if (in->var < 0) {
+      fprintf(out, "\tla\tt1, %s\n\tadd\tt1, t1, t0\n", atomName(in->name));
+      return;
+   }
+   v = &se->fn->vars[in->var];
+   home = slotHome(se->eg, v->slot);
+   if (home) {
+      fprintf(out, "\tadd\tt1, %s, t0\n", vcodeRegName(home));
+      return;
+   }
+   frameAccess("lw", "t1", v->slot, 0, "t1", out);
+   fprintf(out, "\tadd\tt1, t1, t0\n");
+}
+
+// Print one instruction as stack code
+static void stackInstr(StackEmit* se, IRBlock* b, IRInstr* in)
+{
+   FILE* out = se->out;
+   IRVar* v;
+   stackSpill(se, b, in);
+   switch (in->op) {
+    case IR_NOTE:
+       printIRNote(in, out);
+       break;
+    case IR_LI:
+       fprintf(out, "\tli\tt0, %d\n", in->imm);
+       break;
+    case IR_LASTR:
+       fprintf(out, "\tla\tt0, .SC%d\n", in->imm);
+       break;
+    case IR_RETVAL:
+       fprintf(out, "\tmv\tt0, a%d\n", in->imm);
+       break;
+    case IR_LOAD:
+       v = &se->fn->vars[in->var];
+       if (v->kind == V_GLOBAL)
+          fprintf(out, "\tlw\tt0, %s\n", atomName(v->name));
        else
-          fprintf(out," type unknown (%d)\n", node->valType);
+          frameAccess("lw", "t0", v->slot, slotHome(se->eg, v->slot), "t0", out);
        break;
-    case AST_FUNCTION:
-       fprintf(out,"Function def (%s)\n",node->strval); // function name
-       fprintf(out,"%s--params--\n",levelPrefix(level+1));
-       printASTree(node->child[0],level+1,out); // child 0 is param list
-       fprintf(out,"%s--locals--\n",levelPrefix(level+1));
-       printASTree(node->child[2],level+1,out); // child 2 is local vars
-       fprintf(out,"%s--body--\n",levelPrefix(level+1));
-       printASTree(node->child[1],level+1,out); // child 1 is body (stmt list)
+    case IR_STORE:
+       stackFetch(se, in->a, "t0");
+       v = &se->fn->vars[in->var];
+       if (v->kind == V_GLOBAL)
+          fprintf(out, "\tsw\tt0, %s, t1\n", atomName(v->name));
+       else
+          frameAccess("sw", "t0", v->slot, slotHome(se->eg, v->slot), "t1", out);
        break;
-    case AST_SBLOCK:
-       fprintf(out,"Statement block\n"); // we don't use this type
-       printASTree(node->child[0],level+1,out);  // child 0 is statement list
+    case IR_LA:
+       fprintf(out, "\tla\tt0, %s\n", atomName(in->name));
        break;
-    case AST_FUNCALL:
-       fprintf(out,"Function call (%s)\n",node->strval); // func name
-       printASTree(node->child[0],level+1,out);  // child 0 is argument list
+    case IR_LOADELEM:
+       stackFetch(se, in->a, "t0");
+       stackElementAddr(se, in);
+       fprintf(out, "\tlw\tt0, 0(t1)\n");
        break;
-    case AST_ARGUMENT:
-       fprintf(out,"Funcall argument\n");
-       printASTree(node->child[0],level+1,out);  // child 0 is argument expr
+    case IR_STOREELEM:
+       if (in->a.kind == IV_TEMP && in->a.val == se->inT0) {
+          se->inT0 = 0;
+          fprintf(out, "\t#--Array--\n\t#--index: %d--\n", in->imm);
+          fprintf(out, "\taddi\tsp, sp, -4\n\tsw\tt0, 0(sp)\n");
+          se->pushed[se->top++] = in->a.val;
+       }
+       stackFetch(se, in->b, "t0");
+       stackElementAddr(se, in);
+       stackFetch(se, in->a, "t0");
+       fprintf(out, "\tsw\tt0, 0(t1)\n");
        break;
-    case AST_ASSIGNMENT:
-       fprintf(out,"Assignment to (%s) ", node->strval);
-       if (node->varKind == V_GLARRAY) { //child[1]) {
-          fprintf(out,"array var\n");
-          fprintf(out,"%s--index--\n",levelPrefix(level+1));
-          printASTree(node->child[1],level+1,out);
-       } else  
-          fprintf(out,"simple var\n");
-       fprintf(out,"%s--right hand side--\n",levelPrefix(level+1));
-       printASTree(node->child[0],level+1,out);  // child 1 is right hand side
+    case IR_ADD: case IR_SUB:
+       stackFetchPair(se, in);
+       fprintf(out, "\t%s\tt0, t1, t0\n", in->op == IR_ADD ? "add" : "sub");
        break;
-    case AST_WHILE:
-       fprintf(out,"While loop\n");
-       printASTree(node->child[0],level+1,out);  // child 0 is condition expr
-       fprintf(out,"%s--body--\n",levelPrefix(level+1));
-       printASTree(node->child[1],level+1,out);  // child 1 is loop body
+    case IR_ARG:
+       stackFetch(se, in->a, "t0");
+       fprintf(out, "\tmv\ta%d, t0\n", in->imm);
        break;
-    case AST_IFTHEN:
-       fprintf(out,"If then\n");
-       printASTree(node->child[0],level+1,out);  // child 0 is condition expr
-       fprintf(out,"%s--ifpart--\n",levelPrefix(level+1));
-       printASTree(node->child[1],level+1,out);  // child 1 is if body
-       fprintf(out,"%s--elsepart--\n",levelPrefix(level+1));
-       printASTree(node->child[2],level+1,out);  // child 2 is else body
+    case IR_CALL:
+       fprintf(out, "\tjal\t%s\n", atomName(in->name));
        break;
-    case AST_EXPRESSION: // only for binary op expression
-       fprintf(out,"Expression (op %d,%c)\n",node->ival,node->ival);
-       printASTree(node->child[0],level+1,out);  // child 0 is left side
-       printASTree(node->child[1],level+1,out);  // child 1 is right side
+    case IR_JUMP:
+       fprintf(out, "\tb\t.LL%d\n", se->fn->blocks[b->succ[0]].label);
        break;
-    case AST_RELEXPR: // only for relational op expression
-       fprintf(out,"Relational Expression (op %d,%c)\n",node->ival,node->ival);
-       printASTree(node->child[0],level+1,out);  // child 0 is left side
-       printASTree(node->child[1],level+1,out);  // child 1 is right side
+    default: // branches
+       stackFetchPair(se, in);
+       fprintf(out, "\t%s\tt1, t0, .LL%d\n", irBranchCode[in->op - IR_BEQ],
+               se->fn->blocks[b->succ[1]].label);
        break;
-    case AST_VARREF:
-       fprintf(out,"Variable ref (%s)",node->strval); // var name
-       if (node->varKind == V_GLARRAY) { //child[0]) {
-          fprintf(out," array ref\n");
-          printASTree(node->child[0],level+1,out);
-       } else 
-          fprintf(out,"\n");
+   }
+   if (in->dst)
+      se->inT0 = in->dst;
+}
+
+// Print a function's IR as stack code, with t0 and t1
+static void emitIRStack(IRFunc* fn, ExprGen* eg, FILE* out)
+{
+   StackEmit se;
+   IRBlock* b;
+   int i, j;
+   memset(&se, 0, sizeof(se));
+   se.fn = fn;
+   se.eg = eg;
+   se.out = out;
+   se.pushed = (int*) malloc((fn->numTemps+1) * sizeof(int));
+   se.user = (int*) malloc((fn->numTemps+1) * sizeof(int));
+   for (i=0; i <= fn->numTemps; i++)
+      se.user[i] = -1;
+   labelIRTargets(fn);
+   for (i=0; i < fn->numBlocks; i++) {
+      b = &fn->blocks[i];
+      for (j=0; j < b->len; j++) {
+         if (b->code[j].a.kind == IV_TEMP)
+            se.user[b->code[j].a.val] = j;
+         if (b->code[j].b.kind == IV_TEMP)
+            se.user[b->code[j].b.val] = j;
+      }
+      irBlockHead(fn, i, out);
+      se.inT0 = se.top = 0;
+      for (j=0; j < b->len; j++)
+         stackInstr(&se, b, &b->code[j]);
+      irBlockTail(fn, i, out);
+   }
+   free(se.pushed);
+   free(se.user);
+}
+
+// Register code state: the buffer register of each temp (-1 once it
+// is used), and the temps read in place from a home register
+typedef struct {
+   IRFunc* fn;
+   ExprGen* eg;
+   FILE* out;
+   int* regs;
+   int* homeTemps;
+   int numHomeTemps;
+} RegEmit;
+
+// Allocate the buffer's registers and print it
+static void regFlush(RegEmit* re)
+{
+   if (re->eg->vc.len)
+      finishExprCode(re->eg, 0, re->out);
+   re->numHomeTemps = 0;
+}
+
+// Register of an operand (a constant is loaded into one)
+static int regOperand(RegEmit* re, IRValue v)
+{
+   int r;
+   if (v.kind == IV_TEMP) {
+      r = re->regs[v.val];
+      re->regs[v.val] = -1;
+      return r;
+   }
+   if (v.kind != IV_CONST || v.val == 0)
+      return R_ZERO;
+   r = newVReg(&re->eg->vc);
+   emitVInstr(&re->eg->vc, VI_LI, r, 0, 0, v.val, 0);
+   return r;
+}
+
+// Before a home register is written, copy out any value read from
+// it that is still to be used
+static void regSaveHome(RegEmit* re, int home)
+{
+   int i, t, r;
+   for (i=0; i < re->numHomeTemps; i++) {
+      t = re->homeTemps[i];
+      if (re->regs[t] != home)
+         continue;
+      r = newVReg(&re->eg->vc);
+      emitVInstr(&re->eg->vc, VI_MV, r, home, 0, 0, 0);
+      re->regs[t] = r;
+   }
+}
+
+// Add the address of an element op's element to the buffer, from
+// the index in register index; returns its register
+// - the array's address is from la, or from its variable
+static int regElementAddr(RegEmit* re, IRInstr* in, int index)
+{
+   VCode* vc = &re->eg->vc;
+   IRVar* v;
+   int offset, base, addr, frameOffset;
+   if (in->var < 0)
+      return lowerElementAddr(re->eg, in->name, index);
+   v = &re->fn->vars[in->var];
+   offset = newVReg(vc);
+   emitVInstr(vc, VI_SLLI, offset, index, 0, 2, 0);
+   base = slotHome(re->eg, v->slot);
+   if (!base) {
+      addr = lowerFrameAddr(re->eg, v->slot, &frameOffset);
+      base = newVReg(vc);
+      emitVInstr(vc, VI_LW, base, addr, 0, frameOffset, 0);
+   }
+   addr = newVReg(vc);
+   emitVInstr(vc, VI_ADD, addr, base, offset, 0, 0);
+   return addr;
+}
+
+// Add one instruction to the buffer; calls, branches and jumps end
+// the buffer, and so do the statement comments
+static void regInstr(RegEmit* re, IRBlock* b, IRInstr* in)
+{
+   VCode* vc = &re->eg->vc;
+   IRVar* v = in->op == IR_LOAD || in->op == IR_STORE ? &re->fn->vars[in->var] : 0;
+   int r = R_ZERO, value, base, offset, home;
+   switch (in->op) {
+    case IR_NOTE:
+       if (in->imm != N_BINOP && in->imm != N_ARRAYREF) {
+          regFlush(re);
+          printIRNote(in, re->out);
+       }
        break;
-    case AST_CONSTANT: // for both int and string constants
-       if (node->valType == T_INT)
-          fprintf(out,"Int Constant = %d\n",node->ival);
-       else if (node->valType == T_STRING)
-          fprintf(out,"String Constant = (%s)\n",node->strval);
-       else if (node->valType == T_RETURNVAL)
-          fprintf(out, "Return Value\n");
-       else 
-          fprintf(out,"Unknown Constant\n");
+    case IR_LI:
+       r = newVReg(vc);
+       emitVInstr(vc, VI_LI, r, 0, 0, in->imm, 0);
+       break;
+    case IR_LASTR:
+       r = newVReg(vc);
+       emitVInstr(vc, VI_LASTR, r, 0, 0, in->imm, 0);
+       break;
+    case IR_RETVAL:
+       r = newVReg(vc);
+       emitVInstr(vc, VI_MV, r, R_A(in->imm), 0, 0, 0);
+       break;
+    case IR_LOAD:
+       home = v->kind == V_GLOBAL ? 0 : slotHome(re->eg, v->slot);
+       if (v->kind == V_GLOBAL) {
+          r = newVReg(vc);
+          emitVInstr(vc, VI_LWG, r, 0, 0, 0, v->name);
+       } else if (home) {
+          r = home; // read in place
+          re->homeTemps[re->numHomeTemps++] = in->dst;
+       } else {
+          base = lowerFrameAddr(re->eg, v->slot, &offset);
+          r = newVReg(vc);
+          emitVInstr(vc, VI_LW, r, base, 0, offset, 0);
+       }
+       break;
+    case IR_STORE:
+       value = regOperand(re, in->a);
+       home = v->kind == V_GLOBAL ? 0 : slotHome(re->eg, v->slot);
+       if (v->kind == V_GLOBAL) {
+          emitVInstr(vc, VI_SWG, 0, value, newVReg(vc), 0, v->name);
+       } else if (home) {
+          regSaveHome(re, home);
+          emitVInstr(vc, VI_MV, home, value, 0, 0, 0);
+       } else {
+          base = lowerFrameAddr(re->eg, v->slot, &offset);
+          emitVInstr(vc, VI_SW, 0, value, base, offset, 0);
+       }
+       break;
+    case IR_LA:
+       r = newVReg(vc);
+       emitVInstr(vc, VI_LA, r, 0, 0, 0, in->name);
+       break;
+    case IR_LOADELEM:
+       base = regElementAddr(re, in, regOperand(re, in->a));
+       r = newVReg(vc);
+       emitVInstr(vc, VI_LW, r, base, 0, 0, 0);
+       break;
+    case IR_STOREELEM:
+       value = regOperand(re, in->a);
+       base = regElementAddr(re, in, regOperand(re, in->b));
+       emitVInstr(vc, VI_SW, 0, value, base, 0, 0);
+       break;
+    case IR_ADD: case IR_SUB:
+       value = regOperand(re, in->a);
+       base = regOperand(re, in->b);
+       r = newVReg(vc);
+       emitVInstr(vc, in->op == IR_ADD ? VI_ADD : VI_SUB, r, value, base, 0, 0);
+       break;
+    case IR_ARG:
+       emitVInstr(vc, VI_MV, R_A(in->imm), regOperand(re, in->a), 0, 0, 0);
+       break;
+    case IR_CALL:
+       regFlush(re);
+       fprintf(re->out, "\tjal\t%s\n", atomName(in->name));
+       break;
+    case IR_JUMP:
+       regFlush(re);
+       fprintf(re->out, "\tb\t.LL%d\n", re->fn->blocks[b->succ[0]].label);
+       break;
+    default: // branches
+       value = regOperand(re, in->a);
+       base = regOperand(re, in->b);
+       emitVInstr(vc, VI_BEQ + (in->op - IR_BEQ), 0, value, base,
+                  re->fn->blocks[b->succ[1]].label, 0);
+       regFlush(re);
        break;
-    default:
-       fprintf(out,"Unknown AST node!\n");
    }
-   // IMPORTANT: walks down sibling list (for nodes that form lists, like
-   // declarations, functions, parameters, arguments, and statements)
-   printASTree(node->next,level,out);
+   if (in->dst)
+      re->regs[in->dst] = r;
 }
 
-//
-// Below here is code for generating our output assembly code from
-// an AST. You will probably want to move some things from the
-// grammar file (.y file) over here, since you will no longer be 
-// generating code in the grammar file. You may have some global 
-// stuff that needs accessed from both, in which case declare it in
-// one and then use "extern" to reference it in the other.
+// Print a function's IR with its temps in registers
+static void emitIRRegs(IRFunc* fn, ExprGen* eg, FILE* out)
+{
+   RegEmit re;
+   IRBlock* b;
+   int i, j;
+   memset(&re, 0, sizeof(re));
+   re.fn = fn;
+   re.eg = eg;
+   re.out = out;
+   re.regs = (int*) malloc((fn->numTemps+1) * sizeof(int));
+   re.homeTemps = (int*) malloc((fn->numTemps+1) * sizeof(int));
+   labelIRTargets(fn);
+   for (i=0; i < fn->numBlocks; i++) {
+      b = &fn->blocks[i];
+      irBlockHead(fn, i, out);
+      for (j=0; j < b->len; j++)
+         regInstr(&re, b, &b->code[j]);
+      regFlush(&re);
+      irBlockTail(fn, i, out);
+   }
+   free(re.regs);
+   free(re.homeTemps);
+}
 
-extern void outputDataSection(); // in main.c
+// How many more slots an IR body can take and still be a frameless
+// leaf (see framelessLeaf()), or -1 if it cannot be one anyway
+// - the program block has no frame, so it can take none
+static int leafSlotRoom(IRFunc* fn)
+{
+   BodyReads reads;
+   int k, temps = 0;
+   if (!fn->name)
+      return 0;
+   scanIRReads(fn, &reads);
+   if (!(codeGenFlags & CG_LEAF) || reads.calls || reads.returnValue ||
+       fn->numSlots > MAXHOMES)
+      return -1;
+   for (k=0; k < fn->numSlots; k++)
+      if (k >= fn->numParams || (reads.assigns & (1u << k)))
+         temps++;
+   if (temps > LEAFTEMPS)
+      return -1;
+   return MAXHOMES - fn->numSlots < LEAFTEMPS - temps ? MAXHOMES - fn->numSlots
+                                                        : LEAFTEMPS - temps;
+}
 
-// Used for labels inside code, for loops and conditionals
-static int getUniqueLabelID()
+// Run the IR passes that are on over a lowered body (see passes.h)
+// - with CG_IRSTATS, passes report what they did to each body on
+//   stderr
+static IRFunc* optimizeIR(IRFunc* fn)
 {
-   static int lid = 100; // you can start at 0, it really doesn't matter
-   return lid++;
+   IRPassEnv env;
+   env.globals = irGlobals;
+   env.slotRoom = leafSlotRoom;
+   env.report = codeGenFlags & CG_IRSTATS ? stderr : 0;
+   runIRPasses(fn, &env);
+   return fn;
+}
+
+// Print a body's code from its IR
+static void emitIR(IRFunc* fn, ExprGen* eg, FILE* out)
+{
+   if (codeGenFlags & CG_DUMPIR)
+      printIR(fn, stderr);
+   if (codeGenFlags & CG_REGALLOC)
+      emitIRRegs(fn, eg, out);
+   else
+      emitIRStack(fn, eg, out);
 }
 
 // Generate assembly code from AST
@@ -216,186 +1783,343 @@ static int getUniqueLabelID()
 // - param out is the output file handle. Use "fprintf(out,..." 
 //   instead of printf(...); call it with "stdout" for terminal output
 //   (see printASTree() code for how it uses the output file handle)
+// - like printASTree(), this walks the tree with an explicit stack:
+//   a child is generated by pushing it, and the node's code after
+//   the child is generated when the node's frame is back on top;
+//   the hval a node leaves for its next sibling is given to nextWalk
 //
-void genCodeFromASTree(ASTNode* node, int hval, FILE *out)
+void genCodeFromASTree(CompactAST* ast, CNodeId id, int hval, FILE *out)
 {  
+   WalkStack ws = { 0, 0, 0 };
+   ExprGen eg;
+   int regAlloc = (codeGenFlags & CG_REGALLOC) != 0;
+   WalkFrame* f;
+   CNode* node;
+   BodyReads reads;
+   IRFunc* fn = 0;
    char* code;
-   int num;
-   int label1 = 0;
-   int label2 = 0;
-   if (!node)
-      return;
-   switch (node->type) {
-    case AST_PROGRAM:
-       fprintf(out, "#\n# RISC-V assembly output\n#\n");
-       
-       fprintf(out, "\n#\n# data section\n#\n\t.data\n#--string constants--\n");
-       outputDataSection();
-       fprintf(out, "\n#--Globals Declarations--\n");
-       genCodeFromASTree(node->child[0],hval,out);  // child 0 is global var decls
-       
-       fprintf(out, "\n\n#\n# Program Instructions\n#\n");
-       fprintf(out, "\t.text\nprogram:\n");
-       genCodeFromASTree(node->child[2],hval,out);  // child 2 is program
-       fprintf(out, "\tli\ta0, 0\n\tli\ta7, 93\n\tecall\n");
-       
-       fprintf(out, "\n#\n# Functions\n#\n\n");
-       genCodeFromASTree(node->child[1],hval,out);  // child 1 is function defs\
-
-       fprintf(out, "\n#\n# Library functions\n#\n\n");
-       fprintf(out, "# Print a null-terminated string: arg: a0 == string address\n");
-       fprintf(out, "printStr:\n\tli\ta7, 4\n\tecall\n\tret\n");
-       fprintf(out, "\n# Print a decimal integer: arg: a0 == value\n");
-       fprintf(out, "printInt:\n\tli\ta7, 1\n\tecall\n\tret\n");
-       fprintf(out, "\n#Read in a decimal integer: return: a0 == value\n");
-       fprintf(out, "readInt:\n\tli\ta7, 5\n\tecall\n\tret\n");       
-       break;
-    case AST_VARDECL:
-       if (node->valType == T_INT) {
-          if (node->varKind == V_GLOBAL) {
-             fprintf(out,"%s:\t.word\t0\n", node->strval);
-          } else if (node->varKind == V_GLARRAY) {
-             fprintf(out, "%s:\t.space\t%d\n", node->strval, node->ival*4);
-          } else if (node->varKind == V_PARAM || node->varKind == V_LOCAL) {
-             fprintf(out, "\tsw\ta%d, %d(fp)\n", node->ival, (node->ival+2)*4);
-          } else {
-             fprintf(out,"%s:\t.word\t0\n", node->strval);
+   int i, params, slots;
+   memset(&eg, 0, sizeof(eg));
+   initVCode(&eg.vc);
+   eg.pool = TREGS;
+   if (regAlloc && (codeGenFlags & CG_SETHIULLMAN))
+      eg.need = (unsigned char*) calloc(ast->numNodes, 1);
+   pushWalk(&ws,id,hval);
+   while (ws.top > 0) {
+      f = &ws.frames[ws.top-1];
+      node = &ast->nodes[f->id];
+      hval = f->hval;
+      switch (node->type) {
+       case AST_PROGRAM:
+          if (f->phase == 0) {
+             fprintf(out, "#\n# RISC-V assembly output\n#\n");
+             if ((codeGenFlags & CG_IR) && passEnabled("sccp") && !irGlobals)
+                irGlobals = findGlobalConstants(ast, f->id);
+             
+             fprintf(out, "\n#\n# data section\n#\n\t.data\n#--string constants--\n");
+             for (i=0; i < ast->numStrings; i++)
+                if (ast->strOffsets[i])
+                   fprintf(out, ".SC%d:\t.string\t%s\n", i, compactASTString(ast,i));
+             fprintf(out, "\n#--Globals Declarations--\n");
+             f->phase = 1;
+             pushWalk(&ws,node->child[0],hval);  // child 0 is global var decls
+             continue;
           }
-       } else if (node->valType == T_STRING) {
-          if (node->varKind == V_GLOBAL) {
-            fprintf(out,"SC%d:\t.string %s\n", hval, node->strval);
+          if (f->phase == 1) {
+             fprintf(out, "\n\n#\n# Program Instructions\n#\n");
+             fprintf(out, "\t.text\nprogram:\n");
+             if (codeGenFlags & CG_IR) {
+                fn = optimizeIR(lowerProgramToIR(ast, node->child[2], eg.need != 0));
+                scanIRReads(fn, &reads);
+                eg.pool = exprRegPool(&reads, 0);
+                emitIR(fn, &eg, out);
+                freeIR(fn);
+                f->phase = 2;
+                continue;
+             }
+             if (regAlloc) {
+                scanBodyReads(ast, node->child[2], &reads);
+                eg.pool = exprRegPool(&reads, 0);
+             }
+             f->phase = 2;
+             pushWalk(&ws,node->child[2],hval);  // child 2 is program
+             continue;
+          }
+          if (f->phase == 2) {
+             fprintf(out, "\tli\ta0, 0\n\tli\ta7, 93\n\tecall\n");
+             
+             fprintf(out, "\n#\n# Functions\n#\n\n");
+             f->phase = 3;
+             pushWalk(&ws,node->child[1],hval);  // child 1 is function defs
+             continue;
+          }
+          fprintf(out, "\n#\n# Library functions\n#\n\n");
+          fprintf(out, "# Print a null-terminated string: arg: a0 == string address\n");
+          fprintf(out, "printStr:\n\tli\ta7, 4\n\tecall\n\tret\n");
+          fprintf(out, "\n# Print a decimal integer: arg: a0 == value\n");
+          fprintf(out, "printInt:\n\tli\ta7, 1\n\tecall\n\tret\n");
+          fprintf(out, "\n#Read in a decimal integer: return: a0 == value\n");
+          fprintf(out, "readInt:\n\tli\ta7, 5\n\tecall\n\tret\n");       
+          break;
+       case AST_VARDECL:
+          if (node->valType == T_INT) {
+             if (node->varKind == V_GLOBAL) {
+                fprintf(out,"%s:\t.word\t0\n", atomName(node->name));
+             } else if (node->varKind == V_GLARRAY) {
+                fprintf(out, "%s:\t.space\t%d\n", atomName(node->name), node->ival*4);
+             } else if (node->varKind == V_PARAM || node->varKind == V_LOCAL) {
+                fprintf(out, "\tsw\ta%d, %d(fp)\n", node->ival, (node->ival+2)*4);
+             } else {
+                fprintf(out,"%s:\t.word\t0\n", atomName(node->name));
+             }
+          } else if (node->valType == T_STRING) {
+             if (node->varKind == V_GLOBAL) {
+               fprintf(out,"SC%d:\t.string %s\n", hval, atomName(node->name));
+             } else {
+               fprintf(out, "\tsw\ta%d, %d(fp)\n", node->ival, (node->ival+2)*4);
+             }
           } else {
-            fprintf(out, "\tsw\ta%d, %d(fp)\n", node->ival, (node->ival+2)*4);
+             fprintf(out," Unknown Variable type (%d)\n", node->valType);
           }
-       } else {
-          fprintf(out," Unknown Variable type (%d)\n", node->valType);
-       }
-       break;
-    case AST_FUNCTION:
-       fprintf(out, "\t#--FUNCTION--\n");
-       fprintf(out,"%s:\n\taddi\tsp, sp, -128\n\tsw\tfp, 4(sp)\n",node->strval); // function start
-       fprintf(out, "\tsw\tra, 0(sp)\n\tmv\tfp, sp\n");
-       fprintf(out, "\tsw\ta0, 8(sp)\n\tsw\ta1, 12(sp)\n\tsw\ta2, 16(sp)\n");
-       fprintf(out, "\tsw\ta3, 20(sp)\n\tsw\ta4, 24(sp)\n\tsw\ta5, 28(sp)\n");
-       genCodeFromASTree(node->child[1],hval,out); // child 1 is body (stmt list)
-       fprintf(out, "\tmv\tsp, fp\n\tlw\tfp, 4(sp)\n");
-       fprintf(out, "\tlw\tra, 0(sp)\n\taddi\tsp, sp, 128\n\tret\n\n"); // function end
-       break;
-    case AST_SBLOCK:
-       fprintf(out,"Statement block\n"); // we don't use this type
-       printASTree(node->child[0],hval,out);  // child 0 is statement list
-       break;
-    case AST_FUNCALL:
-       fprintf(out, "\t#--funcall to %s--\n", node->strval);
-       genCodeFromASTree(node->child[0],hval,out);  // child 0 is argument list
-       fprintf(out,"\tjal\t%s\n", node->strval);
-       hval = 0;
-       break;
-    case AST_ARGUMENT:
-       genCodeFromASTree(node->child[0],hval,out);  // child 0 is argument expr
-       fprintf(out,"\tmv\ta%d, t0\n", hval);
-       hval++;
-       break;
-    case AST_ASSIGNMENT:
-       fprintf(out, "\t#--assignment--\n");
-       genCodeFromASTree(node->child[0], 0, out);
-       if (node->varKind == V_GLOBAL) {
-          fprintf(out, "\tsw\tt0, %s, t1\n", node->strval);
-       } else if (node->varKind == V_PARAM || node->varKind == V_LOCAL) {
-          fprintf(out, "\tsw\tt0, %d(fp)\n", (node->ival+2)*4);
-       } else if (node->varKind == V_GLARRAY) { //child[1]) {
-          fprintf(out, "\t#--Array--\n");
-          fprintf(out, "\t#--index: %d--\n", node->ival);
-          fprintf(out, "\taddi\tsp, sp, -4\n\tsw\tt0, 0(sp)\n");
-          genCodeFromASTree(node->child[1],0,out);
-          fprintf(out, "\tslli\tt0, t0, 2\n\tla\tt1, %s\n", node->strval);
+          break;
+       case AST_FUNCTION:
+          if (f->phase == 0) {
+             fprintf(out, "\t#--FUNCTION--\n");
+             fprintf(out,"%s:\n",atomName(node->name)); // function start
+             if (codeGenFlags & CG_IR) {
+                fn = optimizeIR(lowerToIR(ast, f->id, eg.need != 0));
+                scanIRReads(fn, &reads);
+                params = fn->numParams;
+                slots = fn->numSlots;
+             } else {
+                scanBodyReads(ast, node->child[1], &reads);
+                params = listLength(ast, node->child[0]);
+                slots = params + listLength(ast, node->child[2]);
+             }
+             if (framelessLeaf(params, slots, &reads, &eg, out)) {
+                f->label1 = 0; // no frame, for the epilogue
+             } else {
+                f->label1 = frameSize(slots); // kept for the epilogue
+                adjustStack(-f->label1, out);
+                fprintf(out, "\tsw\tfp, 4(sp)\n\tsw\tra, 0(sp)\n\tmv\tfp, sp\n");
+                // save the argument registers of the parameters it reads
+                for (i=0; i < 8; i++)
+                   if (reads.params & (1u << i))
+                      fprintf(out, "\tsw\ta%d, %d(sp)\n", i, FRAMEOFFSET(i));
+             }
+             if (regAlloc) {
+                eg.pool = exprRegPool(&reads, 1);
+                for (i=0; i < eg.numHomes; i++)
+                   eg.pool &= ~REGBIT(eg.homes[i]);
+             }
+             f->phase = 1;
+             if (fn) {
+                emitIR(fn, &eg, out);
+                freeIR(fn);
+                fn = 0;
+                continue;
+             }
+             pushWalk(&ws,node->child[1],hval); // child 1 is body (stmt list)
+             continue;
+          }
+          if (f->label1) {
+             fprintf(out, "\tmv\tsp, fp\n\tlw\tfp, 4(sp)\n\tlw\tra, 0(sp)\n");
+             adjustStack(f->label1, out);
+          }
+          eg.numHomes = 0;
+          fprintf(out, "\tret\n\n"); // function end
+          break;
+       case AST_SBLOCK:
+          fprintf(out,"Statement block\n"); // we don't use this type
+          printASTree(ast,node->child[0],hval,out);  // child 0 is statement list
+          break;
+       case AST_FUNCALL:
+          if (f->phase == 0) {
+             fprintf(out, "\t#--funcall to %s--\n", atomName(node->name));
+             f->phase = 1;
+             pushWalk(&ws,node->child[0],hval);  // child 0 is argument list
+             continue;
+          }
+          fprintf(out,"\tjal\t%s\n", atomName(node->name));
+          hval = 0;
+          break;
+       case AST_ARGUMENT:
+          if (regAlloc) {
+             genArgument(&eg, ast, node, hval, out);
+             hval++;
+             break;
+          }
+          if (f->phase == 0) {
+             f->phase = 1;
+             pushWalk(&ws,node->child[0],hval);  // child 0 is argument expr
+             continue;
+          }
+          fprintf(out,"\tmv\ta%d, t0\n", hval);
+          hval++;
+          break;
+       case AST_ASSIGNMENT:
+          if (f->phase == 0) {
+             fprintf(out, "\t#--assignment--\n");
+             if (regAlloc) {
+                genAssignment(&eg, ast, node, out);
+                break;
+             }
+             f->phase = 1;
+             pushWalk(&ws,node->child[0],0);
+             continue;
+          }
+          if (f->phase == 1) {
+             if (node->varKind == V_GLOBAL) {
+                fprintf(out, "\tsw\tt0, %s, t1\n", atomName(node->name));
+             } else if (node->varKind == V_PARAM || node->varKind == V_LOCAL) {
+                frameAccess("sw", "t0", node->ival, slotHome(&eg, node->ival), "t1", out);
+             } else if (node->varKind == V_GLARRAY) { //child[1]) {
+                fprintf(out, "\t#--Array--\n");
+                fprintf(out, "\t#--index: %d--\n", node->ival);
+                fprintf(out, "\taddi\tsp, sp, -4\n\tsw\tt0, 0(sp)\n");
+                f->phase = 2;
+                pushWalk(&ws,node->child[1],0);
+                continue;
+             } else {
+                fprintf(out, "Unknown variable kind assignment\n");
+             }
+             break;
+          }
+          fprintf(out, "\tslli\tt0, t0, 2\n\tla\tt1, %s\n", atomName(node->name));
           fprintf(out, "\tadd\tt1, t1, t0\n\tlw\tt0, 0(sp)\n");
           fprintf(out, "\taddi\tsp, sp, 4\n\tsw\tt0, 0(t1)\n");
-       } else {
-          fprintf(out, "Unknown variable kind assignment\n");
-       }
-       break;
-    case AST_WHILE:
-       label1 = getUniqueLabelID();
-       label2 = getUniqueLabelID();
-       fprintf(out,"\t#--While loop--\n\tb\t.LL%d\n", label2);
-       fprintf(out, ".LL%d:\n\t#--body--\n", label1);
-       genCodeFromASTree(node->child[1],hval,out);  // child 1 is loop body
-       fprintf(out, "\t#--condition--\n.LL%d:\n",label2);
-       genCodeFromASTree(node->child[0],label1,out);  // child 0 is condition expr
-       fprintf(out, "\t#--endloop--\n");
-       break;
-    case AST_IFTHEN:
-       label1 = getUniqueLabelID();
-       label2 = getUniqueLabelID();
-       fprintf(out,"\t#--ifthenelse--\n");
-       genCodeFromASTree(node->child[0],label1,out);  // child 0 is condition expr
-       fprintf(out,"\t#--elsepart--\n");
-       genCodeFromASTree(node->child[2], hval,out);  // child 2 is else body
-       fprintf(out,"\tb\t.LL%d\n.LL%d:\n\t#--ifpart--\n", label2, label1);
-       genCodeFromASTree(node->child[1],hval,out);  // child 1 is if body
-       fprintf(out, ".LL%d:\n\t#--endif--\n", label2);
-       break;
-    case AST_EXPRESSION: // only for binary op expression
-       fprintf(out, "\t#--Binary OP Expression: ");
-       if (node->ival == '+') fprintf(out, "(+)--\n");
-       else fprintf(out, "(-)--\n");
-       genCodeFromASTree(node->child[0],hval,out);  // child 0 is left side
-       fprintf(out, "\taddi\tsp, sp, -4\n\tsw\tt0, 0(sp)\n");
-       genCodeFromASTree(node->child[1],hval,out);  // child 1 is right side
-       fprintf(out, "\tlw\tt1, 0(sp)\n\taddi\tsp, sp, 4\n");
-       switch (node->ival) {
-          case '+': code = "add"; break;
-          case '-': code = "sub"; break;
-          default: fprintf(out, "unknown ADDOP\n");
-       }
-       fprintf(out, "\t%s\tt0, t1, t0\n", code);
-       break;
-    case AST_RELEXPR: // only for relational op expression
-       fprintf(out,"\t# Relational Expression (op %d,%c)\n",node->ival,node->ival);
-       genCodeFromASTree(node->child[0],0,out);  // child 0 is left side
-       fprintf(out,"\taddi\tsp, sp, -4\n\tsw\tt0, 0(sp)\n");
-       genCodeFromASTree(node->child[1],0,out);  // child 1 is right side
-       switch (node->ival) {
-         case '=': code = "beq"; break;
-         case '!': code = "bne"; break;
-         case '>': code = "bgt"; break;
-         case '<': code = "blt"; break;
-         default: code = "unknown relop";
-       }
-       fprintf(out,"\tlw\tt1, 0(sp)\n\taddi\tsp, sp, 4\n\t%s\tt1, t0, .LL%d\n", code, hval);
-       break;
-    case AST_VARREF:
-       if (node->varKind == V_GLOBAL) {
-          fprintf(out, "\tlw\tt0, %s\n", node->strval);
-       } else if (node->varKind == V_PARAM || node->varKind == V_LOCAL) {
-          fprintf(out, "\tlw\tt0, %d(fp)\n", (node->ival+2)*4);
-       } else if (node->varKind == V_GLARRAY) {
-          fprintf(out, "\t#--ArrayReference--\n");
-          genCodeFromASTree(node->child[0],0,out);
-          fprintf(out,"\tslli\tt0, t0, 2\n\tla\tt1, %s\n", node->strval);
-          fprintf(out,"\tadd\tt1, t1, t0\n\tlw\tt0, 0(t1)\n");
-       } else {
-          fprintf(out, "Unknown variable kind assignment\n");
-       }
-       break;
-    case AST_CONSTANT: // for both int and string constants
-       if (node->valType == T_INT) {
-          fprintf(out,"\tli\tt0, %d\n", node->ival);
-       }
-       else if (node->valType == T_STRING) {
-          fprintf(out,"\tla\tt0, .SC%d\n", node->ival);
-       }
-       else if (node->valType == T_RETURNVAL)
-          fprintf(out, "\tmv\tt0, a%d\n", hval);
-       else
-          fprintf(out,"");
-       break;
-    default:
-       fprintf(out,"");
+          break;
+       case AST_WHILE:
+          if (f->phase == 0) {
+             f->label1 = getUniqueLabelID();
+             f->label2 = getUniqueLabelID();
+             fprintf(out,"\t#--While loop--\n");
+             if (!alwaysTrue(ast, node->child[0]))
+                fprintf(out,"\tb\t.LL%d\n", f->label2);
+             fprintf(out, ".LL%d:\n\t#--body--\n", f->label1);
+             f->phase = 1;
+             pushWalk(&ws,node->child[1],hval);  // child 1 is loop body
+             continue;
+          }
+          if (f->phase == 1 && alwaysTrue(ast, node->child[0])) {
+             fprintf(out, "\tb\t.LL%d\n\t#--endloop--\n", f->label1);
+             break;
+          }
+          if (f->phase == 1) {
+             fprintf(out, "\t#--condition--\n.LL%d:\n",f->label2);
+             f->phase = 2;
+             pushWalk(&ws,node->child[0],f->label1);  // child 0 is condition expr
+             continue;
+          }
+          fprintf(out, "\t#--endloop--\n");
+          break;
+       case AST_IFTHEN:
+          if (f->phase == 0) {
+             f->label1 = getUniqueLabelID();
+             f->label2 = getUniqueLabelID();
+             fprintf(out,"\t#--ifthenelse--\n");
+             f->phase = 1;
+             pushWalk(&ws,node->child[0],f->label1);  // child 0 is condition expr
+             continue;
+          }
+          if (f->phase == 1) {
+             fprintf(out,"\t#--elsepart--\n");
+             f->phase = 2;
+             pushWalk(&ws,node->child[2],hval);  // child 2 is else body
+             continue;
+          }
+          if (f->phase == 2) {
+             fprintf(out,"\tb\t.LL%d\n.LL%d:\n\t#--ifpart--\n", f->label2, f->label1);
+             f->phase = 3;
+             pushWalk(&ws,node->child[1],hval);  // child 1 is if body
+             continue;
+          }
+          fprintf(out, ".LL%d:\n\t#--endif--\n", f->label2);
+          break;
+       case AST_EXPRESSION: // only for binary op expression
+          if (f->phase == 0) {
+             fprintf(out, "\t#--Binary OP Expression: ");
+             if (node->ival == '+') fprintf(out, "(+)--\n");
+             else fprintf(out, "(-)--\n");
+             f->phase = 1;
+             pushWalk(&ws,node->child[0],hval);  // child 0 is left side
+             continue;
+          }
+          if (f->phase == 1) {
+             fprintf(out, "\taddi\tsp, sp, -4\n\tsw\tt0, 0(sp)\n");
+             f->phase = 2;
+             pushWalk(&ws,node->child[1],hval);  // child 1 is right side
+             continue;
+          }
+          fprintf(out, "\tlw\tt1, 0(sp)\n\taddi\tsp, sp, 4\n");
+          switch (node->ival) {
+             case '+': code = "add"; break;
+             case '-': code = "sub"; break;
+             default: fprintf(out, "unknown ADDOP\n"); code = "unknown";
+          }
+          fprintf(out, "\t%s\tt0, t1, t0\n", code);
+          break;
+       case AST_RELEXPR: // only for relational op expression
+          if (f->phase == 0) {
+             fprintf(out,"\t# Relational Expression (op %d,%c)\n",node->ival,node->ival);
+             if (regAlloc) {
+                genCondition(&eg, ast, node, hval, out);
+                break;
+             }
+             f->phase = 1;
+             pushWalk(&ws,node->child[0],0);  // child 0 is left side
+             continue;
+          }
+          if (f->phase == 1) {
+             fprintf(out,"\taddi\tsp, sp, -4\n\tsw\tt0, 0(sp)\n");
+             f->phase = 2;
+             pushWalk(&ws,node->child[1],0);  // child 1 is right side
+             continue;
+          }
+          switch (node->ival) {
+            case '=': code = "beq"; break;
+            case '!': code = "bne"; break;
+            case '>': code = "bgt"; break;
+            case '<': code = "blt"; break;
+            default: code = "unknown relop";
+          }
+          fprintf(out,"\tlw\tt1, 0(sp)\n\taddi\tsp, sp, 4\n\t%s\tt1, t0, .LL%d\n", code, hval);
+          break;
+       case AST_VARREF:
+          if (node->varKind == V_GLOBAL) {
+             fprintf(out, "\tlw\tt0, %s\n", atomName(node->name));
+          } else if (node->varKind == V_PARAM || node->varKind == V_LOCAL) {
+             frameAccess("lw", "t0", node->ival, slotHome(&eg, node->ival), "t0", out);
+          } else if (node->varKind == V_GLARRAY) {
+             if (f->phase == 0) {
+                fprintf(out, "\t#--ArrayReference--\n");
+                f->phase = 1;
+                pushWalk(&ws,node->child[0],0);
+                continue;
+             }
+             fprintf(out,"\tslli\tt0, t0, 2\n\tla\tt1, %s\n", atomName(node->name));
+             fprintf(out,"\tadd\tt1, t1, t0\n\tlw\tt0, 0(t1)\n");
+          } else {
+             fprintf(out, "Unknown variable kind assignment\n");
+          }
+          break;
+       case AST_CONSTANT: // for both int and string constants
+          if (node->valType == T_INT) {
+             fprintf(out,"\tli\tt0, %d\n", node->ival);
+          }
+          else if (node->valType == T_STRING) {
+             fprintf(out,"\tla\tt0, .SC%d\n", node->ival);
+          }
+          else if (node->valType == T_RETURNVAL)
+             fprintf(out, "\tmv\tt0, a%d\n", hval);
+          break;
+      }
+      nextWalk(&ws,node,hval);
    }
-
-   genCodeFromASTree(node->next,hval,out);
+   free(ws.frames);
+   free(eg.frames);
+   free(eg.need);
+   freeVCode(&eg.vc);
+   freeGlobalConstants(irGlobals);
+   irGlobals = 0;
 }
-
-
@@ -35,17 +35,94 @@ typedef struct astnode_s {
    DataType valType; // type for any data or variable referenced by this node
    VariableKind varKind; // if variable, kind (global, local, param, array)
    int ival;         // integer value if needed for this node type
-   char* strval;     // string value if needed for this node type
-   int strNeedsFreed; // tree freeing should also free the strval
+   Atom name;        // var or function name if this node type has one
+   int consed;       // made by the hash-consing factory (may be shared)
+   char* strval;     // string value if needed (from newASTString)
    struct astnode_s* next;  // pointer to next node in sibling sequence
    struct astnode_s* child[ASTNUMCHILDREN]; // pointers to children, if any
 } ASTNode;
 
+// Hash-consing: expressions, variable reads, and int and return
+// value constants are made by the consAST*() factory functions, which
+// hand back an existing node when an identical one (same fields, same
+// child pointers) is still valid, so repeated subtrees share one node
+// - a shared node is still valid if no variable it reads has been
+//   stored to since it was made, and no block boundary (start of a
+//   statement list, end of an if or while) or call that might change
+//   what it reads lies between; so within the region where it is
+//   valid, two uses with the same node pointer have the same value
+// - so the pointer tree is really a DAG; passes must not change a
+//   consed node in place, but put a new one in its parent instead
+//
+// Compact AST: the same tree, flattened into one node array
+// - the parser builds the pointer tree above; compactASTree() then
+//   copies it into a CompactAST, which printing and code generation
+//   work on
+// - nodes are numbered by their index in the array; index 0 is not
+//   a node and stands for "none" (like a NULL pointer)
+// - nodes are laid out in the order the walkers visit them: a node,
+//   then its child subtrees in order, then its next sibling; a
+//   shared (consed) node is copied once, at its first use, and later
+//   uses refer back to it
+// - string constant text lives in a side table, indexed by the
+//   string id in the constant's ival (strval is not kept per node)
+typedef unsigned int CNodeId;
+#define CNONE 0
+
+typedef struct {
+   unsigned char type;    // ASTNodeType
+   unsigned char valType; // DataType
+   unsigned char varKind; // VariableKind
+   int ival;
+   Atom name;
+   CNodeId next;
+   CNodeId child[ASTNUMCHILDREN];
+} CNode;
+
+typedef struct {
+   CNode* nodes;
+   unsigned int numNodes, capNodes; // numNodes counts unused node 0
+   unsigned int* strOffsets; // pool offset+1 of each string id's text
+   unsigned int numStrings, capStrings; // string ids are 0 to numStrings-1
+   char* strPool;
+   unsigned int poolLen, poolCap;
+   CNodeId root;
+   void* map;      // if loaded from a file (astfile.h), its mapping;
+   size_t mapSize; // then nodes are owned only if capNodes is nonzero
+} CompactAST;
+
+// Code generator options (bits for setCodeGenFlags)
+#define CG_REGALLOC 1  // expression temps in registers (vcode.h), not on the stack
+#define CG_SETHIULLMAN 2 // with CG_REGALLOC, do the needier operand first
+#define CG_LEAF 4        // small leaf functions have no frame: parameters never
+                         // assigned are read from their a register, other
+                         // slots live in t6..t2, and a0-a7 are left as set
+#define CG_IR 8          // generate function and program bodies from the IR (ir.h)
+#define CG_DUMPIR 16     // with CG_IR, print the IR to stderr
+#define CG_IRSTATS 32    // with CG_IR, print what the IR passes did to stderr
+
 // Function Prototypes -- see C file for detailed descriptions
 ASTNode* newASTNode(ASTNodeType type);
+char* newASTString(const char* str, int len);
+ASTNode* reverseASTList(ASTNode* list);
+ASTNode* consASTConstant(int value, DataType type);
+ASTNode* consASTVarRef(Atom name, VariableKind kind, int offset, ASTNode* index);
+ASTNode* consASTExpression(int op, ASTNode* left, ASTNode* right);
+void consASTStore(Atom name);
+void consASTCall();
+void consASTReset();
+unsigned int consASTShared();
 void freeASTree(ASTNode* tree);
-void printASTree(ASTNode* tree, int level, FILE *out);
-void genCodeFromASTree(ASTNode* tree, int count, FILE *out);
+size_t astBytesUsed();
+CompactAST* compactASTree(ASTNode* tree);
+void freeCompactAST(CompactAST* ast);
+size_t compactASTBytes(CompactAST* ast);
+const char* compactASTString(CompactAST* ast, int sid);
+void printASTree(CompactAST* ast, CNodeId node, int level, FILE *out);
+int alwaysTrue(CompactAST* ast, CNodeId cond);
+void setCodeGenFlags(unsigned int flags);
+int getUniqueLabelID();
+void genCodeFromASTree(CompactAST* ast, CNodeId node, int count, FILE *out);
 
 #endif
 
@@ -58,19 +135,19 @@ void genCodeFromASTree(ASTNode* tree, int count, FILE *out);
 //                child[0] is global var decls
 //                child[1] is function decls
 //                child[2] is main program statements
-// AST_VARDECL -- variable declaration; strval is var name; ival will be used
+// AST_VARDECL -- variable declaration; name is var name; ival will be used
 //                for local var offsets, array sizes, etc.
 //                next is the next variable
-// AST_FUNCTION - root node for function definition
+// AST_FUNCTION - root node for function definition; name is func name
 //                child[0] is param decls
 //                child[1] is function body
 //                child[2] is local var decls
 //                next is the next function def
 // AST_SBLOCK  -- statement block -- not used for now
-// AST_FUNCALL -- function call node; strval is function name;
+// AST_FUNCALL -- function call node; name is function name;
 //                child[0] is arguments
 //                next is the next statement
-// AST_ASSIGNMENT - assignment statement; strval is variable name
+// AST_ASSIGNMENT - assignment statement; name is variable name
 //                child[0] is right hand side expression
 //                next is the next statement
 // AST_WHILE   -- while loop statement
@@ -85,10 +162,12 @@ void genCodeFromASTree(ASTNode* tree, int count, FILE *out);
 // AST_EXPRESSION - expression node; ival is the operator id number
 //                child[0] is left subexpr
 //                child[1] is right subexpr
-// AST_VARREF  -- variable reference (read); strval is var name
+// AST_VARREF  -- variable reference (read); name is var name
 //                ival and valtype will be used
 // AST_CONSTANT - constant value; ival is int value for int constant,
-//                strval is string for a string constant; valtype is set
+//                or the string id for a string constant, whose text
+//                is in strval (in a CompactAST, in its string table);
+//                valtype is set
 // AST_ARGUMENT - function call argument
 //                child[0] is expression of arg;
 //                next is the next argument
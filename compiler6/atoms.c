@@ -0,0 +1,111 @@
+//
+// Atom Table Module
+// - atoms are numbered 0,1,2,... in the order they are first seen
+// - the name text of each atom is copied once into an arena (see
+//   arena.h; chunks never move, so atomName() pointers stay valid)
+// - the lookup index is an open-addressing hash table of atoms with
+//   a power-of-two size; it doubles when it gets over half full
+// - the FNV-1a hash of each name is computed once and kept, so other
+//   tables keyed by atoms never need to hash the text again
+//
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+#include "atoms.h"
+
+#define POOLCHUNKSIZE 65536
+#define INITINDEXSIZE 1024
+
+static char** names = 0;        // name text of each atom
+static unsigned int* hashes = 0; // hash of each atom's name
+static unsigned int count = 0, capacity = 0;
+static Atom* lookup = 0;        // hash index; holds atom+1, 0 is empty
+static unsigned int indexSize = 0;
+static Arena pool = { 0, POOLCHUNKSIZE, 0, 0 };
+
+// FNV-1a hash of len chars of a string
+static unsigned int hashText(const char* str, int len)
+{
+   unsigned int h = 2166136261u;
+   int i;
+   for (i=0; i < len; i++) {
+      h ^= (unsigned char) str[i];
+      h *= 16777619u;
+   }
+   return h;
+}
+
+// Double the hash index (or create it) and re-insert every atom
+static void growIndex()
+{
+   unsigned int i, j, mask;
+   free(lookup);
+   indexSize = indexSize ? indexSize * 2 : INITINDEXSIZE;
+   lookup = (Atom*) calloc(indexSize, sizeof(Atom));
+   mask = indexSize - 1;
+   for (i=0; i < count; i++) {
+      for (j = hashes[i] & mask; lookup[j]; j = (j+1) & mask)
+         ;
+      lookup[j] = i + 1;
+   }
+}
+
+// Intern the len-char name str and return its atom
+// - str does not need to be null terminated
+// - returns the existing atom if the name was seen before, otherwise
+//   copies the name and creates the next atom
+Atom internAtom(const char* str, int len)
+{
+   unsigned int h = hashText(str, len);
+   unsigned int j, mask;
+   Atom a;
+   if (2*(count+1) > indexSize)
+      growIndex();
+   mask = indexSize - 1;
+   for (j = h & mask; lookup[j]; j = (j+1) & mask) {
+      a = lookup[j] - 1;
+      if (hashes[a] == h && !strncmp(names[a], str, len) && !names[a][len])
+         return a;
+   }
+   if (count == capacity) {
+      capacity = capacity ? capacity * 2 : INITINDEXSIZE;
+      names = (char**) realloc(names, capacity * sizeof(char*));
+      hashes = (unsigned int*) realloc(hashes, capacity * sizeof(unsigned int));
+   }
+   a = count++;
+   names[a] = arenaStrndup(&pool, str, len);
+   hashes[a] = h;
+   lookup[j] = a + 1;
+   return a;
+}
+
+// Name text of an atom (null terminated; owned by the atom table)
+const char* atomName(Atom atom)
+{
+   return names[atom];
+}
+
+// Hash of an atom's name (computed once when it was interned)
+unsigned int atomHash(Atom atom)
+{
+   return hashes[atom];
+}
+
+// Number of atoms interned so far
+unsigned int atomCount()
+{
+   return count;
+}
+
+// Free the whole atom table; all atoms and names become invalid
+void freeAtoms()
+{
+   freeArena(&pool);
+   free(names);
+   free(hashes);
+   free(lookup);
+   names = 0;
+   hashes = 0;
+   lookup = 0;
+   count = capacity = indexSize = 0;
+}
@@ -0,0 +1,18 @@
+//
+// Atom Table Interface
+// - every identifier is interned once, at lex time, and from then
+//   on is named by a small dense integer (an Atom) instead of a string
+// - two identifiers are the same name iff their atoms are equal
+//
+#ifndef ATOMS_H
+#define ATOMS_H
+
+typedef unsigned int Atom;
+
+Atom internAtom(const char* name, int len);
+const char* atomName(Atom atom);
+unsigned int atomHash(Atom atom);
+unsigned int atomCount();
+void freeAtoms();
+
+#endif
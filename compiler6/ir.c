@@ -0,0 +1,804 @@
+//
+// Three-Address IR Module
+// - see ir.h; lowering walks the compact AST with an explicit stack,
+//   like the code generator, and makes the same instructions in the
+//   same order that the code generator's stack code would compute
+//   them, so the IR can be emitted as exactly that code
+// - label numbers come from getUniqueLabelID() in the same order
+//   the code generator takes them, so the listing is unchanged
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ir.h"
+
+// Lowering frames: a node being lowered and what is done of it
+typedef struct {
+   CNodeId id;
+   int phase;
+   int hval;         // argument number, or branch target block
+   int x, y, z, w;   // operand temps, blocks and labels so far
+} LowerFrame;
+
+typedef struct {
+   IRFunc* fn;
+   CompactAST* ast;
+   int cur;              // block being filled
+   LowerFrame* frames;
+   int top, cap;
+   unsigned char* need;  // Sethi-Ullman numbers, or NULL
+   int result;           // temp of the expression lowered last
+} Lowering;
+
+static void pushLower(Lowering* lw, CNodeId id, int hval)
+{
+   LowerFrame* f;
+   if (id == CNONE)
+      return;
+   if (lw->top == lw->cap) {
+      lw->cap = lw->cap ? lw->cap * 2 : 64;
+      lw->frames = (LowerFrame*) realloc(lw->frames, lw->cap * sizeof(LowerFrame));
+   }
+   f = &lw->frames[lw->top++];
+   memset(f, 0, sizeof(*f));
+   f->id = id;
+   f->hval = hval;
+}
+
+static IRFunc* newIRFunc(Atom name)
+{
+   IRFunc* fn = (IRFunc*) calloc(1, sizeof(IRFunc));
+   fn->name = name;
+   newIRBlock(fn);
+   return fn;
+}
+
+// Add an empty block at the end of the layout; returns its number
+int newIRBlock(IRFunc* fn)
+{
+   IRBlock* b;
+   if (fn->numBlocks == fn->capBlocks) {
+      fn->capBlocks = fn->capBlocks ? fn->capBlocks * 2 : 16;
+      fn->blocks = (IRBlock*) realloc(fn->blocks, fn->capBlocks * sizeof(IRBlock));
+   }
+   b = &fn->blocks[fn->numBlocks];
+   memset(b, 0, sizeof(*b));
+   b->succ[0] = b->succ[1] = -1;
+   return fn->numBlocks++;
+}
+
+// Add an empty block at layout position at; returns at
+// - blocks from there on move up one, and every edge, predecessor
+//   and phi argument that names them is renumbered
+int insertIRBlock(IRFunc* fn, int at)
+{
+   IRBlock* b;
+   int i, j, k;
+   newIRBlock(fn);
+   memmove(&fn->blocks[at+1], &fn->blocks[at], (fn->numBlocks-1 - at) * sizeof(IRBlock));
+   memset(&fn->blocks[at], 0, sizeof(IRBlock));
+   fn->blocks[at].succ[0] = fn->blocks[at].succ[1] = -1;
+   for (i=0; i < fn->numBlocks; i++) {
+      b = &fn->blocks[i];
+      for (j=0; j < 2; j++)
+         if (b->succ[j] >= at)
+            b->succ[j]++;
+      for (j=0; j < b->numPreds; j++)
+         if (b->preds[j] >= at)
+            b->preds[j]++;
+      for (j=0; j < b->len; j++)
+         if (b->code[j].op == IR_PHI)
+            for (k=0; k < b->code[j].imm; k++)
+               if (b->code[j].args[k].pred >= at)
+                  b->code[j].args[k].pred++;
+   }
+   return at;
+}
+
+// Is pred a predecessor of block?
+static int isIRPred(IRFunc* fn, int block, int pred)
+{
+   IRBlock* b = &fn->blocks[block];
+   int k;
+   for (k=0; k < b->numPreds; k++)
+      if (b->preds[k] == pred)
+         return 1;
+   return 0;
+}
+
+// Take the blocks not kept out of the layout; returns how many
+// - no kept block may go on to one that is not; the others are
+//   renumbered, and phi arguments from blocks that are no longer
+//   predecessors are dropped
+int removeIRBlocks(IRFunc* fn, const char* keep)
+{
+   int* map = (int*) malloc(fn->numBlocks * sizeof(int));
+   IRBlock* b;
+   IRInstr* in;
+   int i, j, k, n = 0, removed;
+   for (i=0; i < fn->numBlocks; i++)
+      map[i] = keep[i] ? n++ : -1;
+   removed = fn->numBlocks - n;
+   for (i=0; i < fn->numBlocks; i++) {
+      b = &fn->blocks[i];
+      if (map[i] < 0) {
+         for (j=0; j < b->len; j++)
+            free(b->code[j].args);
+         free(b->code);
+         free(b->preds);
+         continue;
+      }
+      for (j=0; j < 2; j++)
+         if (b->succ[j] >= 0)
+            b->succ[j] = map[b->succ[j]];
+      fn->blocks[map[i]] = *b;
+   }
+   fn->numBlocks = n;
+   computeIRPreds(fn);
+   for (i=0; i < n; i++) {
+      b = &fn->blocks[i];
+      for (j=0; j < b->len && b->code[j].op == IR_PHI; j++) {
+         in = &b->code[j];
+         for (k=0; k < in->imm; ) {
+            in->args[k].pred = map[in->args[k].pred];
+            if (in->args[k].pred >= 0 && isIRPred(fn, i, in->args[k].pred))
+               k++;
+            else
+               in->args[k] = in->args[--in->imm];
+         }
+      }
+   }
+   free(map);
+   return removed;
+}
+
+// Add an instruction to a block, before its instruction at
+// - the pointer is only good until the block's next instruction
+IRInstr* insertIRInstr(IRFunc* fn, int block, int at, IROp op)
+{
+   IRBlock* b = &fn->blocks[block];
+   IRInstr* in;
+   if (b->len == b->cap) {
+      b->cap = b->cap ? b->cap * 2 : 16;
+      b->code = (IRInstr*) realloc(b->code, b->cap * sizeof(IRInstr));
+   }
+   in = &b->code[at];
+   memmove(in+1, in, (b->len - at) * sizeof(IRInstr));
+   b->len++;
+   memset(in, 0, sizeof(*in));
+   in->op = op;
+   return in;
+}
+
+// Add an instruction to the end of a block
+IRInstr* appendIRInstr(IRFunc* fn, int block, IROp op)
+{
+   return insertIRInstr(fn, block, fn->blocks[block].len, op);
+}
+
+// Take instruction at out of a block
+void removeIRInstr(IRFunc* fn, int block, int at)
+{
+   IRBlock* b = &fn->blocks[block];
+   free(b->code[at].args);
+   memmove(&b->code[at], &b->code[at+1], (b->len - at - 1) * sizeof(IRInstr));
+   b->len--;
+}
+
+// Add a variable, its own original, to the end of fn->vars
+// - the pointer is only good until the next variable is added
+static IRVar* addIRVar(IRFunc* fn)
+{
+   IRVar* v;
+   if (fn->numVars == fn->capVars) {
+      fn->capVars = fn->capVars ? fn->capVars * 2 : 16;
+      fn->vars = (IRVar*) realloc(fn->vars, fn->capVars * sizeof(IRVar));
+   }
+   v = &fn->vars[fn->numVars];
+   memset(v, 0, sizeof(*v));
+   v->orig = fn->numVars++;
+   return v;
+}
+
+// The variable for a global (by name) or frame slot, added if new
+int findIRVar(IRFunc* fn, VariableKind kind, Atom name, int slot)
+{
+   IRVar* v;
+   int i;
+   for (i=0; i < fn->numVars; i++) {
+      v = &fn->vars[i];
+      if (v->version == 0 &&
+          (v->kind == V_GLOBAL ? kind == V_GLOBAL && v->name == name
+                               : kind != V_GLOBAL && v->slot == slot))
+         return i;
+   }
+   v = addIRVar(fn);
+   v->kind = kind;
+   v->name = name;
+   v->slot = kind == V_GLOBAL ? -1 : slot;
+   return v->orig;
+}
+
+// Make a new SSA version of variable orig; returns it
+int newIRVar(IRFunc* fn, int orig)
+{
+   IRVar* v = addIRVar(fn);
+   int var = v->orig;
+   *v = fn->vars[orig];
+   v->orig = orig;
+   v->version = ++fn->vars[orig].versions;
+   v->versions = 0;
+   return var;
+}
+
+// Make a new local in a frame slot of its own, named after orig
+// (or unnamed, if orig is -1)
+int newIRSlot(IRFunc* fn, int orig)
+{
+   IRVar* v = addIRVar(fn);
+   v->kind = V_LOCAL;
+   v->name = orig < 0 ? 0 : fn->vars[fn->vars[orig].orig].name;
+   v->slot = fn->numSlots++;
+   return v->orig;
+}
+
+int irIsBranch(int op)
+{
+   return op >= IR_BEQ && op <= IR_BLT;
+}
+
+// The variable an instruction reads, or -1 (a phi's are its args)
+int irReadsVar(IRInstr* in)
+{
+   if (in->op == IR_LOAD || in->op == IR_LOADELEM || in->op == IR_STOREELEM)
+      return in->var;
+   return -1;
+}
+
+static void addNote(Lowering* lw, IRNote note, Atom name, int ival)
+{
+   IRInstr* in = appendIRInstr(lw->fn, lw->cur, IR_NOTE);
+   in->imm = note;
+   in->name = name;
+   in->var = ival;
+}
+
+// Add an instruction that defines a new temp; returns the temp
+static int addDef(Lowering* lw, IROp op, int imm)
+{
+   IRInstr* in = appendIRInstr(lw->fn, lw->cur, op);
+   in->dst = ++lw->fn->numTemps;
+   in->imm = imm;
+   return in->dst;
+}
+
+static IRValue tempValue(int t)
+{
+   IRValue v;
+   v.kind = IV_TEMP;
+   v.val = t;
+   return v;
+}
+
+// Sethi-Ullman numbers of an expression's nodes, as the code
+// generator counts them (see labelExpr() in astree.c)
+static void labelNeeds(Lowering* lw, CNodeId id)
+{
+   CompactAST* ast = lw->ast;
+   unsigned char* need = lw->need;
+   int base = lw->top, l, r, n, i;
+   LowerFrame* f;
+   CNode* node;
+   pushLower(lw, id, 0);
+   while (lw->top > base) {
+      f = &lw->frames[lw->top-1];
+      node = &ast->nodes[f->id];
+      if (need[f->id]) {
+         lw->top--;
+         continue;
+      }
+      if (f->phase == 0) {
+         f->phase = 1;
+         id = f->id;
+         for (i=0; i < 2; i++)
+            if (node->child[i] != CNONE && !need[node->child[i]])
+               pushLower(lw, node->child[i], 0);
+         if (lw->frames[lw->top-1].id != id)
+            continue;
+      }
+      l = node->child[0] != CNONE ? need[node->child[0]] : 0;
+      r = node->child[1] != CNONE ? need[node->child[1]] : 0;
+      if (node->type == AST_EXPRESSION || node->type == AST_RELEXPR)
+         n = l == r ? l+1 : l > r ? l : r;
+      else if (node->type == AST_VARREF && node->varKind == V_GLARRAY)
+         n = l > 2 ? l : 2;
+      else
+         n = 1;
+      need[f->id] = n < 255 ? n : 255;
+      lw->top--;
+   }
+}
+
+// Should the second operand (b) be lowered first?
+static int lowerSecondFirst(Lowering* lw, CNodeId a, CNodeId b)
+{
+   if (!lw->need)
+      return 0;
+   labelNeeds(lw, a);
+   labelNeeds(lw, b);
+   return lw->need[b] > lw->need[a];
+}
+
+// Set each block's fall through edge and its predecessors
+static void finishBlocks(IRFunc* fn)
+{
+   IRBlock* b;
+   int i;
+   for (i=0; i < fn->numBlocks; i++) {
+      b = &fn->blocks[i];
+      if (b->len == 0 || b->code[b->len-1].op != IR_JUMP)
+         b->succ[0] = i+1 < fn->numBlocks ? i+1 : -1;
+      if (b->len == 0 || !irIsBranch(b->code[b->len-1].op))
+         b->succ[1] = -1;
+   }
+   computeIRPreds(fn);
+}
+
+// Recompute every block's predecessor list from the succ edges
+void computeIRPreds(IRFunc* fn)
+{
+   IRBlock *b, *s;
+   int i, j;
+   for (i=0; i < fn->numBlocks; i++)
+      fn->blocks[i].numPreds = 0;
+   for (i=0; i < fn->numBlocks; i++) {
+      b = &fn->blocks[i];
+      for (j=0; j < 2; j++) {
+         if (b->succ[j] < 0 || (j == 1 && b->succ[1] == b->succ[0]))
+            continue;
+         s = &fn->blocks[b->succ[j]];
+         if (s->numPreds == s->capPreds) {
+            s->capPreds = s->capPreds ? s->capPreds * 2 : 4;
+            s->preds = (int*) realloc(s->preds, s->capPreds * sizeof(int));
+         }
+         s->preds[s->numPreds++] = i;
+      }
+   }
+}
+
+// Lower a statement list into lw->fn
+// - each node's instructions are made in the order the code
+//   generator's stack code computes them; with lw->need, the
+//   operand that needs more registers is done first instead
+static void lowerStatements(Lowering* lw, CNodeId list)
+{
+   CompactAST* ast = lw->ast;
+   IRFunc* fn = lw->fn;
+   LowerFrame* f;
+   IRInstr* in;
+   CNode* node;
+   int hval, b, left, right;
+   pushLower(lw, list, 0);
+   while (lw->top > 0) {
+      f = &lw->frames[lw->top-1];
+      node = &ast->nodes[f->id];
+      hval = f->hval;
+      switch (node->type) {
+       case AST_ASSIGNMENT:
+          // x: value temp, y: index temp, z: index was done first
+          if (f->phase == 0) {
+             addNote(lw, N_ASSIGN, 0, 0);
+             b = node->varKind == V_GLARRAY &&
+                 lowerSecondFirst(lw, node->child[0], node->child[1]);
+             f = &lw->frames[lw->top-1]; // labelling may move the frames
+             f->phase = 1;
+             f->z = b;
+             pushLower(lw, node->child[b], 0);
+             continue;
+          }
+          if (f->phase == 1) {
+             if (f->z)
+                f->y = lw->result;
+             else
+                f->x = lw->result;
+             if (node->varKind == V_GLARRAY) {
+                f->phase = 2;
+                pushLower(lw, node->child[f->z ? 0 : 1], 0);
+                continue;
+             }
+             in = appendIRInstr(fn, lw->cur, IR_STORE);
+             in->a = tempValue(f->x);
+             in->var = findIRVar(fn, node->varKind, node->name, node->ival);
+             break;
+          }
+          if (f->z)
+             f->x = lw->result;
+          else
+             f->y = lw->result;
+          in = appendIRInstr(fn, lw->cur, IR_STOREELEM);
+          in->a = tempValue(f->x);
+          in->b = tempValue(f->y);
+          in->imm = node->ival;
+          in->name = node->name;
+          in->var = -1;
+          break;
+       case AST_FUNCALL:
+          if (f->phase == 0) {
+             addNote(lw, N_FUNCALL, node->name, 0);
+             f->phase = 1;
+             pushLower(lw, node->child[0], 0); // arguments, numbered from 0
+             continue;
+          }
+          appendIRInstr(fn, lw->cur, IR_CALL)->name = node->name;
+          break;
+       case AST_ARGUMENT:
+          if (f->phase == 0) {
+             f->phase = 1;
+             pushLower(lw, node->child[0], hval);
+             continue;
+          }
+          in = appendIRInstr(fn, lw->cur, IR_ARG);
+          in->a = tempValue(lw->result);
+          in->imm = hval;
+          hval++; // the next argument's number
+          break;
+       case AST_WHILE:
+          // x: block before the loop, y: body block, z: condition's label
+          // (a condition that always holds makes no condition block:
+          // x falls into the body, which jumps back to its own start)
+          if (f->phase == 0) {
+             f->y = getUniqueLabelID();
+             f->z = getUniqueLabelID();
+             addNote(lw, N_WHILE, 0, 0);
+             if (!alwaysTrue(ast, node->child[0]))
+                appendIRInstr(fn, lw->cur, IR_JUMP);
+             f->x = lw->cur;
+             b = newIRBlock(fn);
+             fn->blocks[b].label = f->y;
+             f->y = lw->cur = b;
+             addNote(lw, N_BODY, 0, 0);
+             f->phase = 1;
+             pushLower(lw, node->child[1], 0);
+             continue;
+          }
+          if (f->phase == 1 && alwaysTrue(ast, node->child[0])) {
+             appendIRInstr(fn, lw->cur, IR_JUMP);
+             fn->blocks[lw->cur].succ[0] = f->y;
+             f->phase = 2;
+          }
+          if (f->phase == 1) {
+             addNote(lw, N_CONDITION, 0, 0);
+             b = newIRBlock(fn);
+             fn->blocks[b].label = f->z;
+             fn->blocks[f->x].succ[0] = b;
+             lw->cur = b;
+             f->phase = 2;
+             pushLower(lw, node->child[0], f->y);
+             continue;
+          }
+          lw->cur = newIRBlock(fn);
+          addNote(lw, N_ENDLOOP, 0, 0);
+          break;
+       case AST_IFTHEN:
+          // x: condition block, y and z: labels of the if part and the
+          // end, w: block that ends the else part
+          if (f->phase == 0) {
+             f->y = getUniqueLabelID();
+             f->z = getUniqueLabelID();
+             addNote(lw, N_IFTHENELSE, 0, 0);
+             f->phase = 1;
+             pushLower(lw, node->child[0], -1); // target set below
+             continue;
+          }
+          if (f->phase == 1) {
+             f->x = lw->cur;
+             lw->cur = newIRBlock(fn);
+             addNote(lw, N_ELSEPART, 0, 0);
+             f->phase = 2;
+             pushLower(lw, node->child[2], 0);
+             continue;
+          }
+          if (f->phase == 2) {
+             appendIRInstr(fn, lw->cur, IR_JUMP);
+             f->w = lw->cur;
+             b = newIRBlock(fn);
+             fn->blocks[b].label = f->y;
+             fn->blocks[f->x].succ[1] = b;
+             lw->cur = b;
+             addNote(lw, N_IFPART, 0, 0);
+             f->phase = 3;
+             pushLower(lw, node->child[1], 0);
+             continue;
+          }
+          b = newIRBlock(fn);
+          fn->blocks[b].label = f->z;
+          fn->blocks[f->w].succ[0] = b;
+          lw->cur = b;
+          addNote(lw, N_ENDIF, 0, 0);
+          break;
+       case AST_RELEXPR:
+       case AST_EXPRESSION:
+          // x: first operand's temp, z: the right one was done first
+          if (f->phase == 0) {
+             addNote(lw, node->type == AST_RELEXPR ? N_RELEXPR : N_BINOP, 0, node->ival);
+             b = lowerSecondFirst(lw, node->child[0], node->child[1]);
+             f = &lw->frames[lw->top-1]; // labelling may move the frames
+             f->z = b;
+             f->phase = 1;
+             if (node->type == AST_RELEXPR)
+                hval = 0; // no argument number below a condition
+             pushLower(lw, node->child[f->z], hval);
+             continue;
+          }
+          if (f->phase == 1) {
+             f->x = lw->result;
+             f->phase = 2;
+             pushLower(lw, node->child[!f->z], node->type == AST_RELEXPR ? 0 : hval);
+             continue;
+          }
+          // operands in source order, whichever was done first
+          left = f->z ? lw->result : f->x;
+          right = f->z ? f->x : lw->result;
+          if (node->type == AST_RELEXPR) {
+             switch (node->ival) {
+               case '=': b = IR_BEQ; break;
+               case '!': b = IR_BNE; break;
+               case '>': b = IR_BGT; break;
+               default: b = IR_BLT; break;
+             }
+             in = appendIRInstr(fn, lw->cur, (IROp) b);
+             fn->blocks[lw->cur].succ[1] = hval;
+          } else {
+             in = appendIRInstr(fn, lw->cur, node->ival == '+' ? IR_ADD : IR_SUB);
+             in->dst = lw->result = ++fn->numTemps;
+          }
+          in->a = tempValue(left);
+          in->b = tempValue(right);
+          break;
+       case AST_VARREF:
+          if (node->varKind == V_GLARRAY) {
+             if (f->phase == 0) {
+                addNote(lw, N_ARRAYREF, 0, 0);
+                f->phase = 1;
+                pushLower(lw, node->child[0], 0);
+                continue;
+             }
+             f->x = lw->result;
+             lw->result = addDef(lw, IR_LOADELEM, 0);
+             in = &fn->blocks[lw->cur].code[fn->blocks[lw->cur].len-1];
+             in->a = tempValue(f->x);
+             in->name = node->name;
+             in->var = -1;
+          } else {
+             lw->result = addDef(lw, IR_LOAD, 0);
+             in = &fn->blocks[lw->cur].code[fn->blocks[lw->cur].len-1];
+             in->var = findIRVar(fn, node->varKind, node->name, node->ival);
+          }
+          break;
+       default: // AST_CONSTANT
+          if (node->valType == T_STRING)
+             lw->result = addDef(lw, IR_LASTR, node->ival);
+          else if (node->valType == T_RETURNVAL)
+             lw->result = addDef(lw, IR_RETVAL, hval);
+          else
+             lw->result = addDef(lw, IR_LI, node->ival);
+          break;
+      }
+      // done with this node: on to its next sibling, or pop
+      f = &lw->frames[lw->top-1];
+      if (node->next == CNONE) {
+         lw->top--;
+      } else {
+         f->id = node->next;
+         f->hval = hval;
+         f->phase = 0;
+      }
+   }
+}
+
+static IRFunc* lowerBody(CompactAST* ast, IRFunc* fn, CNodeId body, int needierFirst)
+{
+   Lowering lw;
+   memset(&lw, 0, sizeof(lw));
+   lw.fn = fn;
+   lw.ast = ast;
+   if (needierFirst)
+      lw.need = (unsigned char*) calloc(ast->numNodes, 1);
+   lowerStatements(&lw, body);
+   finishBlocks(fn);
+   free(lw.frames);
+   free(lw.need);
+   return fn;
+}
+
+// Lower an AST_FUNCTION node's body
+// - with needierFirst, operands are lowered in Sethi-Ullman order
+IRFunc* lowerToIR(CompactAST* ast, CNodeId func, int needierFirst)
+{
+   CNode* node = &ast->nodes[func];
+   IRFunc* fn = newIRFunc(node->name);
+   CNodeId id;
+   for (id = node->child[0]; id != CNONE; id = ast->nodes[id].next)
+      fn->numParams++;
+   fn->numSlots = fn->numParams;
+   for (id = node->child[2]; id != CNONE; id = ast->nodes[id].next)
+      fn->numSlots++;
+   return lowerBody(ast, fn, node->child[1], needierFirst);
+}
+
+// Lower the program block (a statement list)
+IRFunc* lowerProgramToIR(CompactAST* ast, CNodeId body, int needierFirst)
+{
+   return lowerBody(ast, newIRFunc(0), body, needierFirst);
+}
+
+void freeIR(IRFunc* fn)
+{
+   int i, j;
+   if (!fn)
+      return;
+   for (i=0; i < fn->numBlocks; i++) {
+      for (j=0; j < fn->blocks[i].len; j++)
+         free(fn->blocks[i].code[j].args);
+      free(fn->blocks[i].code);
+      free(fn->blocks[i].preds);
+   }
+   free(fn->blocks);
+   free(fn->vars);
+   free(fn);
+}
+
+//
+// IR dump
+//
+
+static const char* irOpNames[] = {
+   "note", "li", "lastr", "la", "retval", "load", "store", "loadelem",
+   "storeelem", "add", "sub", "arg", "call", "beq", "bne", "bgt",
+   "blt", "jump", "phi"
+};
+
+static const char* irNoteNames[] = {
+   "assignment", "funcall to", "while loop", "body", "condition",
+   "endloop", "ifthenelse", "elsepart", "ifpart", "endif",
+   "binary op", "relational op", "array reference"
+};
+
+static void printIRValue(IRValue v, FILE* out)
+{
+   if (v.kind == IV_TEMP)
+      fprintf(out, "t%d", v.val);
+   else if (v.kind == IV_CONST)
+      fprintf(out, "%d", v.val);
+   else
+      fprintf(out, "-");
+}
+
+static void printIRVar(IRFunc* fn, int var, FILE* out)
+{
+   IRVar* v = &fn->vars[var];
+   if (v->kind == V_GLOBAL)
+      fprintf(out, "@%s", atomName(v->name));
+   else
+      fprintf(out, "%s$%d", v->name ? atomName(v->name) : "tmp", v->slot);
+   if (v->version)
+      fprintf(out, ".%d", v->version);
+}
+
+// Print an element operand: name[index], or name@var[index] when
+// the array's address is in a variable
+static void printIRElem(IRFunc* fn, IRInstr* in, IRValue index, FILE* out)
+{
+   fprintf(out, " %s", atomName(in->name));
+   if (in->var >= 0) {
+      fprintf(out, "@");
+      printIRVar(fn, in->var, out);
+   }
+   fprintf(out, "[");
+   printIRValue(index, out);
+   fprintf(out, "]");
+}
+
+// Print one instruction (no newline)
+static void printIRInstr(IRFunc* fn, IRInstr* in, FILE* out)
+{
+   int i;
+   if (in->op == IR_NOTE) {
+      fprintf(out, "; %s", irNoteNames[in->imm]);
+      if (in->name)
+         fprintf(out, " %s", atomName(in->name));
+      if (in->var)
+         fprintf(out, " (%c)", in->var);
+      return;
+   }
+   if (in->dst)
+      fprintf(out, "t%d = ", in->dst);
+   if (in->op == IR_PHI) {
+      printIRVar(fn, in->var, out);
+      fprintf(out, " = ");
+   }
+   fprintf(out, "%s", irOpNames[in->op]);
+   switch (in->op) {
+    case IR_LI: case IR_RETVAL:
+       fprintf(out, " %d", in->imm);
+       break;
+    case IR_LASTR:
+       fprintf(out, " .SC%d", in->imm);
+       break;
+    case IR_LA:
+       fprintf(out, " %s", atomName(in->name));
+       break;
+    case IR_LOAD:
+       fprintf(out, " ");
+       printIRVar(fn, in->var, out);
+       break;
+    case IR_STORE:
+       fprintf(out, " ");
+       printIRVar(fn, in->var, out);
+       fprintf(out, ", ");
+       printIRValue(in->a, out);
+       break;
+    case IR_LOADELEM:
+       printIRElem(fn, in, in->a, out);
+       break;
+    case IR_STOREELEM:
+       printIRElem(fn, in, in->b, out);
+       fprintf(out, ", ");
+       printIRValue(in->a, out);
+       break;
+    case IR_ARG:
+       fprintf(out, " a%d, ", in->imm);
+       printIRValue(in->a, out);
+       break;
+    case IR_CALL:
+       fprintf(out, " %s", atomName(in->name));
+       break;
+    case IR_JUMP:
+       break;
+    case IR_PHI:
+       for (i=0; i < in->imm; i++) {
+          fprintf(out, i ? ", " : " ");
+          printIRVar(fn, in->args[i].var, out);
+          fprintf(out, " (B%d)", in->args[i].pred);
+       }
+       break;
+    default: // binary ops and branches
+       fprintf(out, " ");
+       printIRValue(in->a, out);
+       fprintf(out, ", ");
+       printIRValue(in->b, out);
+       break;
+   }
+}
+
+// Print a function's IR: its blocks, with their edges, and code
+void printIR(IRFunc* fn, FILE* out)
+{
+   IRBlock* b;
+   int i, j;
+   fprintf(out, "%s %s: %d params, %d slots, %d vars, %d temps, %d blocks\n",
+           fn->name ? "function" : "program", fn->name ? atomName(fn->name) : "block",
+           fn->numParams, fn->numSlots, fn->numVars, fn->numTemps, fn->numBlocks);
+   for (i=0; i < fn->numBlocks; i++) {
+      b = &fn->blocks[i];
+      fprintf(out, "B%d", i);
+      if (b->label)
+         fprintf(out, " (.LL%d)", b->label);
+      fprintf(out, ":  preds");
+      for (j=0; j < b->numPreds; j++)
+         fprintf(out, " B%d", b->preds[j]);
+      fprintf(out, "  succs");
+      for (j=0; j < 2; j++)
+         if (b->succ[j] >= 0)
+            fprintf(out, " B%d", b->succ[j]);
+      fprintf(out, "\n");
+      for (j=0; j < b->len; j++) {
+         fprintf(out, "    ");
+         printIRInstr(fn, &b->code[j], out);
+         if (irIsBranch(b->code[j].op) || b->code[j].op == IR_JUMP)
+            fprintf(out, " -> B%d", b->succ[b->code[j].op != IR_JUMP]);
+         fprintf(out, "\n");
+      }
+   }
+   fprintf(out, "\n");
+}
@@ -0,0 +1,131 @@
+//
+// Three-Address IR Interface
+// - a function body (or the program block) lowered from the compact
+//   AST into basic blocks of three-address instructions, with the
+//   control-flow edges of its whiles and ifs made explicit
+// - values live in temps (t1, t2, ...), each defined by exactly one
+//   instruction and used once, within the statement that defines it;
+//   anything that lives longer is a variable (a global, parameter,
+//   local, or one a pass made), read and written with IR_LOAD and
+//   IR_STORE
+// - blocks are kept in layout (output) order; a block goes on to
+//   succ[0] (by IR_JUMP, or by falling through, which the emitter
+//   turns into a jump if succ[0] is not the next block), and IR_B*
+//   branches go to succ[1] when taken; the program or function ends
+//   after a block with no successors
+// - in SSA form (see ssa.h) each version of a parameter or local is
+//   a variable of its own, and IR_PHI instructions start the blocks
+// - IR_NOTE instructions carry the comments of the assembly listing,
+//   so the emitter can reproduce the AST code generator's output;
+//   analyses ignore them
+//
+#ifndef IR_H
+#define IR_H
+
+#include <stdio.h>
+#include "astree.h"
+
+typedef enum {
+   IR_NOTE,      // listing comment: imm is the IRNote, name/var its detail
+   IR_LI,        // dst = imm
+   IR_LASTR,     // dst = address of string constant imm
+   IR_LA,        // dst = address of global array name
+   IR_RETVAL,    // dst = return value register a<imm>
+   IR_LOAD,      // dst = variable var
+   IR_STORE,     // variable var = a
+   IR_LOADELEM,  // dst = name[a] (name's address is in var, or -1 for la)
+   IR_STOREELEM, // name[b] = a (imm is the listing's index note; var as
+                 // for IR_LOADELEM)
+   IR_ADD,       // dst = a + b
+   IR_SUB,       // dst = a - b
+   IR_ARG,       // argument register a<imm> = a
+   IR_CALL,      // call name
+   IR_BEQ, IR_BNE, IR_BGT, IR_BLT, // if (a op b) go to succ[1]
+   IR_JUMP,      // go to succ[0]
+   IR_PHI        // variable var = the args' variable from the block
+                 // control came from (imm args)
+} IROp;
+
+// Listing comments
+typedef enum {
+   N_ASSIGN, N_FUNCALL, N_WHILE, N_BODY, N_CONDITION, N_ENDLOOP,
+   N_IFTHENELSE, N_ELSEPART, N_IFPART, N_ENDIF, N_BINOP, N_RELEXPR,
+   N_ARRAYREF
+} IRNote;
+
+// An operand: nothing, a temp, or a constant
+#define IV_NONE  0
+#define IV_TEMP  1
+#define IV_CONST 2
+
+typedef struct {
+   int kind;  // IV_
+   int val;   // temp number or constant value
+} IRValue;
+
+// A phi's argument: the variable it takes from a predecessor
+typedef struct {
+   int pred;          // predecessor block
+   int var;
+} IRPhiArg;
+
+typedef struct {
+   unsigned char op;  // IROp
+   int dst;           // temp defined, or 0
+   IRValue a, b;
+   int imm;
+   int var;           // variable of IR_LOAD, IR_STORE and IR_PHI, or
+                      // the array address variable of IR_*ELEM
+   Atom name;         // array, function, or IR_NOTE detail
+   IRPhiArg* args;    // IR_PHI's arguments
+} IRInstr;
+
+// A variable: a global (by name) or a frame slot
+typedef struct {
+   VariableKind kind; // V_GLOBAL, V_PARAM or V_LOCAL
+   Atom name;         // for the listing, and a global's symbol
+   int slot;          // frame slot of a parameter or local
+   int orig;          // the variable this is an SSA version of (or itself)
+   int version;       // its SSA version number, 0 for the variable itself
+   int versions;      // versions made of it so far
+} IRVar;
+
+typedef struct {
+   IRInstr* code;
+   int len, cap;
+   int label;         // .LL number, or 0 if it needs none (yet)
+   int succ[2];       // successor blocks (-1 for none): fall through
+                      // or jump target, and branch target
+   int* preds;        // predecessor blocks
+   int numPreds, capPreds;
+} IRBlock;
+
+typedef struct {
+   Atom name;         // function name, or 0 for the program block
+   IRBlock* blocks;   // in layout order; block 0 is the entry
+   int numBlocks, capBlocks;
+   IRVar* vars;
+   int numVars, capVars;
+   int numParams;     // parameters are slots 0..numParams-1
+   int numSlots;      // frame slots used by parameters and locals
+   int numTemps;      // temps are 1..numTemps
+} IRFunc;
+
+IRFunc* lowerToIR(CompactAST* ast, CNodeId func, int needierFirst);
+IRFunc* lowerProgramToIR(CompactAST* ast, CNodeId body, int needierFirst);
+void freeIR(IRFunc* fn);
+int newIRBlock(IRFunc* fn);
+int insertIRBlock(IRFunc* fn, int at);
+int removeIRBlocks(IRFunc* fn, const char* keep);
+IRInstr* appendIRInstr(IRFunc* fn, int block, IROp op);
+IRInstr* insertIRInstr(IRFunc* fn, int block, int at, IROp op);
+void removeIRInstr(IRFunc* fn, int block, int at);
+int findIRVar(IRFunc* fn, VariableKind kind, Atom name, int slot);
+int newIRVar(IRFunc* fn, int orig);
+int newIRSlot(IRFunc* fn, int orig);
+void computeIRPreds(IRFunc* fn);
+int irIsBranch(int op);
+int irReadsVar(IRInstr* in);
+void printIR(IRFunc* fn, FILE* out);
+
+#endif
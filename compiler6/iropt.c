@@ -0,0 +1,1033 @@
+//
+// IR Optimization Module
+// - see iropt.h
+//
+#include <stdlib.h>
+#include <string.h>
+#include "iropt.h"
+#include "ssa.h"
+
+//
+// Globals known program-wide
+//
+
+// Is name a function of the program (not a library routine, which
+// cannot change a global)?
+static int isProgramFunc(CompactAST* ast, CNodeId funcs, Atom name)
+{
+   for (; funcs != CNONE; funcs = ast->nodes[funcs].next)
+      if (ast->nodes[funcs].name == name)
+         return 1;
+   return 0;
+}
+
+// Does a statement call a function of the program, anywhere in it?
+static int makesCall(CompactAST* ast, CNodeId funcs, CNodeId id)
+{
+   CNodeId* stack;
+   CNode* node;
+   int top = 0, cap = 64, i, found = 0;
+   stack = (CNodeId*) malloc(cap * sizeof(CNodeId));
+   node = &ast->nodes[id];
+   for (i=0; i < ASTNUMCHILDREN; i++)
+      if (node->child[i] != CNONE)
+         stack[top++] = node->child[i];
+   found = node->type == AST_FUNCALL && isProgramFunc(ast, funcs, node->name);
+   while (top > 0 && !found) {
+      node = &ast->nodes[stack[--top]];
+      found = node->type == AST_FUNCALL && isProgramFunc(ast, funcs, node->name);
+      if (top + ASTNUMCHILDREN+1 > cap) {
+         cap *= 2;
+         stack = (CNodeId*) realloc(stack, cap * sizeof(CNodeId));
+      }
+      if (node->next != CNONE)
+         stack[top++] = node->next;
+      for (i=0; i < ASTNUMCHILDREN; i++)
+         if (node->child[i] != CNONE)
+            stack[top++] = node->child[i];
+   }
+   free(stack);
+   return found;
+}
+
+static int findGlobal(IRGlobals* globals, Atom name)
+{
+   int k;
+   for (k=0; k < globals->num; k++)
+      if (globals->names[k] == name)
+         return k;
+   return -1;
+}
+
+// Find the int globals whose value is known program-wide
+// - every assignment in the tree is counted; a global assigned
+//   once, by a constant, in a statement of the program block that
+//   no call of a program function comes before, is known too
+IRGlobals* findGlobalConstants(CompactAST* ast, CNodeId program)
+{
+   IRGlobals* globals = (IRGlobals*) calloc(1, sizeof(IRGlobals));
+   CNode* prog = &ast->nodes[program];
+   CNode* node;
+   CNodeId id;
+   int* stores;
+   int n = 0, k, i;
+   for (id = prog->child[0]; id != CNONE; id = ast->nodes[id].next)
+      n++;
+   globals->names = (Atom*) malloc((n+1) * sizeof(Atom));
+   globals->values = (int*) calloc(n+1, sizeof(int));
+   globals->assigned = (char*) calloc(n+1, 1);
+   stores = (int*) calloc(n+1, sizeof(int));
+   for (id = prog->child[0]; id != CNONE; id = node->next) {
+      node = &ast->nodes[id];
+      if (node->varKind == V_GLOBAL && node->valType == T_INT)
+         globals->names[globals->num++] = node->name;
+   }
+   for (i=0; i < ast->numNodes; i++) {
+      node = &ast->nodes[i];
+      if (node->type == AST_ASSIGNMENT && node->varKind == V_GLOBAL &&
+          (k = findGlobal(globals, node->name)) >= 0)
+         stores[k]++;
+   }
+   for (id = prog->child[2]; id != CNONE; id = node->next) {
+      node = &ast->nodes[id];
+      if (node->type == AST_ASSIGNMENT && node->varKind == V_GLOBAL &&
+          (k = findGlobal(globals, node->name)) >= 0 && stores[k] == 1 &&
+          ast->nodes[node->child[0]].type == AST_CONSTANT &&
+          ast->nodes[node->child[0]].valType == T_INT) {
+         globals->values[k] = ast->nodes[node->child[0]].ival;
+         globals->assigned[k] = 1;
+         stores[k] = 0;
+      }
+      if (makesCall(ast, prog->child[1], id))
+         break;
+   }
+   for (k=n=0; k < globals->num; k++) {
+      if (stores[k])
+         continue; // assigned elsewhere: not known
+      globals->names[n] = globals->names[k];
+      globals->values[n] = globals->values[k];
+      globals->assigned[n++] = globals->assigned[k];
+   }
+   globals->num = n;
+   free(stores);
+   return globals;
+}
+
+void freeGlobalConstants(IRGlobals* globals)
+{
+   if (!globals)
+      return;
+   free(globals->names);
+   free(globals->values);
+   free(globals->assigned);
+   free(globals);
+}
+
+//
+// Sparse conditional constant propagation
+//
+
+// Lattice values: not yet known to run, one constant, or varying
+#define LAT_TOP 0
+#define LAT_CONST 1
+#define LAT_BOTTOM 2
+
+typedef struct {
+   int state;
+   int value;
+} LatValue;
+
+typedef struct {
+   IRFunc* fn;
+   LatValue* temps;   // by temp
+   LatValue* vars;    // by variable
+   int* global;       // each variable's IRGlobals entry, or -1
+   char* reached;     // blocks found to run
+   char* edges;       // edges found to run: edges[block*2 + succ]
+   int* work;         // blocks to (re)visit
+   char* queued;
+   int top;
+   int* useStart;     // blocks that read variable v: uses[useStart[v]..
+   int* uses;         //    useStart[v+1]-1]
+   IRGlobals* globals;
+   IRDom* dom;        // the program block's, for globals it stores
+   int* storeBlock;   // where the program block stores a known
+   int* storeAt;      //    global, by IRGlobals entry
+} SCCP;
+
+static LatValue meet(LatValue a, LatValue b)
+{
+   if (a.state == LAT_TOP || b.state == LAT_BOTTOM)
+      return b;
+   if (b.state == LAT_TOP || a.state == LAT_BOTTOM)
+      return a;
+   if (a.value != b.value)
+      a.state = LAT_BOTTOM;
+   return a;
+}
+
+static LatValue latConst(int value)
+{
+   LatValue v;
+   v.state = LAT_CONST;
+   v.value = value;
+   return v;
+}
+
+static LatValue latBottom()
+{
+   LatValue v;
+   v.state = LAT_BOTTOM;
+   v.value = 0;
+   return v;
+}
+
+static void queueBlock(SCCP* s, int block)
+{
+   if (s->queued[block])
+      return;
+   s->queued[block] = 1;
+   s->work[s->top++] = block;
+}
+
+// Lower a variable's value; blocks that read it go back on the list
+static void lowerVar(SCCP* s, int var, LatValue v)
+{
+   LatValue old = s->vars[var];
+   int k;
+   s->vars[var] = meet(old, v);
+   if (s->vars[var].state == old.state && s->vars[var].value == old.value)
+      return;
+   for (k=s->useStart[var]; k < s->useStart[var+1]; k++)
+      if (s->reached[s->uses[k]])
+         queueBlock(s, s->uses[k]);
+}
+
+// An edge can run: its target runs, and its phis see the edge
+static void reachEdge(SCCP* s, int block, int succ)
+{
+   int target = s->fn->blocks[block].succ[succ];
+   if (target < 0 || s->edges[block*2 + succ])
+      return;
+   s->edges[block*2 + succ] = 1;
+   s->reached[target] = 1;
+   queueBlock(s, target);
+}
+
+// Is the edge from pred into block known to run?
+static int edgeRuns(SCCP* s, int pred, int block)
+{
+   IRBlock* p = &s->fn->blocks[pred];
+   return (p->succ[0] == block && s->edges[pred*2]) ||
+          (p->succ[1] == block && s->edges[pred*2 + 1]);
+}
+
+static LatValue operandValue(SCCP* s, IRValue v)
+{
+   if (v.kind == IV_CONST)
+      return latConst(v.val);
+   if (v.kind == IV_TEMP)
+      return s->temps[v.val];
+   return latBottom();
+}
+
+// Value a global read has at instruction at of block
+// - in a function, a known global has its value; in the program
+//   block, a global it stores has it only after the store
+static LatValue globalValue(SCCP* s, int var, int block, int at)
+{
+   int k = s->global[var], sb;
+   if (k < 0)
+      return latBottom();
+   if (!s->fn->name && s->globals->assigned[k]) {
+      sb = s->storeBlock[k];
+      if (sb < 0)
+         return latBottom();
+      if (sb == block ? at < s->storeAt[k] : !irDominates(s->dom, sb, block))
+         return latConst(0);
+   }
+   return latConst(s->globals->values[k]);
+}
+
+// Does branch op go to its target with operands x and y?
+static int branchTaken(int op, int x, int y)
+{
+   switch (op) {
+    case IR_BEQ: return x == y;
+    case IR_BNE: return x != y;
+    case IR_BGT: return x > y;
+    default:     return x < y;
+   }
+}
+
+// Evaluate a block's instructions with what is known so far
+static void visitBlock(SCCP* s, int block)
+{
+   IRBlock* b = &s->fn->blocks[block];
+   IRInstr* in;
+   LatValue x, y, v;
+   int j, k;
+   for (j=0; j < b->len; j++) {
+      in = &b->code[j];
+      v = latBottom();
+      switch (in->op) {
+       case IR_LI:
+          v = latConst(in->imm);
+          break;
+       case IR_LOAD:
+          v = isSSAVar(s->fn, in->var) ? s->vars[in->var]
+                                       : globalValue(s, in->var, block, j);
+          break;
+       case IR_STORE:
+          if (isSSAVar(s->fn, in->var))
+             lowerVar(s, in->var, operandValue(s, in->a));
+          break;
+       case IR_PHI:
+          v.state = LAT_TOP;
+          for (k=0; k < in->imm; k++)
+             if (edgeRuns(s, in->args[k].pred, block))
+                v = meet(v, s->vars[in->args[k].var]);
+          lowerVar(s, in->var, v);
+          break;
+       case IR_ADD: case IR_SUB:
+          x = operandValue(s, in->a);
+          y = operandValue(s, in->b);
+          if (x.state == LAT_CONST && y.state == LAT_CONST)
+             v = latConst(in->op == IR_ADD ? (int) ((unsigned) x.value + (unsigned) y.value)
+                                           : (int) ((unsigned) x.value - (unsigned) y.value));
+          else if (x.state == LAT_TOP || y.state == LAT_TOP)
+             v.state = LAT_TOP;
+          break;
+       case IR_BEQ: case IR_BNE: case IR_BGT: case IR_BLT:
+          x = operandValue(s, in->a);
+          y = operandValue(s, in->b);
+          if (x.state == LAT_BOTTOM || y.state == LAT_BOTTOM) {
+             reachEdge(s, block, 0);
+             reachEdge(s, block, 1);
+          } else if (x.state == LAT_CONST && y.state == LAT_CONST) {
+             reachEdge(s, block, branchTaken(in->op, x.value, y.value));
+          }
+          break;
+       default:
+          break;
+      }
+      if (in->dst)
+         s->temps[in->dst] = meet(s->temps[in->dst], v);
+   }
+   if (b->len == 0 || !irIsBranch(b->code[b->len-1].op))
+      reachEdge(s, block, 0);
+}
+
+// Which variables each block reads (by IR_LOAD or a phi argument)
+static void findUses(SCCP* s)
+{
+   IRFunc* fn = s->fn;
+   IRBlock* b;
+   IRInstr* in;
+   int pass, i, j, k, n, var;
+   int* fill = (int*) calloc(fn->numVars + 1, sizeof(int));
+   s->useStart = (int*) calloc(fn->numVars + 1, sizeof(int));
+   for (pass=0; pass < 2; pass++) {
+      for (i=0; i < fn->numBlocks; i++) {
+         b = &fn->blocks[i];
+         for (j=0; j < b->len; j++) {
+            in = &b->code[j];
+            n = in->op == IR_LOAD ? 1 : in->op == IR_PHI ? in->imm : 0;
+            for (k=0; k < n; k++) {
+               var = in->op == IR_LOAD ? in->var : in->args[k].var;
+               if (pass == 0)
+                  s->useStart[var+1]++;
+               else
+                  s->uses[s->useStart[var] + fill[var]++] = i;
+            }
+         }
+      }
+      if (pass == 0) {
+         for (i=0; i < fn->numVars; i++)
+            s->useStart[i+1] += s->useStart[i];
+         s->uses = (int*) malloc((s->useStart[fn->numVars] + 1) * sizeof(int));
+      }
+   }
+   free(fill);
+}
+
+// Where the program block stores each known global it assigns
+static void findGlobalStores(SCCP* s)
+{
+   IRFunc* fn = s->fn;
+   IRBlock* b;
+   int i, j, k;
+   s->storeBlock = (int*) malloc((s->globals->num + 1) * sizeof(int));
+   s->storeAt = (int*) malloc((s->globals->num + 1) * sizeof(int));
+   for (k=0; k < s->globals->num; k++)
+      s->storeBlock[k] = -1;
+   for (i=0; i < fn->numBlocks; i++) {
+      b = &fn->blocks[i];
+      for (j=0; j < b->len; j++) {
+         if (b->code[j].op != IR_STORE || (k = s->global[b->code[j].var]) < 0)
+            continue;
+         s->storeBlock[k] = i;
+         s->storeAt[k] = j;
+      }
+   }
+   s->dom = computeDominators(fn);
+}
+
+// Fold what the analysis found into the code
+// - reads and sums of constants become constants, and operands that
+//   are constant temps become constant operands; a branch that only
+//   goes one way becomes a jump, or nothing
+// - a temp nothing uses any more loses the instruction that made
+//   it, unless that has an effect
+static void foldFound(SCCP* s)
+{
+   IRFunc* fn = s->fn;
+   IRBlock* b;
+   IRInstr* in;
+   int* uses = (int*) calloc(fn->numTemps + 1, sizeof(int));
+   int i, j, k;
+   IRValue* ops[2];
+   for (i=0; i < fn->numBlocks; i++) {
+      b = &fn->blocks[i];
+      if (!s->reached[i])
+         continue;
+      in = b->len > 0 ? &b->code[b->len-1] : 0;
+      if (in && irIsBranch(in->op) && s->edges[i*2] != s->edges[i*2 + 1]) {
+         if (s->edges[i*2 + 1]) {
+            in->op = IR_JUMP;
+            in->a.kind = in->b.kind = IV_NONE;
+            b->succ[0] = b->succ[1];
+         } else {
+            removeIRInstr(fn, i, b->len-1);
+         }
+         b->succ[1] = -1;
+      }
+      for (j=0; j < b->len; j++) {
+         in = &b->code[j];
+         if (in->dst && s->temps[in->dst].state == LAT_CONST &&
+             (in->op == IR_LOAD || in->op == IR_ADD || in->op == IR_SUB)) {
+            in->op = IR_LI;
+            in->imm = s->temps[in->dst].value;
+            in->a.kind = in->b.kind = IV_NONE;
+            in->var = 0;
+         }
+         ops[0] = &in->a;
+         ops[1] = &in->b;
+         for (k=0; k < 2; k++) {
+            if (ops[k]->kind != IV_TEMP)
+               continue;
+            if (s->temps[ops[k]->val].state == LAT_CONST) {
+               ops[k]->kind = IV_CONST;
+               ops[k]->val = s->temps[ops[k]->val].value;
+            } else {
+               uses[ops[k]->val]++;
+            }
+         }
+      }
+   }
+   for (i=0; i < fn->numBlocks; i++) {
+      b = &fn->blocks[i];
+      for (j=b->len-1; j >= 0; j--) {
+         in = &b->code[j];
+         if (!in->dst || uses[in->dst] || in->op == IR_PHI)
+            continue;
+         if (in->a.kind == IV_TEMP)
+            uses[in->a.val]--;
+         if (in->b.kind == IV_TEMP)
+            uses[in->b.val]--;
+         removeIRInstr(fn, i, j);
+      }
+   }
+   free(uses);
+}
+
+// Drop jumps to the next block in the layout, which it falls into
+static void dropJumpsToNext(IRFunc* fn)
+{
+   IRBlock* b;
+   int i;
+   for (i=0; i < fn->numBlocks; i++) {
+      b = &fn->blocks[i];
+      if (b->len > 0 && b->code[b->len-1].op == IR_JUMP && b->succ[0] == i+1)
+         removeIRInstr(fn, i, b->len-1);
+   }
+}
+
+// Sparse conditional constant propagation over fn, in SSA form
+// - globals are read as known from globals (which may be NULL)
+void propagateIRConstants(IRFunc* fn, IRGlobals* globals)
+{
+   SCCP s;
+   int i, k;
+   memset(&s, 0, sizeof(s));
+   s.fn = fn;
+   s.globals = globals;
+   s.temps = (LatValue*) calloc(fn->numTemps + 1, sizeof(LatValue));
+   s.vars = (LatValue*) calloc(fn->numVars + 1, sizeof(LatValue));
+   s.global = (int*) malloc((fn->numVars + 1) * sizeof(int));
+   s.reached = (char*) calloc(fn->numBlocks, 1);
+   s.edges = (char*) calloc(fn->numBlocks * 2, 1);
+   s.queued = (char*) calloc(fn->numBlocks, 1);
+   s.work = (int*) malloc(fn->numBlocks * sizeof(int));
+   for (i=0; i < fn->numVars; i++) {
+      // a parameter's or local's value on entry is not known
+      if (isSSAVar(fn, i) && fn->vars[i].version == 0)
+         s.vars[i] = latBottom();
+      k = !isSSAVar(fn, i) && globals ? findGlobal(globals, fn->vars[i].name) : -1;
+      s.global[i] = k;
+   }
+   findUses(&s);
+   if (!fn->name && globals)
+      findGlobalStores(&s);
+   s.reached[0] = 1;
+   queueBlock(&s, 0);
+   while (s.top > 0) {
+      i = s.work[--s.top];
+      s.queued[i] = 0;
+      visitBlock(&s, i);
+   }
+   foldFound(&s);
+   removeIRBlocks(fn, s.reached);
+   dropJumpsToNext(fn);
+   freeDominators(s.dom);
+   free(s.temps);
+   free(s.vars);
+   free(s.global);
+   free(s.reached);
+   free(s.edges);
+   free(s.queued);
+   free(s.work);
+   free(s.useStart);
+   free(s.uses);
+   free(s.storeBlock);
+   free(s.storeAt);
+}
+
+//
+// Dead code elimination
+//
+
+// The constant an operand of block's instruction at holds, if it is
+// a constant or a temp the block loads one into
+static int constOperand(IRFunc* fn, int block, int at, IRValue v, int* value)
+{
+   IRBlock* b = &fn->blocks[block];
+   int j;
+   if (v.kind == IV_CONST) {
+      *value = v.val;
+      return 1;
+   }
+   for (j=at-1; j >= 0 && v.kind == IV_TEMP; j--) {
+      if (b->code[j].dst != v.val)
+         continue;
+      *value = b->code[j].imm;
+      return b->code[j].op == IR_LI;
+   }
+   return 0;
+}
+
+// Resolve the branches on two constants (such as the condition of
+// a while loop that never ends): one that is always taken becomes
+// a jump, one that never is goes away
+static void foldConstantBranches(IRFunc* fn)
+{
+   IRBlock* b;
+   IRInstr* in;
+   int i, x, y;
+   for (i=0; i < fn->numBlocks; i++) {
+      b = &fn->blocks[i];
+      in = b->len > 0 ? &b->code[b->len-1] : 0;
+      if (!in || !irIsBranch(in->op) || !constOperand(fn, i, b->len-1, in->a, &x) ||
+          !constOperand(fn, i, b->len-1, in->b, &y))
+         continue;
+      if (branchTaken(in->op, x, y)) {
+         in->op = IR_JUMP;
+         in->a.kind = in->b.kind = IV_NONE;
+         b->succ[0] = b->succ[1];
+      } else {
+         removeIRInstr(fn, i, b->len-1);
+      }
+      b->succ[1] = -1;
+   }
+}
+
+// Mark the blocks control can reach from the entry
+static char* findReachable(IRFunc* fn)
+{
+   char* reached = (char*) calloc(fn->numBlocks + 1, 1);
+   int* work = (int*) malloc((fn->numBlocks + 1) * sizeof(int));
+   int top = 0, i, j, s;
+   reached[0] = 1;
+   work[top++] = 0;
+   while (top > 0) {
+      i = work[--top];
+      for (j=0; j < 2; j++) {
+         s = fn->blocks[i].succ[j];
+         if (s >= 0 && !reached[s]) {
+            reached[s] = 1;
+            work[top++] = s;
+         }
+      }
+   }
+   free(work);
+   return reached;
+}
+
+// Count the instructions (not notes) of the blocks not reached
+static int countUnreached(IRFunc* fn, const char* reached)
+{
+   int i, j, n = 0;
+   for (i=0; i < fn->numBlocks; i++)
+      for (j=0; !reached[i] && j < fn->blocks[i].len; j++)
+         n += fn->blocks[i].code[j].op != IR_NOTE;
+   return n;
+}
+
+// Remove the stores (and phis) of parameters and locals that are
+// not live after them; returns how many
+// - walks each block backward from what is live out of it
+static int removeDeadStores(IRFunc* fn)
+{
+   IRLiveness* lv = computeLiveness(fn);
+   unsigned int* live = (unsigned int*) malloc((lv->words + 1) * sizeof(unsigned int));
+   IRBlock* b;
+   IRInstr* in;
+   int i, j, removed = 0;
+   for (i=0; i < fn->numBlocks; i++) {
+      b = &fn->blocks[i];
+      memcpy(live, lv->out + i*lv->words, lv->words * sizeof(unsigned int));
+      for (j=b->len-1; j >= 0; j--) {
+         in = &b->code[j];
+         if ((in->op == IR_STORE || in->op == IR_PHI) && isSSAVar(fn, in->var)) {
+            if (!IRSETHAS(live, in->var)) {
+               removeIRInstr(fn, i, j);
+               removed++;
+               continue;
+            }
+            if (in->op == IR_STORE)
+               IRSETDEL(live, in->var);
+         } else if (irReadsVar(in) >= 0 && isSSAVar(fn, irReadsVar(in))) {
+            IRSETADD(live, irReadsVar(in));
+         }
+      }
+   }
+   free(live);
+   freeLiveness(lv);
+   return removed;
+}
+
+// Remove the instructions that make temps nothing uses; returns
+// how many
+// - every instruction that makes a temp only reads, so the call
+//   whose return value is dropped stays
+static int removeUnusedTemps(IRFunc* fn)
+{
+   int* uses = (int*) calloc(fn->numTemps + 1, sizeof(int));
+   IRBlock* b;
+   IRInstr* in;
+   int i, j, removed = 0;
+   for (i=0; i < fn->numBlocks; i++) {
+      b = &fn->blocks[i];
+      for (j=0; j < b->len; j++) {
+         in = &b->code[j];
+         if (in->a.kind == IV_TEMP)
+            uses[in->a.val]++;
+         if (in->b.kind == IV_TEMP)
+            uses[in->b.val]++;
+      }
+   }
+   // a temp is used later than it is made, so one backward sweep
+   // finds whole dead expressions
+   for (i=fn->numBlocks-1; i >= 0; i--) {
+      b = &fn->blocks[i];
+      for (j=b->len-1; j >= 0; j--) {
+         in = &b->code[j];
+         if (!in->dst || uses[in->dst])
+            continue;
+         if (in->a.kind == IV_TEMP)
+            uses[in->a.val]--;
+         if (in->b.kind == IV_TEMP)
+            uses[in->b.val]--;
+         removeIRInstr(fn, i, j);
+         removed++;
+      }
+   }
+   free(uses);
+   return removed;
+}
+
+// Dead code elimination over fn, in SSA form or not; returns how
+// many instructions (not counting notes) it removed
+// - branches on constants are resolved, and the blocks control
+//   then cannot reach go first; then, until nothing
+//   changes, stores to parameters and locals that are never read
+//   again, and the expressions only they used
+// - calls, argument moves, array stores and global stores stay
+int eliminateDeadCode(IRFunc* fn)
+{
+   char* reached;
+   int removed, n;
+   foldConstantBranches(fn);
+   reached = findReachable(fn);
+   removed = countUnreached(fn, reached);
+   removeIRBlocks(fn, reached);
+   dropJumpsToNext(fn);
+   free(reached);
+   do {
+      n = removeDeadStores(fn);
+      n += removeUnusedTemps(fn);
+      removed += n;
+   } while (n > 0);
+   return removed;
+}
+
+//
+// Loop-invariant code motion
+//
+
+// A loop: its header, and every block in it (the header too)
+typedef struct {
+   int header;
+   int* blocks;
+   int num;
+} IRLoop;
+
+// Find the natural loop of each header that a back edge goes to
+// - a back edge goes from a block to one that dominates it; the
+//   loop is the header and the blocks that reach the edge's source
+//   without going through the header
+// - returned innermost first (smallest first), since an inner loop
+//   is smaller than the loops around it
+static IRLoop* findLoops(IRFunc* fn, int* numLoops)
+{
+   IRDom* dom = computeDominators(fn);
+   IRLoop* loops = (IRLoop*) malloc((fn->numBlocks + 1) * sizeof(IRLoop));
+   char* in = (char*) malloc(fn->numBlocks + 1);
+   int* work = (int*) malloc((fn->numBlocks + 1) * sizeof(int));
+   IRLoop swap;
+   int n = 0, i, j, k, h, top, b, back;
+   for (h=0; h < fn->numBlocks; h++) {
+      memset(in, 0, fn->numBlocks);
+      in[h] = 1;
+      top = back = 0;
+      for (k=0; k < fn->blocks[h].numPreds; k++) {
+         b = fn->blocks[h].preds[k];
+         if (!irDominates(dom, h, b))
+            continue;
+         back = 1;
+         if (!in[b]) {
+            in[b] = 1;
+            work[top++] = b;
+         }
+      }
+      if (!back)
+         continue;
+      while (top > 0) {
+         b = work[--top];
+         for (k=0; k < fn->blocks[b].numPreds; k++)
+            if (!in[fn->blocks[b].preds[k]]) {
+               in[fn->blocks[b].preds[k]] = 1;
+               work[top++] = fn->blocks[b].preds[k];
+            }
+      }
+      loops[n].header = h;
+      // room for the preheaders of the loops inside it, too
+      loops[n].blocks = (int*) malloc((2*fn->numBlocks + 1) * sizeof(int));
+      loops[n].num = 0;
+      for (i=0; i < fn->numBlocks; i++)
+         if (in[i])
+            loops[n].blocks[loops[n].num++] = i;
+      n++;
+   }
+   for (i=1; i < n; i++)
+      for (j=i; j > 0 && loops[j].num < loops[j-1].num; j--) {
+         swap = loops[j];
+         loops[j] = loops[j-1];
+         loops[j-1] = swap;
+      }
+   freeDominators(dom);
+   free(in);
+   free(work);
+   *numLoops = n;
+   return loops;
+}
+
+// The one block outside a loop that goes on to its header, which
+// must fall through or jump to it, or -1
+static int loopEntry(IRFunc* fn, IRLoop* loop)
+{
+   IRBlock* h = &fn->blocks[loop->header];
+   int k, j, p = -1;
+   for (k=0; k < h->numPreds; k++) {
+      for (j=0; j < loop->num && loop->blocks[j] != h->preds[k]; j++)
+         ;
+      if (j < loop->num)
+         continue;
+      if (p >= 0)
+         return -1;
+      p = h->preds[k];
+   }
+   if (p < 0 || fn->blocks[p].succ[1] == loop->header)
+      return -1;
+   return p;
+}
+
+typedef struct {
+   IRFunc* fn;
+   char* modified;    // variables the loop stores, by variable
+   int calls;         // does the loop call (and so change globals)?
+   char* invariant;   // temps with the same value on every iteration
+   char* defOp;       // the op that makes each temp
+   int* roots;        // the invariant expressions to hoist, by temp
+   int numRoots;
+   Atom* arrays;      // arrays whose address the loop loads with la
+   int numArrays;
+   int homes;         // do new locals get registers (so arrays hoist)?
+} LoopInfo;
+
+// Is operand v the same on every iteration?
+static int invariantOperand(LoopInfo* li, IRValue v)
+{
+   return v.kind != IV_TEMP || li->invariant[v.val];
+}
+
+// Find what a loop's code can hoist: its largest invariant sums and
+// differences, and (if new locals get registers) its arrays'
+// addresses; returns how many
+// - a variable is invariant if the loop never stores it, and a
+//   global only if it calls nothing either
+static int analyzeLoop(LoopInfo* li, IRLoop* loop)
+{
+   IRFunc* fn = li->fn;
+   IRBlock* b;
+   IRInstr* in;
+   IRValue* ops[2];
+   int i, j, k, t;
+   memset(li->modified, 0, fn->numVars + 1);
+   memset(li->invariant, 0, fn->numTemps + 1);
+   li->calls = li->numRoots = li->numArrays = 0;
+   for (i=0; i < loop->num; i++) {
+      b = &fn->blocks[loop->blocks[i]];
+      for (j=0; j < b->len; j++) {
+         if (b->code[j].op == IR_STORE)
+            li->modified[b->code[j].var] = 1;
+         else if (b->code[j].op == IR_CALL)
+            li->calls = 1;
+      }
+   }
+   for (i=0; i < loop->num; i++) {
+      b = &fn->blocks[loop->blocks[i]];
+      for (j=0; j < b->len; j++) {
+         in = &b->code[j];
+         if (!in->dst)
+            continue;
+         li->defOp[in->dst] = in->op;
+         if (in->op == IR_LI)
+            li->invariant[in->dst] = 1;
+         else if (in->op == IR_LOAD)
+            li->invariant[in->dst] = !li->modified[in->var] &&
+               !(li->calls && fn->vars[in->var].kind == V_GLOBAL);
+         else if (in->op == IR_ADD || in->op == IR_SUB)
+            li->invariant[in->dst] = invariantOperand(li, in->a) &&
+                                     invariantOperand(li, in->b);
+      }
+   }
+   for (i=0; i < loop->num; i++) {
+      b = &fn->blocks[loop->blocks[i]];
+      for (j=0; j < b->len; j++) {
+         in = &b->code[j];
+         ops[0] = &in->a;
+         ops[1] = &in->b;
+         for (k=0; k < 2; k++) {
+            t = ops[k]->val;
+            if (ops[k]->kind != IV_TEMP || !li->invariant[t] ||
+                (li->defOp[t] != IR_ADD && li->defOp[t] != IR_SUB))
+               continue;
+            // only the whole invariant expression moves
+            if ((in->op == IR_ADD || in->op == IR_SUB) && li->invariant[in->dst])
+               continue;
+            li->roots[li->numRoots++] = t;
+         }
+         if ((in->op == IR_LOADELEM || in->op == IR_STOREELEM) && in->var < 0 &&
+             li->homes) {
+            for (k=0; k < li->numArrays && li->arrays[k] != in->name; k++)
+               ;
+            if (k == li->numArrays)
+               li->arrays[li->numArrays++] = in->name;
+         }
+      }
+   }
+   return li->numRoots + li->numArrays;
+}
+
+// Give a loop a preheader after its entry block p; returns it
+// - p now falls into the preheader, which goes on to the header;
+//   the blocks after it move up one, in every loop
+static int addPreheader(IRFunc* fn, IRLoop* loops, int numLoops, int p)
+{
+   int pre = insertIRBlock(fn, p+1);
+   IRBlock* b = &fn->blocks[p];
+   int i, j, inLoop;
+   fn->blocks[pre].succ[0] = b->succ[0];
+   b->succ[0] = pre;
+   if (b->len > 0 && b->code[b->len-1].op == IR_JUMP)
+      removeIRInstr(fn, p, b->len-1);
+   if (fn->blocks[pre].succ[0] != pre+1)
+      appendIRInstr(fn, pre, IR_JUMP);
+   for (i=0; i < numLoops; i++) {
+      inLoop = 0;
+      for (j=0; j < loops[i].num; j++) {
+         if (loops[i].blocks[j] >= pre)
+            loops[i].blocks[j]++;
+         inLoop |= loops[i].blocks[j] == p;
+      }
+      if (loops[i].header >= pre)
+         loops[i].header++;
+      if (inLoop)
+         loops[i].blocks[loops[i].num++] = pre;
+   }
+   computeIRPreds(fn);
+   return pre;
+}
+
+// Move the expression that makes temp root into preheader pre (just
+// before its end), saving its value in a new local; where it was,
+// the loop loads that local instead
+static void hoistExpr(IRFunc* fn, IRLoop* loop, int pre, int root, int var)
+{
+   IRBlock* b = 0;
+   IRInstr* in;
+   IRValue v;
+   char* moves;
+   int i, j, k, at = -1, top = 0, end;
+   int* work;
+   for (i=0; at < 0 && i < loop->num; i++) {
+      b = &fn->blocks[loop->blocks[i]];
+      for (j=0; j < b->len && at < 0; j++)
+         if (b->code[j].dst == root)
+            at = j;
+   }
+   i = loop->blocks[i-1];
+   moves = (char*) calloc(at + 1, 1);
+   work = (int*) malloc((at + 1) * sizeof(int));
+   moves[at] = 1;
+   work[top++] = at;
+   // the temps of an expression are made in its block, before it
+   while (top > 0) {
+      in = &b->code[work[--top]];
+      for (k=0; k < 2; k++) {
+         v = k ? in->b : in->a;
+         if (v.kind != IV_TEMP)
+            continue;
+         for (j=at-1; j >= 0 && b->code[j].dst != v.val; j--)
+            ;
+         if (j >= 0 && !moves[j]) {
+            moves[j] = 1;
+            work[top++] = j;
+         }
+      }
+   }
+   end = fn->blocks[pre].len;
+   if (end > 0 && fn->blocks[pre].code[end-1].op == IR_JUMP)
+      end--;
+   for (j=0; j <= at; j++) {
+      if (!moves[j])
+         continue;
+      in = insertIRInstr(fn, pre, end++, IR_NOTE);
+      *in = fn->blocks[i].code[j];
+      if (j == at)
+         in->dst = ++fn->numTemps;
+   }
+   in = insertIRInstr(fn, pre, end, IR_STORE);
+   in->var = var;
+   in->a.kind = IV_TEMP;
+   in->a.val = fn->numTemps;
+   in = &fn->blocks[i].code[at];
+   in->op = IR_LOAD;
+   in->var = var;
+   in->a.kind = in->b.kind = IV_NONE;
+   in->imm = 0;
+   for (j=at-1; j >= 0; j--)
+      if (moves[j])
+         removeIRInstr(fn, i, j);
+   free(moves);
+   free(work);
+}
+
+// Load array name's address into a new local in preheader pre, and
+// have the loop's element ops take it from there
+static void hoistArrayAddr(IRFunc* fn, IRLoop* loop, int pre, Atom name, int var)
+{
+   IRBlock* b = &fn->blocks[pre];
+   IRInstr* in;
+   int i, j, end = b->len;
+   if (end > 0 && b->code[end-1].op == IR_JUMP)
+      end--;
+   in = insertIRInstr(fn, pre, end, IR_LA);
+   in->dst = ++fn->numTemps;
+   in->name = name;
+   in = insertIRInstr(fn, pre, end+1, IR_STORE);
+   in->var = var;
+   in->a.kind = IV_TEMP;
+   in->a.val = fn->numTemps;
+   fn->vars[var].name = name;
+   for (i=0; i < loop->num; i++) {
+      b = &fn->blocks[loop->blocks[i]];
+      for (j=0; j < b->len; j++)
+         if ((b->code[j].op == IR_LOADELEM || b->code[j].op == IR_STOREELEM) &&
+             b->code[j].var < 0 && b->code[j].name == name)
+            b->code[j].var = var;
+   }
+}
+
+// Loop-invariant code motion over fn, not in SSA form; returns how
+// many expressions and array addresses it hoisted
+// - each loop, innermost first, gets a preheader that computes its
+//   invariant expressions and array addresses once, into new locals
+//   (at most room of them, unless room is -1)
+// - room is -1 when the new locals are frame slots; then array
+//   addresses stay in the loop, since reloading one from the frame
+//   is no cheaper than its la
+// - only loops entered from a single block are done, which is how a
+//   while loop is lowered
+int hoistLoopInvariants(IRFunc* fn, int room)
+{
+   LoopInfo li;
+   IRLoop* loops;
+   int numLoops, i, k, p, pre, code, hoisted = 0;
+   if (room == 0)
+      return 0;
+   loops = findLoops(fn, &numLoops);
+   memset(&li, 0, sizeof(li));
+   li.fn = fn;
+   li.homes = room > 0;
+   for (i=0; i < numLoops; i++) {
+      p = loopEntry(fn, &loops[i]);
+      if (p < 0 || room == 0)
+         continue;
+      // hoisting adds variables and temps, so size for this loop
+      li.modified = (char*) realloc(li.modified, fn->numVars + 1);
+      li.invariant = (char*) realloc(li.invariant, fn->numTemps + 1);
+      li.defOp = (char*) realloc(li.defOp, fn->numTemps + 1);
+      li.roots = (int*) realloc(li.roots, (fn->numTemps + 1) * sizeof(int));
+      for (k=0, code=0; k < fn->numBlocks; k++)
+         code += fn->blocks[k].len;
+      li.arrays = (Atom*) realloc(li.arrays, (code + 1) * sizeof(Atom));
+      if (analyzeLoop(&li, &loops[i]) == 0)
+         continue;
+      pre = addPreheader(fn, loops, numLoops, p);
+      for (k=0; k < li.numRoots && room != 0; k++, room--, hoisted++)
+         hoistExpr(fn, &loops[i], pre, li.roots[k], newIRSlot(fn, -1));
+      for (k=0; k < li.numArrays && room != 0; k++, room--, hoisted++)
+         hoistArrayAddr(fn, &loops[i], pre, li.arrays[k], newIRSlot(fn, -1));
+   }
+   for (i=0; i < numLoops; i++)
+      free(loops[i].blocks);
+   free(loops);
+   free(li.modified);
+   free(li.invariant);
+   free(li.defOp);
+   free(li.roots);
+   free(li.arrays);
+   return hoisted;
+}
@@ -0,0 +1,45 @@
+//
+// IR Optimization Interface
+// - passes over a lowered function body or program block (ir.h);
+//   the code generator runs the ones that are on between lowering
+//   a body and emitting it
+// - propagateIRConstants() is sparse conditional constant
+//   propagation (Wegman and Zadeck) over a body in SSA form (ssa.h):
+//   it finds the variables and temps that hold one constant on
+//   every path that can run, and the branches that can only go one
+//   way, then folds them and deletes the blocks that never run
+// - eliminateDeadCode() deletes the blocks control cannot reach and
+//   the assignments to parameters and locals that are never read
+//   again (with the expressions they stored), using the liveness of
+//   ssa.h; calls and the argument moves of calls stay
+// - hoistLoopInvariants() gives each loop a preheader block, run
+//   once before it, and moves there the sums and differences whose
+//   operands the loop never changes (a variable it never stores; a
+//   global also only if it makes no call), and, when the new locals
+//   get registers, the la of each global array it indexes; the values
+//   are kept in new locals
+//
+#ifndef IROPT_H
+#define IROPT_H
+
+#include "ir.h"
+
+// Int globals whose value is known program-wide: never assigned
+// (always 0), or assigned a constant once, by a statement of the
+// program block that comes before any call of a program function
+// (so every function sees that value, and the program block sees
+// it once the store is done)
+typedef struct {
+   int num;
+   Atom* names;
+   int* values;
+   char* assigned;  // 1 if set by the program block's store
+} IRGlobals;
+
+IRGlobals* findGlobalConstants(CompactAST* ast, CNodeId program);
+void freeGlobalConstants(IRGlobals* globals);
+void propagateIRConstants(IRFunc* fn, IRGlobals* globals);
+int eliminateDeadCode(IRFunc* fn);
+int hoistLoopInvariants(IRFunc* fn, int room);
+
+#endif
@@ -0,0 +1,302 @@
+//
+// Hand-written Scanner Module
+// - recognizes exactly the tokens of scanner.l (see the rules there)
+// - the long-running parts of a token (whitespace runs, identifier
+//   and number characters, string literal bodies) are skipped over
+//   16 or 32 bytes at a time with SSE2 or AVX2 compares; AVX2 is used
+//   only if the CPU has it, and other machines get a scalar loop
+// - vector loads never go past the end of the buffer; the last few
+//   bytes of the buffer are always handled by the scalar loop
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "srcbuf.h"
+#include "atoms.h"
+#include "y.tab.h"
+#include "jlex.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define JLEX_X86
+#endif
+
+extern int yylineno; // from lex; both scanners keep it up to date
+
+// byte classes that are skipped over in bulk; classBits[c] has
+// bit (1 << class) set if byte c is in the class
+#define CL_SPACE   0  // whitespace
+#define CL_IDENT   1  // letters, digits and underscore
+#define CL_DIGIT   2  // decimal digits
+#define CL_STRCHAR 3  // anything but a double quote
+#define CL_IDSTART 4  // letters and underscore (not skipped in bulk)
+static unsigned char classBits[256];
+
+static const char *cur, *end; // scan position and end of buffer
+static const char* (*skipClass)(const char* p, int cls, int* lines);
+static const char* simdName = "scalar";
+
+// Skip bytes of class cls starting at p, one at a time
+// - returns pointer to the first byte not in the class (or end)
+// - adds the number of newlines skipped to *lines
+static const char* skipScalar(const char* p, int cls, int* lines)
+{
+   unsigned char bit = 1 << cls;
+   int n = 0;
+   while (p < end && (classBits[(unsigned char) *p] & bit)) {
+      n += *p == '\n';
+      p++;
+   }
+   *lines += n;
+   return p;
+}
+
+#ifdef JLEX_X86
+// Mark (with 0xFF) each of 16 bytes that is in class cls
+// - SSE2 only has signed byte compares, so bytes >= 0x80 compare as
+//   negative, which keeps them out of every ASCII range below
+static inline __m128i classMask16(__m128i v, int cls)
+{
+   __m128i lower, m;
+   switch (cls) {
+    case CL_SPACE:
+       m = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+                        _mm_cmpeq_epi8(v, _mm_set1_epi8('\n')));
+       m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('\t')));
+       return _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('\r')));
+    case CL_IDENT:
+    case CL_DIGIT:
+       m = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('0'-1)),
+                         _mm_cmpgt_epi8(_mm_set1_epi8('9'+1), v));
+       if (cls == CL_DIGIT)
+          return m;
+       lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+       m = _mm_or_si128(m, _mm_and_si128(
+                              _mm_cmpgt_epi8(lower, _mm_set1_epi8('a'-1)),
+                              _mm_cmpgt_epi8(_mm_set1_epi8('z'+1), lower)));
+       return _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('_')));
+    default: // CL_STRCHAR
+       return _mm_xor_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('"')),
+                            _mm_set1_epi8(-1));
+   }
+}
+
+// Skip bytes of class cls 16 at a time (same contract as skipScalar)
+static const char* skipSSE2(const char* p, int cls, int* lines)
+{
+   const __m128i nl = _mm_set1_epi8('\n');
+   unsigned int stop, nls;
+   while (end - p >= 16) {
+      __m128i v = _mm_loadu_si128((const __m128i*) p);
+      stop = ~_mm_movemask_epi8(classMask16(v, cls)) & 0xFFFF;
+      nls = _mm_movemask_epi8(_mm_cmpeq_epi8(v, nl));
+      if (stop) {
+         stop = __builtin_ctz(stop);
+         *lines += __builtin_popcount(nls & ((1u << stop) - 1));
+         return p + stop;
+      }
+      *lines += __builtin_popcount(nls);
+      p += 16;
+   }
+   return skipScalar(p, cls, lines);
+}
+
+// Mark each of 32 bytes that is in class cls (see classMask16)
+__attribute__((target("avx2")))
+static inline __m256i classMask32(__m256i v, int cls)
+{
+   __m256i lower, m;
+   switch (cls) {
+    case CL_SPACE:
+       m = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')),
+                           _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')));
+       m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t')));
+       return _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r')));
+    case CL_IDENT:
+    case CL_DIGIT:
+       m = _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8('0'-1)),
+                            _mm256_cmpgt_epi8(_mm256_set1_epi8('9'+1), v));
+       if (cls == CL_DIGIT)
+          return m;
+       lower = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+       m = _mm256_or_si256(m, _mm256_and_si256(
+                              _mm256_cmpgt_epi8(lower, _mm256_set1_epi8('a'-1)),
+                              _mm256_cmpgt_epi8(_mm256_set1_epi8('z'+1), lower)));
+       return _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('_')));
+    default: // CL_STRCHAR
+       return _mm256_xor_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')),
+                               _mm256_set1_epi8(-1));
+   }
+}
+
+// Skip bytes of class cls 32 at a time (same contract as skipScalar)
+__attribute__((target("avx2,popcnt,bmi")))
+static const char* skipAVX2(const char* p, int cls, int* lines)
+{
+   const __m256i nl = _mm256_set1_epi8('\n');
+   unsigned int stop, nls;
+   while (end - p >= 32) {
+      __m256i v = _mm256_loadu_si256((const __m256i*) p);
+      stop = ~(unsigned int) _mm256_movemask_epi8(classMask32(v, cls));
+      nls = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl));
+      if (stop) {
+         stop = __builtin_ctz(stop);
+         *lines += __builtin_popcount(nls & ((1u << stop) - 1));
+         return p + stop;
+      }
+      *lines += __builtin_popcount(nls);
+      p += 32;
+   }
+   return skipSSE2(p, cls, lines);
+}
+#endif
+
+// Token code for an identifier-shaped lexeme: a keyword code, or ID
+static int keyword(const char* s, int len)
+{
+   switch (len) {
+    case 2:
+       if (!memcmp(s, "do", 2)) return KWDO;
+       if (!memcmp(s, "if", 2)) return KWIF;
+       break;
+    case 3:
+       if (!memcmp(s, "int", 3)) return KWINT;
+       break;
+    case 4:
+       if (!memcmp(s, "then", 4)) return KWTHEN;
+       if (!memcmp(s, "else", 4)) return KWELSE;
+       if (!memcmp(s, "call", 4)) return KWCALL;
+       break;
+    case 5:
+       if (!memcmp(s, "while", 5)) return KWWHILE;
+       break;
+    case 6:
+       if (!memcmp(s, "string", 6)) return KWSTRING;
+       if (!memcmp(s, "global", 6)) return KWGLOBAL;
+       break;
+    case 7:
+       if (!memcmp(s, "program", 7)) return KWPROGRAM;
+       break;
+    case 8:
+       if (!memcmp(s, "function", 8)) return KWFUNCTION;
+       break;
+    case 11:
+       if (!memcmp(s, "returnvalue", 11)) return KWRETURNVAL;
+       break;
+   }
+   return ID;
+}
+
+// Start scanning the given buffer (from its beginning, at line 1)
+// - picks the widest skipping loop this CPU supports
+void jlexInit(SourceBuffer* sb)
+{
+   int c;
+   cur = sb->base;
+   end = sb->base + sb->size;
+   yylineno = 1;
+   for (c=0; c < 256; c++) {
+      classBits[c] = 0;
+      if (c == ' ' || c == '\t' || c == '\n' || c == '\r')
+         classBits[c] |= 1 << CL_SPACE;
+      if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_')
+         classBits[c] |= (1 << CL_IDENT) | (1 << CL_IDSTART);
+      if (c >= '0' && c <= '9')
+         classBits[c] |= (1 << CL_IDENT) | (1 << CL_DIGIT);
+      if (c != '"')
+         classBits[c] |= 1 << CL_STRCHAR;
+   }
+   skipClass = skipScalar;
+   simdName = "scalar";
+#ifdef JLEX_X86
+   __builtin_cpu_init();
+   skipClass = skipSSE2;
+   simdName = "sse2";
+   if (__builtin_cpu_supports("avx2")) {
+      skipClass = skipAVX2;
+      simdName = "avx2";
+   }
+#endif
+}
+
+// Name of the skipping loop in use ("avx2", "sse2" or "scalar")
+const char* jlexSimdName()
+{
+   return simdName;
+}
+
+// Return the next token code, setting yylval; 0 at end of input
+// - characters that start no token are echoed to stdout and skipped,
+//   just like flex's default rule does
+int jlex(void)
+{
+   const char *p = cur, *s;
+   int c, tok, lines = 0;
+   for (;;) {
+      if (p < end && (classBits[(unsigned char) *p] & (1 << CL_SPACE)))
+         p = skipClass(p, CL_SPACE, &yylineno);
+      if (p >= end) {
+         cur = p;
+         return 0;
+      }
+      s = p;
+      c = (unsigned char) *p++;
+      if (classBits[c] & (1 << CL_IDSTART)) {
+         p = skipClass(p, CL_IDENT, &lines);
+         tok = keyword(s, p - s);
+         if (tok == ID)
+            yylval.atom = internAtom(s, p - s);
+         else
+            yylval.ival = c;
+         cur = p;
+         return tok;
+      }
+      if (classBits[c] & (1 << CL_DIGIT)) {
+         p = skipClass(p, CL_DIGIT, &lines);
+         yylval.ival = strtol(s, NULL, 10);
+         cur = p;
+         return NUMBER;
+      }
+      if (c == '"' && *p != '"') {
+         // a string needs at least one char and a closing quote
+         p = skipClass(p, CL_STRCHAR, &lines);
+         if (p < end) {
+            p++;
+            yylineno += lines;
+            lines = 0;
+            yylval.slice.off = s - srcBuf.base;
+            yylval.slice.len = p - s;
+            cur = p;
+            return STRING;
+         }
+         p = s + 1;
+         lines = 0;
+      }
+      yylval.ival = c;
+      cur = p;
+      switch (c) {
+       case '+': case '-': return ADDOP;
+       case '>': case '<': return RELOP;
+       case ',': return COMMA;
+       case '{': return LBRACE;
+       case '(': return LPAREN;
+       case '[': return LBRACKET;
+       case '}': return RBRACE;
+       case ')': return RPAREN;
+       case ']': return RBRACKET;
+       case ';': return SEMICOLON;
+       case '=':
+          if (*p == '=') {
+             cur = p + 1;
+             return RELOP;
+          }
+          return EQUALS;
+       case '!':
+          if (*p == '=') {
+             cur = p + 1;
+             return RELOP;
+          }
+          break;
+      }
+      putchar(c);
+   }
+}
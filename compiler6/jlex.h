@@ -0,0 +1,17 @@
+//
+// Hand-written Scanner Interface
+// - an alternative to the flex scanner in scanner.l; it returns the
+//   same token codes (from y.tab.h) with the same yylval values, and
+//   keeps yylineno up to date the same way
+// - it scans a SourceBuffer in place and never writes to it
+//
+#ifndef JLEX_H
+#define JLEX_H
+
+#include "srcbuf.h"
+
+void jlexInit(SourceBuffer* sb);
+int jlex(void);
+const char* jlexSimdName();
+
+#endif
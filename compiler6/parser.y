@@ -4,27 +4,40 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "srcbuf.h"
 #include "symtable.h"
 #include "astree.h"
+#include "jlex.h"
+#include "tokcache.h"
+#include "astfile.h"
+#include "passes.h"
+#include "peephole.h"
 // function prototypes from lex
-int addString(char *str);
-void outputDataSection();
+void scanSourceBuffer(SourceBuffer* sb);
+int flexLex(void);
 int functionNum = 1;
 int argRegNum = 0;
 int scopeLevel = 0;
 int paramNum = 0;
+int stringCount = 0; // string constants get ids 0,1,2,...
 int yyerror(char *s);
 int yylex(void);
 int doAssembly;
 int debug = 0; // set to 1 to turn on extra printing
-Symbol** table;
+int useJlex = 0; // set by -jlex to use the hand-written scanner
+int useTokCache = 0; // set by -tokcache to read or write a token cache
+int replayTokens = 0; // tokens come from a valid token cache
+int symStats = 0; // set by -symstats to print symbol table statistics
+int passStats = 0; // set by -passtimes to print optimization pass times
+SymbolTable* table;
 ASTNode* tree;
+CompactAST* ast;
 FILE *outputFile;
 
 %}
 
 /* token value data types */
-%union { int ival; char* str; struct astnode_s * treeNode; }
+%union { int ival; Atom atom; Slice slice; struct astnode_s * treeNode; }
 
 /* Starting non-terminal */
 %start wholeprogram
@@ -32,7 +45,8 @@ FILE *outputFile;
 
 /* Token types */
 %token <ival> LPAREN RPAREN LBRACE RBRACE SEMICOLON ADDOP KWPROGRAM KWCALL KWFUNCTION COMMA NUMBER EQUALS KWGLOBAL KWINT KWSTRING RELOP KWRETURNVAL KWWHILE KWDO KWIF KWTHEN KWELSE LBRACKET RBRACKET
-%token <str> STRING ID
+%token <atom> ID
+%token <slice> STRING
 
 %%
 /******* Rules *******/
@@ -40,8 +54,8 @@ FILE *outputFile;
 wholeprogram: globals functions program
      {
          tree = newASTNode(AST_PROGRAM);
-         tree->child[0] = $1;
-         tree->child[1] = $2;
+         tree->child[0] = reverseASTList($1);
+         tree->child[1] = reverseASTList($2);
          tree->child[2] = $3;
          if (tree->child[2] != 0) {
           doAssembly = 1;
@@ -53,37 +67,43 @@ wholeprogram: globals functions program
 program: KWPROGRAM LBRACE statements RBRACE
      {
           if (debug) fprintf(stderr, "program rule\n");
-          $$ = $3;
+          $$ = reverseASTList($3);
      };
 
+/* Lists (functions, statements, globals, localvars) are left
+   recursive, so that the parser stack does not grow with the length
+   of a list; each one is built backwards, newest first, and the rule
+   that uses the whole list puts it in order with reverseASTList() */
 functions: /*empty*/ 
        { $$ = 0; }
-      | function functions
+      | functions function
        {
            if (debug) fprintf(stderr, "functions rule\n");
-           $1->next = $2;
-           $$ = $1;
+           $2->next = $1;
+           $$ = $2;
        };
 
-function: KWFUNCTION ID LPAREN parameters RPAREN LBRACE localvars statements RBRACE
+function: KWFUNCTION ID { pushScope(table); consASTReset(); } LPAREN parameters RPAREN LBRACE localvars statements RBRACE
        {
            if (debug) fprintf(stderr, "function rule\n");
            $$ = newASTNode(AST_FUNCTION);
-           $$->strval = $2;
-           $$->strNeedsFreed = 1;
-           $$->child[0] = $4;
-           $$->child[1] = $8;
-           $$->child[2] = $7;
-           delScopeLevel(table, 1);
+           $$->name = $2;
+           $$->child[0] = $5;
+           $$->child[1] = reverseASTList($9);
+           $$->child[2] = reverseASTList($8);
+           popScope(table);
            paramNum = 0;
        };
 
 statements: /*empty*/
-       { $$ = 0; }
-     | statement statements
        {
-           $$ = $1;
-           $$->next = $2;
+           consASTReset(); // a new block: no shared nodes from before it
+           $$ = 0;
+       }
+     | statements statement
+       {
+           $$ = $2;
+           $$->next = $1;
        };
        
 statement: funcall
@@ -111,9 +131,9 @@ funcall: KWCALL ID LPAREN arguments RPAREN SEMICOLON
        {
            if (debug) fprintf(stderr, "function call rule\n");
            $$ = newASTNode(AST_FUNCALL);
-           $$->strval = $2;
-           $$->strNeedsFreed = 1;
+           $$->name = $2;
            $$->child[0] = $4;
+           consASTCall();
        };
        
 assignment: ID EQUALS expression SEMICOLON
@@ -121,29 +141,29 @@ assignment: ID EQUALS expression SEMICOLON
            if (debug) fprintf(stderr, "assignment rule\n");
            Symbol* symbol = findSymbol(table, $1);
            if (!symbol) {
-              printf("Error: Symbol %s couldn't be found\n", $1);
+              printf("Error: Symbol %s couldn't be found\n", atomName($1));
               exit(1);
            }
            $$ = newASTNode(AST_ASSIGNMENT);
-           $$->strval = symbol->name;
+           $$->name = symbol->name;
            $$->child[0] = $3;
            $$->varKind = symbol->varKind;
            $$->ival = symbol->offset;
-           free($1);
+           consASTStore(symbol->name);
        }
      | ID LBRACKET expression RBRACKET EQUALS expression SEMICOLON {
            if (debug) fprintf(stderr, "assignment rule\n");
            Symbol* symbol = findSymbol(table, $1);
            if (!symbol) {
-              printf("Error: Symbol %s couldn't be found\n", $1);
+              printf("Error: Symbol %s couldn't be found\n", atomName($1));
               exit(1);
            }
            $$ = newASTNode(AST_ASSIGNMENT);
-           $$->strval = symbol->name;
+           $$->name = symbol->name;
            $$->child[1] = $3;
            $$->child[0] = $6;
            $$->varKind = symbol->varKind;
-           free($1);
+           consASTStore(symbol->name);
        };
 
 arguments: /* empty */
@@ -170,82 +190,65 @@ argument: expression
 expression: NUMBER
        {
            if (debug) fprintf(stderr, "expression rule 1\n");
-           $$ = newASTNode(AST_CONSTANT);
-           $$->ival = $1;
-           $$->valType = T_INT;
+           $$ = consASTConstant($1, T_INT);
        }
      | STRING
        {
            if (debug) fprintf(stderr, "argument rule 1\n");
-           int sid = addString($1);
            $$ = newASTNode(AST_CONSTANT);
            $$->valType = T_STRING;
-           $$->strval = $1;
-           $$->strNeedsFreed = 1;
-           $$->ival = sid;
+           $$->strval = newASTString(slicePtr($1), $1.len);
+           $$->ival = stringCount++;
        }
      | KWRETURNVAL
        {
            if (debug) fprintf(stderr, "RETURNVAL rules\n");
-           $$ = newASTNode(AST_CONSTANT);
-           $$->valType = T_RETURNVAL;
+           $$ = consASTConstant(0, T_RETURNVAL);
        }
      | ID
        {
            if (debug) fprintf(stderr, "assignment rule\n");
            Symbol* symbol = findSymbol(table, $1);
            if (!symbol) {
-              printf("Error: Symbol %s couldn't be found\n", $1);
+              printf("Error: Symbol %s couldn't be found\n", atomName($1));
               exit(1);
            }
-           $$ = newASTNode(AST_VARREF);
-           $$->strval = symbol->name;
-           $$->varKind = symbol->varKind;
-           $$->ival = symbol->offset;
-           free($1);
+           $$ = consASTVarRef(symbol->name, symbol->varKind, symbol->offset, 0);
        }
      | ID LBRACKET expression RBRACKET {
            if (debug) fprintf(stderr, "expression array ID rule\n");
            Symbol* symbol = findSymbol(table, $1);
            if (!symbol) {
-              printf("Error: Symbol %s couldn't be found\n", $1);
+              printf("Error: Symbol %s couldn't be found\n", atomName($1));
               exit(1);
            }
-           $$ = newASTNode(AST_VARREF);
-           $$->child[0] = $3;
-           $$->strval = symbol->name;
-           $$->varKind = symbol->varKind;
-           free($1);
+           $$ = consASTVarRef(symbol->name, symbol->varKind, 0, $3);
        }
      | expression ADDOP expression
        {
            if (debug) fprintf(stderr, "argument rule 2\n");
-           $$ = newASTNode(AST_EXPRESSION);
-           $$->child[0] = $1;
-           $$->child[1] = $3;
-           $$->ival = $2;
+           $$ = consASTExpression($2, $1, $3);
        };
 
 globals: /* empty */
        { $$ = 0; }
-     | KWGLOBAL vardecl SEMICOLON globals
+     | globals KWGLOBAL vardecl SEMICOLON
        {
            scopeLevel = 0;
            if (debug) fprintf(stderr, "globals rule\n");
-           $$ = $2;
-           $$->next = $4;
+           $$ = $3;
+           $$->next = $1;
        };
 
 vardecl: KWINT ID LBRACKET NUMBER RBRACKET
        {
            if (debug) fprintf(stderr, "int declaration rule\n");
            if (addSymbol(table, $2, 0, T_INT, $4, 0, V_GLARRAY) != 0) {
-             printf("Error adding symbol to table: %s\n", $2);
+             printf("Error adding symbol to table: %s\n", atomName($2));
            }
 
            $$ = newASTNode(AST_VARDECL);
-           $$->strval = $2;
-           $$->strNeedsFreed = 1;
+           $$->name = $2;
            $$->valType = T_INT;
            $$->ival = $4;
            $$->varKind = V_GLARRAY;
@@ -254,25 +257,24 @@ vardecl: KWINT ID LBRACKET NUMBER RBRACKET
        {
            if (debug) fprintf(stderr, "int declaration rule\n");
            if (addSymbol(table, $2, scopeLevel, T_INT, 0, 0, V_GLOBAL) != 0) {
-             printf("Error adding symbol to table: %s\n", $2);
+             printf("Error adding symbol to table: %s\n", atomName($2));
            }
 
            $$ = newASTNode(AST_VARDECL);
            $$->valType = T_INT;
-           $$->strNeedsFreed = 1;
-           $$->strval = $2;
+           $$->name = $2;
            $$->varKind = V_GLOBAL;
        }
      | KWSTRING ID
        {
            if (debug) fprintf(stderr, "string declaration rule\n");
            if (addSymbol(table, $2, scopeLevel, T_STRING, 0, 0, V_GLOBAL) != 0) {
-             printf("Error adding symbol to table: %s\n", $2);
+             printf("Error adding symbol to table: %s\n", atomName($2));
            }
 
            $$ = newASTNode(AST_VARDECL);
            $$->valType = T_STRING;
-           $$->strval = $2;
+           $$->name = $2;
            $$->varKind = V_GLOBAL;
        };
 
@@ -296,12 +298,11 @@ paramdecl: KWINT ID
        {
            if (debug) fprintf(stderr, "param int declaration rule\n");
            if (addSymbol(table, $2, 1, T_INT, 0, paramNum, V_PARAM) != 0) {
-            printf("Error adding symbol to table: %s\n", $2);
+            printf("Error adding symbol to table: %s\n", atomName($2));
            }
 
            $$ = newASTNode(AST_VARDECL);
-           $$->strNeedsFreed = 1;
-           $$->strval = $2;
+           $$->name = $2;
            $$->valType = T_INT;
            $$->ival = paramNum++;
            $$->varKind = V_PARAM;
@@ -309,12 +310,11 @@ paramdecl: KWINT ID
      | KWSTRING ID
        {
            if (addSymbol(table, $2, 1, T_STRING, 0, paramNum, V_PARAM) != 0) {
-            printf("Error adding symbol to table: %s\n", $2);
+            printf("Error adding symbol to table: %s\n", atomName($2));
            }
 
            $$ = newASTNode(AST_VARDECL);
-           $$->strval = $2;
-           $$->strNeedsFreed = 1;
+           $$->name = $2;
            $$->valType = T_STRING;
            $$->ival = paramNum++;
            $$->varKind = V_PARAM;
@@ -322,25 +322,24 @@ paramdecl: KWINT ID
 
 localvars: /* empty */
        { $$ = 0; }
-     | localdecl SEMICOLON localvars
+     | localvars localdecl SEMICOLON
        {
            scopeLevel = 1;
            if (debug) fprintf(stderr, "localvars\n");
-           $$ = $1;
-           $$->next = $3;
+           $$ = $2;
+           $$->next = $1;
        }
 
 localdecl: KWINT ID
        {
            if (debug) fprintf(stderr, "local int declaration rule\n");
            if (addSymbol(table, $2, 1, T_INT, 0, paramNum, V_LOCAL) != 0) {
-            printf("Error adding symbol to table: %s\n", $2);
+            printf("Error adding symbol to table: %s\n", atomName($2));
            }
 
            $$ = newASTNode(AST_VARDECL);
-           $$->strval = $2;
+           $$->name = $2;
            $$->valType = T_INT;
-           $$->strNeedsFreed = 1;
            $$->ival = paramNum++;
            $$->varKind = V_LOCAL;
        }
@@ -348,11 +347,11 @@ localdecl: KWINT ID
        {
            if (debug) fprintf(stderr, "local string declaration rule\n");
            if (addSymbol(table, $2, 1, T_STRING, 0, paramNum, V_LOCAL) != 0) {
-            printf("Error adding symbol to table: %s\n", $2);
+            printf("Error adding symbol to table: %s\n", atomName($2));
            }
 
            $$ = newASTNode(AST_VARDECL);
-           $$->strval = $2;
+           $$->name = $2;
            $$->valType = T_STRING;
            $$->ival = paramNum++;
            $$->varKind = V_LOCAL;
@@ -363,8 +362,9 @@ ifthenelse: KWIF LPAREN boolexpr RPAREN KWTHEN LBRACE statements RBRACE KWELSE L
            if (debug) fprintf(stderr, "ifthenelse rule\n");
            $$ = newASTNode(AST_IFTHEN);
            $$->child[0] = $3;
-           $$->child[1] = $7;
-           $$->child[2] = $11;
+           $$->child[1] = reverseASTList($7);
+           $$->child[2] = reverseASTList($11);
+           consASTReset(); // end of a block
        };
 
 whileloop: KWWHILE LPAREN boolexpr RPAREN KWDO LBRACE statements RBRACE
@@ -372,7 +372,8 @@ whileloop: KWWHILE LPAREN boolexpr RPAREN KWDO LBRACE statements RBRACE
            if (debug) fprintf(stderr, "whileloop rule\n");
            $$ = newASTNode(AST_WHILE);
            $$->child[0] = $3;
-           $$->child[1] = $7;
+           $$->child[1] = reverseASTList($7);
+           consASTReset(); // end of a block
        };
 
 boolexpr: expression RELOP expression
@@ -387,68 +388,207 @@ boolexpr: expression RELOP expression
 
 /******* Functions *******/
 
-int stringCount = 0;
-char *strings[128];
+extern void yylex_destroy(); // from lex
 
-int addString(char *str)
+// Token source for the parser: the flex scanner, or the
+// hand-written one in jlex.c if the -jlex option was given, or
+// a token cache being replayed; with -tokcache, tokens from a
+// live scanner are also recorded for writing a new cache
+int yylex(void)
 {
-    int i = stringCount++;
-    strings[i] = strdup(str);
-    return(i);
+   int tok;
+   if (replayTokens)
+      return tokCacheNext();
+   tok = useJlex ? jlex() : flexLex();
+   if (useTokCache)
+      tokCacheRecord(tok);
+   return tok;
 }
 
-void outputDataSection()
+// Make the name of an output file for source file fileName
+// - a ".j" or ".jast" suffix is replaced by ext, otherwise ext is
+//   appended
+// - returns a new string that the caller must free
+static char* outputName(const char* fileName, const char* ext)
 {
-   int i;
-   for (i = 0; i < stringCount; i++) {
-      fprintf(outputFile, ".SC%d:\t.string\t%s\n",i,strings[i]);
-      free(strings[i]);
-   }
+   size_t len = strlen(fileName);
+   char* name = (char*) malloc(len + strlen(ext) + 1);
+   strcpy(name, fileName);
+   if (len > 2 && strcmp(name + len - 2, ".j") == 0)
+      name[len-2] = '\0';
+   else if (len > 5 && strcmp(name + len - 5, ".jast") == 0)
+      name[len-5] = '\0';
+   strcat(name, ext);
+   return name;
 }
 
-extern FILE *yyin; // from lex
-extern void yylex_destroy();
+// Generate assembly for ast into out
+// - through the peephole optimizer when it is on (-O1 and up)
+static void generateCode(FILE* out)
+{
+   FILE* stream = passEnabled("peephole") ? openPeephole(out) : 0;
+   genCodeFromASTree(ast, ast->root, 0, stream ? stream : out);
+   if (!stream)
+      return;
+   fclose(stream);
+   if (passStats)
+      printPeepholeStats(stderr);
+}
 
+// Generate code for a binary AST file (ptest -loadast)
+// - writes file.s for file.jast; returns 0 on success
+static int compileASTFile(const char* fileName)
+{
+   char* newFile;
+   if (!fileName) {
+      printf("Error: -loadast needs a file name\n");
+      return(1);
+   }
+   ast = loadASTFile(fileName);
+   if (!ast) {
+      printf("Error: unable to load AST file (%s)\n", fileName);
+      return(1);
+   }
+   newFile = outputName(fileName, ".s");
+   outputFile = fopen(newFile, "w");
+   free(newFile);
+   if (outputFile == NULL) {
+      printf("Error: Could not create file.\n");
+      freeCompactAST(ast);
+      freeAtoms();
+      return(1);
+   }
+   generateCode(outputFile);
+   if (passStats)
+      printPassStats(stderr);
+   freeCompactAST(ast);
+   freeAtoms();
+   fclose(outputFile);
+   return(0);
+}
+
+// Usage: ptest [-jlex] [-tokcache] [-symstats] [-O0|-O1|-O2]
+//              [-fno-pass] [-fpass] [-passtimes] [-listpasses]
+//              [-emitast] [-dumpir] [file.j]
+//        ptest [-O0|-O1|-O2] [-fno-pass] [-fpass] -loadast file.jast
+// - compiles file.j into file.s, or stdin to stdout
+// - with -emitast, also saves the optimized AST in file.jast;
+//   -loadast generates file.s from such a file, with no scanning,
+//   parsing or passes (see astfile.h)
+// - with -tokcache, replays tokens from file.jtc if it was made from
+//   the current file.j, and otherwise writes file.jtc for next time
+// - with -symstats, prints symbol table statistics to stderr (they
+//   are only gathered if symtable.c was compiled with -DSYMSTATS)
+// - -O picks the optimization pipeline (default -O0, no passes);
+//   -fno-pass and -fpass switch one pass (or code generator
+//   option, like regalloc) off or on (see passes.c), and -passtimes
+//   prints each pass's time and node count change (and what the
+//   IR passes removed from each function)
+// - -dumpir generates code through the IR (see ir.h) and prints
+//   the IR of each function to stderr
 int main(int argc, char **argv)
 {
-  char newFile[64];
+  char* newFile;
+  char* cacheFile = 0;
+  char* fileName;
+  int i;
   doAssembly = 0;
   int stat;
-   if (argc==2) {
-      yyin = fopen(argv[1],"r");
-      if (!yyin) {
-         printf("Error: unable to open file (%s)\n",argv[1]);
+  int emitAST = 0, loadAST = 0, dumpIR = 0;
+   for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+      if (!strcmp(argv[i], "-jlex"))
+         useJlex = 1;
+      else if (!strcmp(argv[i], "-tokcache"))
+         useTokCache = 1;
+      else if (!strcmp(argv[i], "-symstats"))
+         symStats = 1;
+      else if (argv[i][1] == 'O' && argv[i][2] >= '0' && argv[i][2] <= '9' && !argv[i][3])
+         setOptLevel(argv[i][2] - '0');
+      else if (!strncmp(argv[i], "-fno-", 5) && !setPassEnabled(argv[i]+5, 0))
+         ;
+      else if (!strncmp(argv[i], "-f", 2) && !setPassEnabled(argv[i]+2, 1))
+         ;
+      else if (!strcmp(argv[i], "-passtimes"))
+         passStats = 1;
+      else if (!strcmp(argv[i], "-emitast"))
+         emitAST = 1;
+      else if (!strcmp(argv[i], "-loadast"))
+         loadAST = 1;
+      else if (!strcmp(argv[i], "-dumpir"))
+         dumpIR = 1;
+      else if (!strcmp(argv[i], "-listpasses")) {
+         listPasses(stdout);
+         return(0);
+      }
+      else {
+         printf("Error: unknown option (%s)\n", argv[i]);
          return(1);
       }
    }
+   fileName = i < argc ? argv[i] : 0;
+   setCodeGenFlags((passEnabled("regalloc") ? CG_REGALLOC : 0) |
+                   (passEnabled("sethi-ullman") ? CG_SETHIULLMAN : 0) |
+                   (passEnabled("leaf") ? CG_LEAF : 0) |
+                   (passEnabled("ir") || dumpIR ? CG_IR : 0) |
+                   (passStats ? CG_IRSTATS : 0) |
+                   (dumpIR ? CG_DUMPIR : 0));
+   if (loadAST)
+      return compileASTFile(fileName);
+   if (openSourceBuffer(&srcBuf, fileName) != 0) {
+      printf("Error: unable to open file (%s)\n", fileName ? fileName : "stdin");
+      return(1);
+   }
 
-   if (argc == 2) {
+   if (fileName) {
      if (debug) fprintf(stderr, ".s file creation started\n");
-     strcpy(newFile, argv[1]);
-
-     char *dot = strchr(newFile, '.');
-     if (dot && strcmp(dot, ".j") == 0) *dot = '\0';
-
-     strcat(newFile, ".s");
+     newFile = outputName(fileName, ".s");
      outputFile = fopen(newFile, "w");
+     free(newFile);
      if (outputFile == NULL) {
        printf("Error: Could not create file.\n");
-       fclose(yyin);
+       closeSourceBuffer(&srcBuf);
        return(1);
      }
+     if (useTokCache) {
+       cacheFile = outputName(fileName, ".jtc");
+       replayTokens = tokCacheOpen(cacheFile) == 0;
+     }
    } else {
-     yyin = stdin;
      outputFile = stdout;
+     useTokCache = 0; // no file to put a cache next to
    }
    table = newSymbolTable();
+   if (useJlex)
+      jlexInit(&srcBuf);
+   else
+      scanSourceBuffer(&srcBuf);
    stat = yyparse();
-   fclose(yyin);
-   if (doAssembly && !stat) genCodeFromASTree(tree, 0, outputFile);
-   else printASTree(tree, 0, stderr);
-   freeAllSymbols(table);
-   free(table);
+   if (useTokCache && !replayTokens && !stat &&
+       tokCacheWrite(cacheFile) != 0)
+      fprintf(stderr, "Warning: could not write token cache (%s)\n", cacheFile);
+   tokCacheClose();
+   free(cacheFile);
+   if (!stat)
+      runPasses(tree);
+   ast = compactASTree(tree);
    freeASTree(tree);
+   if (emitAST && fileName && doAssembly && !stat) {
+      cacheFile = outputName(fileName, ".jast");
+      if (writeASTFile(ast, cacheFile) != 0)
+         fprintf(stderr, "Warning: could not write AST file (%s)\n", cacheFile);
+      free(cacheFile);
+   }
+   if (doAssembly && !stat) generateCode(outputFile);
+   else printASTree(ast, ast->root, 0, stderr);
+   if (passStats)
+      printPassStats(stderr);
+   if (symStats)
+      printSymbolStats(table, stderr);
+   freeSymbolTable(table);
+   freeCompactAST(ast);
+   freeAtoms();
    yylex_destroy();
+   closeSourceBuffer(&srcBuf);
    fclose(outputFile);
    return stat;
 }
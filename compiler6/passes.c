@@ -0,0 +1,604 @@
+//
+// Pass Manager Module
+// - see passes.h; the pass table below is the registry, and its
+//   order is the order passes run in
+// - a pass is a function over the pointer AST, run after parsing
+//   and before the tree is compacted for code generation, or an IR
+//   pass, a function over one lowered body (see ir.h) that the code
+//   generator runs through runIRPasses() as it makes each body
+// - an entry with no function is a code generator option instead;
+//   the -O level and -f flags switch it the same way, and the code
+//   generator asks passEnabled() whether it is on
+//
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "passes.h"
+#include "ssa.h"
+
+typedef struct {
+   const char* name;
+   int level;             // lowest -O level that runs this pass
+   void (*run)(ASTNode* tree);
+   void (*runIR)(IRFunc* fn, IRPassEnv* env);
+   int ssaForm;           // an IR pass that works on SSA form
+   const char* desc;
+   int enabled;           // -1 follows the -O level, else 0 or 1
+   int runs;              // times run (and measured)
+   double seconds;
+   long nodesBefore, nodesAfter; // for an IR pass, instructions
+} Pass;
+
+static void removeEmptyIfs(ASTNode* tree);
+static void propagateConstants(ASTNode* tree);
+static void foldConstants(ASTNode* tree);
+static void enterSSA(IRFunc* fn, IRPassEnv* env);
+static void sccpPass(IRFunc* fn, IRPassEnv* env);
+static void dcePass(IRFunc* fn, IRPassEnv* env);
+static void licmPass(IRFunc* fn, IRPassEnv* env);
+
+static Pass passes[] = {
+   { "const-prop", 2, propagateConstants, 0, 0, "forward constant values of scalar variables, and fold", -1 },
+   { "const-fold", 1, foldConstants, 0, 0, "fold constant arithmetic and constant conditions", -1 },
+   { "empty-if", 1, removeEmptyIfs, 0, 0, "remove if statements with empty then and else parts", -1 },
+   { "regalloc", 1, 0, 0, 0, "keep expression temporaries in registers (code generation)", -1 },
+   { "sethi-ullman", 1, 0, 0, 0, "evaluate the operand that needs more registers first (code generation)", -1 },
+   { "leaf", 1, 0, 0, 0, "give small leaf functions no stack frame (code generation)", -1 },
+   { "ir", 2, 0, 0, 0, "generate code through the three-address IR (code generation)", -1 },
+   { "ssa", 2, 0, enterSSA, 1, "take the IR through SSA form and back", -1 },
+   { "sccp", 2, 0, sccpPass, 1, "propagate constants and prune branches in SSA form", -1 },
+   { "dce", 2, 0, dcePass, 0, "remove dead stores and unreachable blocks from the IR", -1 },
+   { "licm", 2, 0, licmPass, 0, "hoist loop-invariant expressions and array addresses out of loops", -1 },
+   { "peephole", 1, 0, 0, 0, "rewrite short instruction sequences in the assembly (code generation)", -1 },
+};
+#define NUMPASSES (sizeof(passes) / sizeof(passes[0]))
+
+static int optLevel = 0;
+
+// Set the -O level (clamped to 0..MAXOPTLEVEL)
+void setOptLevel(int level)
+{
+   if (level < 0)
+      level = 0;
+   if (level > MAXOPTLEVEL)
+      level = MAXOPTLEVEL;
+   optLevel = level;
+}
+
+int getOptLevel()
+{
+   return optLevel;
+}
+
+// Switch a pass on or off by name, whatever the -O level
+// - returns 0 on success, 1 if there is no pass with that name
+int setPassEnabled(const char* name, int enabled)
+{
+   unsigned int i;
+   for (i=0; i < NUMPASSES; i++) {
+      if (!strcmp(passes[i].name, name)) {
+         passes[i].enabled = enabled != 0;
+         return 0;
+      }
+   }
+   return 1;
+}
+
+// Is the named pass (or code generator option) on at this -O level?
+int passEnabled(const char* name)
+{
+   unsigned int i;
+   for (i=0; i < NUMPASSES; i++)
+      if (!strcmp(passes[i].name, name))
+         return passes[i].enabled < 0 ? passes[i].level <= optLevel
+                                      : passes[i].enabled;
+   return 0;
+}
+
+static double seconds()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Count the nodes of a tree
+// - recursion is only on children, so the depth is the tree's
+//   nesting depth; lists are walked with a loop
+static long countNodes(ASTNode* node)
+{
+   long n = 0;
+   int i;
+   for (; node; node = node->next) {
+      n++;
+      for (i=0; i < ASTNUMCHILDREN; i++)
+         n += countNodes(node->child[i]);
+   }
+   return n;
+}
+
+// Run every pass that is enabled at the current -O level (or
+// switched on by name) over the tree, measuring each one
+void runPasses(ASTNode* tree)
+{
+   unsigned int i;
+   double start;
+   long nodes;
+   if (!tree)
+      return;
+   nodes = countNodes(tree);
+   for (i=0; i < NUMPASSES; i++) {
+      Pass* p = &passes[i];
+      if (!p->run || p->enabled == 0 || (p->enabled < 0 && p->level > optLevel))
+         continue;
+      p->nodesBefore = nodes;
+      start = seconds();
+      p->run(tree);
+      p->seconds += seconds() - start;
+      nodes = countNodes(tree);
+      p->nodesAfter = nodes;
+      p->runs++;
+   }
+}
+
+// Number of instructions in a lowered body, not counting notes
+static long countIRInstrs(IRFunc* fn)
+{
+   long n = 0;
+   int i, j;
+   for (i=0; i < fn->numBlocks; i++)
+      for (j=0; j < fn->blocks[i].len; j++)
+         n += fn->blocks[i].code[j].op != IR_NOTE;
+   return n;
+}
+
+// Take a body out of SSA form, measured as part of the ssa pass
+// (its count after takes the change leaving makes)
+// - instrs is the body's instruction count; returns the new one
+static long leaveSSAForm(Pass* ssa, IRFunc* fn, long instrs)
+{
+   double start = seconds();
+   long after;
+   leaveSSA(fn);
+   ssa->seconds += seconds() - start;
+   after = countIRInstrs(fn);
+   ssa->nodesAfter += after - instrs;
+   return after;
+}
+
+// Run every IR pass that is on over one lowered body, measuring
+// each one (times and instruction counts add up over all bodies)
+// - the ssa pass puts the body in SSA form, and passes marked
+//   ssaForm run only while it is there; the body leaves SSA form
+//   before the next pass that is not one of those, or at the end
+void runIRPasses(IRFunc* fn, IRPassEnv* env)
+{
+   unsigned int i;
+   Pass* ssa = 0; // the ssa pass, while the body is in SSA form
+   double start;
+   long instrs = countIRInstrs(fn);
+   for (i=0; i < NUMPASSES; i++) {
+      Pass* p = &passes[i];
+      if (!p->runIR || p->enabled == 0 || (p->enabled < 0 && p->level > optLevel))
+         continue;
+      if (p->ssaForm && !ssa && p->runIR != enterSSA)
+         continue; // needs SSA form, and the ssa pass is off
+      if (ssa && !p->ssaForm) {
+         instrs = leaveSSAForm(ssa, fn, instrs);
+         ssa = 0;
+      }
+      p->nodesBefore += instrs;
+      start = seconds();
+      p->runIR(fn, env);
+      p->seconds += seconds() - start;
+      p->runs++;
+      instrs = countIRInstrs(fn);
+      p->nodesAfter += instrs;
+      if (p->runIR == enterSSA)
+         ssa = p;
+   }
+   if (ssa)
+      leaveSSAForm(ssa, fn, instrs);
+}
+
+// Print the time and node (or IR instruction) count change of
+// every pass that ran
+void printPassStats(FILE* out)
+{
+   unsigned int i;
+   double total = 0;
+   fprintf(out, "Optimization passes (-O%d):\n", optLevel);
+   fprintf(out, "  %-16s %10s %10s %10s %8s\n", "pass", "ms", "nodes in",
+           "nodes out", "delta");
+   for (i=0; i < NUMPASSES; i++) {
+      Pass* p = &passes[i];
+      if (!p->run)
+         continue;
+      if (!p->runs) {
+         fprintf(out, "  %-16s %10s\n", p->name, "(off)");
+         continue;
+      }
+      fprintf(out, "  %-16s %10.3f %10ld %10ld %+8ld\n", p->name,
+              p->seconds * 1e3, p->nodesBefore, p->nodesAfter,
+              p->nodesAfter - p->nodesBefore);
+      total += p->seconds;
+   }
+   fprintf(out, "  %-16s %10s %10s %10s %8s\n", "IR pass", "ms", "instrs in",
+           "instrs out", "delta");
+   for (i=0; i < NUMPASSES; i++) {
+      Pass* p = &passes[i];
+      if (!p->runIR)
+         continue;
+      if (!p->runs) {
+         fprintf(out, "  %-16s %10s\n", p->name, "(off)");
+         continue;
+      }
+      fprintf(out, "  %-16s %10.3f %10ld %10ld %+8ld\n", p->name,
+              p->seconds * 1e3, p->nodesBefore, p->nodesAfter,
+              p->nodesAfter - p->nodesBefore);
+      total += p->seconds;
+   }
+   fprintf(out, "  %-16s %10.3f\n", "total", total * 1e3);
+}
+
+// Print the registered passes, in pipeline order
+void listPasses(FILE* out)
+{
+   unsigned int i;
+   for (i=0; i < NUMPASSES; i++)
+      fprintf(out, "  %-16s -O%d  %s\n", passes[i].name, passes[i].level,
+              passes[i].desc);
+}
+
+//
+// Passes
+//
+
+// Unlink if statements with empty then and else parts from list
+// - conditions cannot have side effects, so such a statement does
+//   nothing; children are done first so that an if which only held
+//   removable ifs is removed too
+static void removeEmptyIfsIn(ASTNode** list)
+{
+   ASTNode* node;
+   int i;
+   while ((node = *list)) {
+      for (i=0; i < ASTNUMCHILDREN; i++)
+         removeEmptyIfsIn(&node->child[i]);
+      if (node->type == AST_IFTHEN && !node->child[1] && !node->child[2])
+         *list = node->next;
+      else
+         list = &node->next;
+   }
+}
+
+static void removeEmptyIfs(ASTNode* tree)
+{
+   removeEmptyIfsIn(&tree);
+}
+
+//
+// Constant folding and propagation
+// - both passes walk the statements of each body in order, folding
+//   every expression; const-prop also carries an environment of the
+//   scalar variables known to hold a constant at that point, and
+//   replaces reads of them by the constant
+// - an if or while whose condition folds to a constant is replaced
+//   by the part that runs (or removed); other ifs merge the
+//   environments of their two parts, and a while starts (and ends)
+//   with what is known minus anything its body assigns
+// - expression nodes may be shared (hash-consed, see astree.h), so
+//   a changed expression is always a new node, never edited in place
+//
+
+typedef struct {
+   Atom name;
+   int global;  // a global variable (else a local or parameter)
+   int value;
+} ConstVar;
+
+typedef struct {
+   ConstVar* vars;
+   int num, cap;
+} ConstEnv;
+
+static ConstVar* findConst(ConstEnv* env, Atom name, int global)
+{
+   int i;
+   for (i=0; i < env->num; i++)
+      if (env->vars[i].name == name && env->vars[i].global == global)
+         return &env->vars[i];
+   return 0;
+}
+
+static void setConst(ConstEnv* env, Atom name, int global, int value)
+{
+   ConstVar* v = findConst(env, name, global);
+   if (!v) {
+      if (env->num == env->cap) {
+         env->cap = env->cap ? env->cap * 2 : 16;
+         env->vars = (ConstVar*) realloc(env->vars, env->cap * sizeof(ConstVar));
+      }
+      v = &env->vars[env->num++];
+      v->name = name;
+      v->global = global;
+   }
+   v->value = value;
+}
+
+// Forget one variable, or (with name 0) every global
+static void killConst(ConstEnv* env, Atom name, int global)
+{
+   int i;
+   for (i=0; i < env->num; ) {
+      if ((name == 0 && env->vars[i].global) ||
+          (env->vars[i].name == name && env->vars[i].global == global))
+         env->vars[i] = env->vars[--env->num];
+      else
+         i++;
+   }
+}
+
+static void copyConsts(ConstEnv* to, ConstEnv* from)
+{
+   if (to->cap < from->num) {
+      to->cap = from->num;
+      to->vars = (ConstVar*) realloc(to->vars, to->cap * sizeof(ConstVar));
+   }
+   if (from->num)
+      memcpy(to->vars, from->vars, from->num * sizeof(ConstVar));
+   to->num = from->num;
+}
+
+// Keep only what env and other agree on (the join after an if)
+static void meetConsts(ConstEnv* env, ConstEnv* other)
+{
+   ConstVar* v;
+   int i;
+   for (i=0; i < env->num; ) {
+      v = findConst(other, env->vars[i].name, env->vars[i].global);
+      if (!v || v->value != env->vars[i].value)
+         env->vars[i] = env->vars[--env->num];
+      else
+         i++;
+   }
+}
+
+// Forget everything a statement list may assign (for a loop)
+static void killAssigned(ConstEnv* env, ASTNode* node)
+{
+   int i;
+   for (; node && env->num; node = node->next) {
+      if (node->type == AST_ASSIGNMENT && node->varKind != V_GLARRAY)
+         killConst(env, node->name, node->varKind == V_GLOBAL);
+      else if (node->type == AST_FUNCALL)
+         killConst(env, 0, 1);
+      else if (node->type == AST_WHILE || node->type == AST_IFTHEN)
+         for (i=1; i < ASTNUMCHILDREN; i++)
+            killAssigned(env, node->child[i]);
+   }
+}
+
+static int isIntConst(ASTNode* node)
+{
+   return node->type == AST_CONSTANT && node->valType == T_INT;
+}
+
+static ASTNode* intConst(int value)
+{
+   ASTNode* node = newASTNode(AST_CONSTANT);
+   node->valType = T_INT;
+   node->ival = value;
+   return node;
+}
+
+// A new copy of an expression node, with new children
+static ASTNode* withChildren(ASTNode* node, ASTNode* left, ASTNode* right)
+{
+   ASTNode* copy;
+   if (node->child[0] == left && node->child[1] == right)
+      return node;
+   copy = newASTNode(node->type);
+   *copy = *node;
+   copy->consed = 0;
+   copy->child[0] = left;
+   copy->child[1] = right;
+   return copy;
+}
+
+// Does relational op hold for the two values?
+static int relHolds(int op, int a, int b)
+{
+   switch (op) {
+    case '=': return a == b;
+    case '!': return a != b;
+    case '>': return a > b;
+    default:  return a < b;
+   }
+}
+
+// Fold an expression (a binary, relational, read or constant)
+// - reads of variables known in env are replaced (env may be NULL)
+// - returns the expression, or a new node if anything changed;
+//   a relational expression that folds becomes an int constant 1
+//   or 0, for foldCondition() to act on
+static ASTNode* foldExpr(ASTNode* node, ConstEnv* env)
+{
+   ASTNode *left, *right;
+   ConstVar* v;
+   int a, b;
+   switch (node->type) {
+    case AST_VARREF:
+       if (node->varKind == V_GLARRAY)
+          return withChildren(node, foldExpr(node->child[0], env), 0);
+       if (env && (v = findConst(env, node->name, node->varKind == V_GLOBAL)))
+          return intConst(v->value);
+       return node;
+    case AST_EXPRESSION:
+    case AST_RELEXPR:
+       left = foldExpr(node->child[0], env);
+       right = foldExpr(node->child[1], env);
+       if (isIntConst(left) && isIntConst(right)) {
+          a = left->ival;
+          b = right->ival;
+          if (node->type == AST_RELEXPR)
+             return intConst(relHolds(node->ival, a, b));
+          return intConst(node->ival == '+' ? (int) ((unsigned) a + (unsigned) b)
+                                            : (int) ((unsigned) a - (unsigned) b));
+       }
+       if (node->type == AST_EXPRESSION) {
+          if (isIntConst(right) && right->ival == 0)
+             return left;                 // x + 0, x - 0
+          if (node->ival == '+' && isIntConst(left) && left->ival == 0)
+             return right;                // 0 + x
+          if (node->ival == '-' && left == right)
+             return intConst(0);          // x - x (same shared node)
+       }
+       return withChildren(node, left, right);
+    default:
+       return node;
+   }
+}
+
+// Fold the statements of a list, in order
+static void foldStatements(ASTNode** list, ConstEnv* env);
+
+// Fold an if or while condition, leaving its folded form in place;
+// returns 1 or 0 if it is constant, else -1
+// - a while whose condition is constant and true keeps the constant
+//   as its condition, and code generation makes it a plain loop
+static int foldCondition(ASTNode* node, ConstEnv* env)
+{
+   ASTNode* cond = foldExpr(node->child[0], env);
+   node->child[0] = cond;
+   return isIntConst(cond) ? cond->ival != 0 : -1;
+}
+
+// Replace the statement at *link by a list (possibly empty) of
+// statements, keeping what followed it
+static void spliceStatements(ASTNode** link, ASTNode* stmts)
+{
+   ASTNode* last = stmts;
+   if (!stmts) {
+      *link = (*link)->next;
+      return;
+   }
+   while (last->next)
+      last = last->next;
+   last->next = (*link)->next;
+   *link = stmts;
+}
+
+static void foldStatements(ASTNode** list, ConstEnv* env)
+{
+   ConstEnv other = { 0, 0, 0 };
+   ASTNode *node, *arg;
+   int cond;
+   while ((node = *list)) {
+      switch (node->type) {
+       case AST_ASSIGNMENT:
+          node->child[0] = foldExpr(node->child[0], env);
+          if (node->varKind == V_GLARRAY)
+             node->child[1] = foldExpr(node->child[1], env);
+          else if (env && isIntConst(node->child[0]))
+             setConst(env, node->name, node->varKind == V_GLOBAL, node->child[0]->ival);
+          else if (env)
+             killConst(env, node->name, node->varKind == V_GLOBAL);
+          break;
+       case AST_FUNCALL:
+          for (arg = node->child[0]; arg; arg = arg->next)
+             arg->child[0] = foldExpr(arg->child[0], env);
+          if (env)
+             killConst(env, 0, 1); // the callee may change any global
+          break;
+       case AST_IFTHEN:
+          cond = foldCondition(node, env);
+          if (cond >= 0) {
+             // only one part runs: put it in place of the if, and go
+             // on with its first statement
+             spliceStatements(list, node->child[cond ? 1 : 2]);
+             continue;
+          }
+          if (env)
+             copyConsts(&other, env);
+          foldStatements(&node->child[1], env);
+          foldStatements(&node->child[2], env ? &other : 0);
+          if (env)
+             meetConsts(env, &other);
+          break;
+       case AST_WHILE:
+          if (env)
+             killAssigned(env, node->child[1]);
+          cond = foldCondition(node, env);
+          if (cond == 0) {
+             spliceStatements(list, 0); // the body never runs
+             continue;
+          }
+          if (env)
+             copyConsts(&other, env);
+          foldStatements(&node->child[1], env ? &other : 0);
+          break;
+       default:
+          break;
+      }
+      list = &node->next;
+   }
+   free(other.vars);
+}
+
+// Fold the statements of every function and the program
+static void foldBodies(ASTNode* tree, int propagate)
+{
+   ConstEnv env = { 0, 0, 0 };
+   ASTNode* node;
+   for (node = tree->child[1]; node; node = node->next) {
+      env.num = 0;
+      foldStatements(&node->child[1], propagate ? &env : 0);
+   }
+   // the program starts with every int global 0 (they are .word 0)
+   env.num = 0;
+   for (node = tree->child[0]; node; node = node->next)
+      if (node->varKind == V_GLOBAL && node->valType == T_INT)
+         setConst(&env, node->name, 1, 0);
+   foldStatements(&tree->child[2], propagate ? &env : 0);
+   free(env.vars);
+}
+
+static void propagateConstants(ASTNode* tree)
+{
+   foldBodies(tree, 1);
+}
+
+static void foldConstants(ASTNode* tree)
+{
+   foldBodies(tree, 0);
+}
+
+//
+// IR passes
+//
+
+static void enterSSA(IRFunc* fn, IRPassEnv* env)
+{
+   buildSSA(fn);
+}
+
+static void sccpPass(IRFunc* fn, IRPassEnv* env)
+{
+   propagateIRConstants(fn, env->globals);
+}
+
+static void dcePass(IRFunc* fn, IRPassEnv* env)
+{
+   int removed = eliminateDeadCode(fn);
+   if (env->report)
+      fprintf(env->report, "dce: %s: %d instructions removed\n",
+              fn->name ? atomName(fn->name) : "program", removed);
+}
+
+// Runs after the other IR passes, since the locals that invariants
+// go into live across the loops
+static void licmPass(IRFunc* fn, IRPassEnv* env)
+{
+   hoistLoopInvariants(fn, env->slotRoom(fn));
+}
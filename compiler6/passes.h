@@ -0,0 +1,43 @@
+//
+// Pass Manager Interface
+// - optimization passes run between parsing and code generation;
+//   each one is registered (in passes.c) with a name, a function
+//   and the lowest -O level whose pipeline includes it
+// - -O0 runs no passes, -O1 runs the level 1 passes, and -O2 runs
+//   the level 1 and level 2 passes, in registration order
+// - any single pass can be switched off (or on) by name, and the
+//   manager keeps the wall time and node count change of every run
+// - code generator options (such as register allocation) are
+//   registered and switched the same way, see passEnabled()
+// - IR passes run over each body as the code generator lowers it to
+//   the IR (runIRPasses()); their change is counted in IR
+//   instructions
+//
+#ifndef PASSES_H
+#define PASSES_H
+
+#include <stdio.h>
+#include "astree.h"
+#include "ir.h"
+#include "iropt.h"
+
+#define MAXOPTLEVEL 2
+
+// What the IR passes may need besides the body itself
+typedef struct {
+   IRGlobals* globals; // globals known program-wide (iropt.h), or NULL
+   int (*slotRoom)(IRFunc* fn); // how many more frame slots the body
+                                // can take as a frameless leaf
+   FILE* report;       // where passes report what they did, or NULL
+} IRPassEnv;
+
+void setOptLevel(int level);
+int getOptLevel();
+int setPassEnabled(const char* name, int enabled);
+int passEnabled(const char* name);
+void runPasses(ASTNode* tree);
+void runIRPasses(IRFunc* fn, IRPassEnv* env);
+void printPassStats(FILE* out);
+void listPasses(FILE* out);
+
+#endif
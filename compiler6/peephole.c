@@ -0,0 +1,418 @@
+//
+// Peephole Optimizer Module
+// - see peephole.h; the stream is a glibc cookie stream (fopencookie),
+//   so the code generator can keep writing with fprintf()
+// - rules are written as assembly text: an instruction "op a, b" or
+//   a label "name:", where an operand (or label name) %1..%9 matches
+//   any text, the same text everywhere it appears in the rule, and
+//   different variables never match the same text
+// - a rule may also have a check function, for conditions that the
+//   patterns cannot say
+//
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "peephole.h"
+
+#define WINDOW 8       // instructions and labels held for matching
+#define MAXQUEUE 64    // lines held (comments included)
+#define MAXLINE 256    // longer lines are passed straight through
+#define MAXARGS 3
+#define ARGLEN 48
+#define MAXPAT 5
+#define MAXVARS 10
+
+// kinds of lines
+enum { L_INSTR, L_LABEL, L_COMMENT, L_BARRIER };
+
+typedef struct {
+   char kind;
+   char op[16];                 // instruction name, or label name
+   int nargs;
+   char args[MAXARGS][ARGLEN];
+   char text[MAXLINE];          // the line as written, no newline
+} AsmLine;
+
+typedef char RuleVars[MAXVARS][ARGLEN];
+
+typedef struct {
+   const char* name;
+   const char* match[MAXPAT+1];     // NULL terminated
+   const char* replace[MAXPAT+1];
+   int (*check)(RuleVars vars);
+   unsigned long fired;
+   AsmLine pat[MAXPAT], rep[MAXPAT]; // parsed on first use
+   int numPat, numRep;
+} PeepRule;
+
+// Is memory operand %2 free of sp and of register %3? (a load
+// from it can move above a write to %3, and past a pop)
+static int loadMovesUp(RuleVars vars)
+{
+   return !strstr(vars[2], "sp") && !strstr(vars[2], vars[3]);
+}
+
+// The rules, tried in order (longer ones first)
+static PeepRule rules[] = {
+   { "push-li-pop",
+     { "addi sp, sp, -4", "sw %1, 0(sp)", "li %1, %2", "lw %3, 0(sp)", "addi sp, sp, 4" },
+     { "mv %3, %1", "li %1, %2" }, 0 },
+   { "push-la-pop",
+     { "addi sp, sp, -4", "sw %1, 0(sp)", "la %1, %2", "lw %3, 0(sp)", "addi sp, sp, 4" },
+     { "mv %3, %1", "la %1, %2" }, 0 },
+   { "push-lw-pop",
+     { "addi sp, sp, -4", "sw %1, 0(sp)", "lw %1, %2", "lw %3, 0(sp)", "addi sp, sp, 4" },
+     { "mv %3, %1", "lw %1, %2" }, loadMovesUp },
+   { "push-pop",
+     { "addi sp, sp, -4", "sw %1, 0(sp)", "lw %2, 0(sp)", "addi sp, sp, 4" },
+     { "mv %2, %1" }, 0 },
+   { "push-pop-same",
+     { "addi sp, sp, -4", "sw %1, 0(sp)", "lw %1, 0(sp)", "addi sp, sp, 4" },
+     { 0 }, 0 },
+   { "sp-pair",
+     { "addi sp, sp, -4", "addi sp, sp, 4" },
+     { 0 }, 0 },
+   { "sp-pair2",
+     { "addi sp, sp, 4", "addi sp, sp, -4" },
+     { 0 }, 0 },
+   { "store-load",
+     { "sw %1, %2", "lw %1, %2" },
+     { "sw %1, %2" }, 0 },
+   { "store-load-mv",
+     { "sw %1, %2", "lw %3, %2" },
+     { "sw %1, %2", "mv %3, %1" }, 0 },
+   { "gstore-load",
+     { "sw %1, %2, %3", "lw %1, %2" },
+     { "sw %1, %2, %3" }, 0 },
+   { "gstore-load-mv",
+     { "sw %1, %2, %3", "lw %4, %2" },
+     { "sw %1, %2, %3", "mv %4, %1" }, 0 },
+   { "mv-back",
+     { "mv %1, %2", "mv %2, %1" },
+     { "mv %1, %2" }, 0 },
+   { "mv-self",
+     { "mv %1, %1" },
+     { 0 }, 0 },
+   { "branch-next",
+     { "b %1", "%1:" },
+     { "%1:" }, 0 },
+   { "branch-over-label",
+     { "b %1", "%2:", "%1:" },
+     { "%2:", "%1:" }, 0 },
+};
+#define NUMRULES (sizeof(rules) / sizeof(rules[0]))
+
+// Peephole stream state
+typedef struct {
+   FILE* out;
+   AsmLine queue[MAXQUEUE];
+   int len;          // lines in the queue
+   int held;         // instructions and labels among them
+   char* partial;    // text of a line not yet ended
+   size_t partialLen, partialCap;
+} Peephole;
+
+// Parse the line of assembly in line->text (without its newline)
+// - returns 0 if the line could not be parsed as its kind
+static int parseLine(AsmLine* line)
+{
+   const char *p, *end, *text = line->text;
+   size_t n;
+   int i;
+   line->nargs = 0;
+   line->op[0] = '\0';
+   if (text[0] == '\0' || text[0] == '#' || (text[0] == '\t' && text[1] == '#')) {
+      line->kind = L_COMMENT;
+      return 1;
+   }
+   if (text[0] != '\t') {
+      n = strlen(text);
+      line->kind = L_BARRIER;
+      if (n < 2 || n >= sizeof(line->op) || text[n-1] != ':' || strpbrk(text, " \t"))
+         return 1;
+      line->kind = L_LABEL;
+      memcpy(line->op, text, n-1);
+      line->op[n-1] = '\0';
+      return 1;
+   }
+   line->kind = L_BARRIER;
+   if (text[1] == '.')
+      return 1;   // a directive
+   p = text + 1;
+   n = strcspn(p, " \t");
+   if (n == 0 || n >= sizeof(line->op))
+      return 0;
+   memcpy(line->op, p, n);
+   line->op[n] = '\0';
+   p += n;
+   while (*p == ' ' || *p == '\t')
+      p++;
+   for (i=0; *p; i++) {
+      if (i == MAXARGS)
+         return 0;
+      end = strchr(p, ',');
+      n = end ? (size_t) (end - p) : strlen(p);
+      while (n > 0 && (p[n-1] == ' ' || p[n-1] == '\t'))
+         n--;
+      if (n == 0 || n >= ARGLEN)
+         return 0;
+      memcpy(line->args[i], p, n);
+      line->args[i][n] = '\0';
+      p = end ? end + 1 : p + strlen(p);
+      while (*p == ' ')
+         p++;
+   }
+   line->nargs = i;
+   line->kind = L_INSTR;
+   return 1;
+}
+
+// Make a pattern line from rule text ("op a, b" or "name:")
+static void parsePattern(AsmLine* line, const char* pattern)
+{
+   if (pattern[strlen(pattern)-1] == ':')
+      strcpy(line->text, pattern);
+   else
+      snprintf(line->text, MAXLINE, "\t%s", pattern);
+   parseLine(line);
+}
+
+static void initRules()
+{
+   static int done = 0;
+   unsigned int r;
+   int i;
+   if (done)
+      return;
+   for (r=0; r < NUMRULES; r++) {
+      for (i=0; rules[r].match[i]; i++)
+         parsePattern(&rules[r].pat[i], rules[r].match[i]);
+      rules[r].numPat = i;
+      for (i=0; rules[r].replace[i]; i++)
+         parsePattern(&rules[r].rep[i], rules[r].replace[i]);
+      rules[r].numRep = i;
+   }
+   done = 1;
+}
+
+// Variable number of a pattern operand (%1..%9), or -1
+static int patternVar(const char* arg)
+{
+   return arg[0] == '%' && arg[1] >= '1' && arg[1] <= '9' && !arg[2] ? arg[1] - '0' : -1;
+}
+
+// Match one operand against a pattern operand, binding variables
+static int matchArg(const char* pat, const char* arg, RuleVars vars, int* bound)
+{
+   int v = patternVar(pat), i;
+   if (v < 0)
+      return !strcmp(pat, arg);
+   if (*bound & (1 << v))
+      return !strcmp(vars[v], arg);
+   for (i=1; i < MAXVARS; i++)
+      if ((*bound & (1 << i)) && !strcmp(vars[i], arg))
+         return 0;
+   strcpy(vars[v], arg);
+   *bound |= 1 << v;
+   return 1;
+}
+
+static int matchLine(AsmLine* pat, AsmLine* line, RuleVars vars, int* bound)
+{
+   int i;
+   if (pat->kind != line->kind)
+      return 0;
+   if (pat->kind == L_LABEL)
+      return matchArg(pat->op, line->op, vars, bound);
+   if (strcmp(pat->op, line->op) || pat->nargs != line->nargs)
+      return 0;
+   for (i=0; i < pat->nargs; i++)
+      if (!matchArg(pat->args[i], line->args[i], vars, bound))
+         return 0;
+   return 1;
+}
+
+// Fill in a replacement line from its pattern and the variables
+static void buildLine(AsmLine* line, AsmLine* pat, RuleVars vars)
+{
+   const char* arg;
+   int i, v;
+   *line = *pat;
+   if (pat->kind == L_LABEL) {
+      v = patternVar(pat->op);
+      if (v > 0)
+         strcpy(line->op, vars[v]);
+      snprintf(line->text, MAXLINE, "%s:", line->op);
+      return;
+   }
+   snprintf(line->text, MAXLINE, "\t%s", line->op);
+   for (i=0; i < pat->nargs; i++) {
+      v = patternVar(pat->args[i]);
+      arg = v > 0 ? vars[v] : pat->args[i];
+      strcpy(line->args[i], arg);
+      strcat(line->text, i ? ", " : "\t");
+      strcat(line->text, arg);
+   }
+}
+
+// Try each rule on the newest instructions and labels; apply the
+// first that matches; returns 1 if one did
+static int applyRule(Peephole* ph)
+{
+   int at[MAXPAT], n, i, j, k, bound;
+   AsmLine rep[MAXPAT];
+   RuleVars vars;
+   PeepRule* rule;
+   unsigned int r;
+   for (r=0; r < NUMRULES; r++) {
+      rule = &rules[r];
+      // the newest numPat instructions and labels, oldest first
+      for (n=0, i=ph->len-1; i >= 0 && n < rule->numPat; i--) {
+         if (ph->queue[i].kind == L_BARRIER)
+            break;
+         if (ph->queue[i].kind != L_COMMENT)
+            at[rule->numPat-1 - n++] = i;
+      }
+      if (n < rule->numPat)
+         continue;
+      bound = 0;
+      for (i=0; i < n; i++)
+         if (!matchLine(&rule->pat[i], &ph->queue[at[i]], vars, &bound))
+            break;
+      if (i < n || (rule->check && !rule->check(vars)))
+         continue;
+      for (i=0; i < rule->numRep; i++)
+         buildLine(&rep[i], &rule->rep[i], vars);
+      // drop the matched lines, keeping the comments between them,
+      // and put the replacement where the first one was
+      for (i=at[0], j=at[0], k=0; i < ph->len; i++) {
+         if (k < n && i == at[k]) {
+            k++;
+            continue;
+         }
+         ph->queue[j++] = ph->queue[i];
+      }
+      ph->len = j;
+      memmove(&ph->queue[at[0] + rule->numRep], &ph->queue[at[0]],
+              (ph->len - at[0]) * sizeof(AsmLine));
+      memcpy(&ph->queue[at[0]], rep, rule->numRep * sizeof(AsmLine));
+      ph->len += rule->numRep;
+      ph->held += rule->numRep - n;
+      rule->fired++;
+      return 1;
+   }
+   return 0;
+}
+
+// Write out the oldest line
+static void flushLine(Peephole* ph)
+{
+   fputs(ph->queue[0].text, ph->out);
+   fputc('\n', ph->out);
+   if (ph->queue[0].kind == L_INSTR || ph->queue[0].kind == L_LABEL)
+      ph->held--;
+   ph->len--;
+   memmove(&ph->queue[0], &ph->queue[1], ph->len * sizeof(AsmLine));
+}
+
+static void flushAll(Peephole* ph)
+{
+   while (ph->len > 0)
+      flushLine(ph);
+}
+
+// Take in one complete line
+static void addLine(Peephole* ph, const char* text, size_t len)
+{
+   AsmLine* line;
+   if (len >= MAXLINE) {
+      flushAll(ph);
+      fwrite(text, 1, len, ph->out);
+      fputc('\n', ph->out);
+      return;
+   }
+   if (ph->len == MAXQUEUE)
+      flushLine(ph);
+   line = &ph->queue[ph->len];
+   memcpy(line->text, text, len);
+   line->text[len] = '\0';
+   if (!parseLine(line))
+      line->kind = L_BARRIER;
+   ph->len++;
+   if (line->kind == L_BARRIER) {
+      flushAll(ph);
+      return;
+   }
+   if (line->kind == L_COMMENT)
+      return;
+   ph->held++;
+   while (applyRule(ph))
+      ;
+   while (ph->held > WINDOW)
+      flushLine(ph);
+}
+
+// Cookie stream write: split the text into lines
+static ssize_t peepholeWrite(void* cookie, const char* buf, size_t size)
+{
+   Peephole* ph = (Peephole*) cookie;
+   const char *p = buf, *nl, *end = buf + size;
+   size_t n;
+   while (p < end) {
+      nl = memchr(p, '\n', end - p);
+      n = nl ? (size_t) (nl - p) : (size_t) (end - p);
+      if (ph->partialLen + n > ph->partialCap) {
+         while (ph->partialLen + n > ph->partialCap)
+            ph->partialCap = ph->partialCap ? ph->partialCap * 2 : MAXLINE;
+         ph->partial = (char*) realloc(ph->partial, ph->partialCap);
+      }
+      memcpy(ph->partial + ph->partialLen, p, n);
+      ph->partialLen += n;
+      if (!nl)
+         break;
+      addLine(ph, ph->partial, ph->partialLen);
+      ph->partialLen = 0;
+      p = nl + 1;
+   }
+   return size;
+}
+
+static int peepholeClose(void* cookie)
+{
+   Peephole* ph = (Peephole*) cookie;
+   if (ph->partialLen)
+      addLine(ph, ph->partial, ph->partialLen);
+   flushAll(ph);
+   free(ph->partial);
+   free(ph);
+   return 0;
+}
+
+// Open a stream whose assembly goes through the optimizer to out
+// - returns NULL if the stream cannot be made
+FILE* openPeephole(FILE* out)
+{
+   cookie_io_functions_t io = { 0, peepholeWrite, 0, peepholeClose };
+   Peephole* ph = (Peephole*) calloc(1, sizeof(Peephole));
+   FILE* stream;
+   initRules();
+   ph->out = out;
+   stream = fopencookie(ph, "w", io);
+   if (!stream)
+      free(ph);
+   return stream;
+}
+
+// Print how many times each rule has fired
+void printPeepholeStats(FILE* out)
+{
+   unsigned long total = 0;
+   unsigned int r;
+   fprintf(out, "Peephole rules:\n");
+   for (r=0; r < NUMRULES; r++) {
+      fprintf(out, "  %-20s %10lu\n", rules[r].name, rules[r].fired);
+      total += rules[r].fired;
+   }
+   fprintf(out, "  %-20s %10lu\n", "total", total);
+}
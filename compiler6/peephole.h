@@ -0,0 +1,23 @@
+//
+// Peephole Optimizer Interface
+// - sits between the code generator and the output file: the code
+//   generator writes to the stream openPeephole() returns, and
+//   each line is parsed as an instruction, label, comment or
+//   directive and held in a small window; instructions leave the
+//   window (to the real output file) once newer ones push them out;
+//   fclose() the stream to flush the window (out is left open)
+// - each time an instruction or label enters the window, the rules
+//   (a table in peephole.c) are tried on the newest instructions;
+//   a rule that matches replaces them, and the rules are tried again
+// - labels and directives end a window (only a rule that names a
+//   label can match across one); comments do not
+//
+#ifndef PEEPHOLE_H
+#define PEEPHOLE_H
+
+#include <stdio.h>
+
+FILE* openPeephole(FILE* out);
+void printPeepholeStats(FILE* out);
+
+#endif
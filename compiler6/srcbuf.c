@@ -0,0 +1,100 @@
+//
+// Source Buffer Module
+// - maps a whole source file into memory for in-place scanning
+// - flex's yy_scan_buffer() needs two null bytes after the text, so
+//   the buffer is always size+2 bytes long with those two bytes zero
+// - flex also temporarily writes a null after each token it matches,
+//   so the mapping is private and writable; pages are only copied by
+//   the kernel when flex writes on them, never read() into user space
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "srcbuf.h"
+
+SourceBuffer srcBuf;
+
+// Read all of a (non-mappable) stream into a heap buffer
+// - used for stdin; grows the buffer by doubling
+static int readWholeStream(SourceBuffer* sb, FILE* in)
+{
+   size_t cap = 1 << 16, n;
+   char* buf = (char*) malloc(cap);
+   sb->size = 0;
+   while (buf && (n = fread(buf+sb->size, 1, cap-sb->size-2, in)) > 0) {
+      sb->size += n;
+      if (cap - sb->size - 2 == 0)
+         buf = (char*) realloc(buf, cap *= 2);
+   }
+   if (!buf)
+      return -1;
+   buf[sb->size] = buf[sb->size+1] = '\0';
+   sb->base = buf;
+   sb->mapSize = 0;
+   return 0;
+}
+
+// Open a source buffer on the given file (or stdin if filename is NULL)
+// - a file is mapped by first reserving size+2 bytes of zeroed
+//   anonymous memory and then mapping the file over the front of it,
+//   so the two trailing null bytes exist even when the file size is
+//   an exact multiple of the page size
+// - returns 0 on success, any other on failure
+int openSourceBuffer(SourceBuffer* sb, const char* filename)
+{
+   int fd;
+   struct stat st;
+   char* base;
+   if (!filename)
+      return readWholeStream(sb, stdin);
+   fd = open(filename, O_RDONLY);
+   if (fd < 0)
+      return -1;
+   if (fstat(fd, &st) < 0) {
+      close(fd);
+      return -1;
+   }
+   sb->size = st.st_size;
+   sb->mapSize = sb->size + 2;
+   base = mmap(0, sb->mapSize, PROT_READ|PROT_WRITE,
+               MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+   if (base != MAP_FAILED && sb->size > 0 &&
+       mmap(base, sb->size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_FIXED,
+            fd, 0) == MAP_FAILED) {
+      munmap(base, sb->mapSize);
+      base = MAP_FAILED;
+   }
+   close(fd);
+   if (base == MAP_FAILED)
+      return -1;
+   madvise(base, sb->mapSize, MADV_SEQUENTIAL);
+   sb->base = base;
+   return 0;
+}
+
+// Release the buffer; slices into it are invalid after this
+void closeSourceBuffer(SourceBuffer* sb)
+{
+   if (!sb->base)
+      return;
+   if (sb->mapSize)
+      munmap(sb->base, sb->mapSize);
+   else
+      free(sb->base);
+   sb->base = 0;
+   sb->size = sb->mapSize = 0;
+}
+
+// Make a null terminated heap copy of a slice of the current buffer
+// - for text that must outlive the buffer; caller frees it
+char* sliceStr(Slice s)
+{
+   char* str = (char*) malloc(s.len+1);
+   memcpy(str, slicePtr(s), s.len);
+   str[s.len] = '\0';
+   return str;
+}
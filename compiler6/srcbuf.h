@@ -0,0 +1,39 @@
+//
+// Source Buffer Interface
+// - holds the whole .j source text in one contiguous buffer so the
+//   scanner can work on it in place instead of reading through stdio
+// - a file is mmap'd; stdin (which cannot be mapped) is read into
+//   a heap buffer once
+// - tokens that carry text (IDs and strings) refer to it with a
+//   Slice (offset and length into the buffer), so nothing is copied
+//   until a name must outlive the buffer
+//
+#ifndef SRCBUF_H
+#define SRCBUF_H
+
+#include <stddef.h>
+
+// a piece of the source text: off is the byte offset from the start
+// of the buffer, len is the number of bytes
+typedef struct {
+   unsigned int off;
+   unsigned int len;
+} Slice;
+
+typedef struct {
+   char* base;     // start of the source text
+   size_t size;    // number of bytes of source text
+   size_t mapSize; // bytes mapped, or 0 if base is a heap buffer
+} SourceBuffer;
+
+// the buffer being compiled; slices always refer to this one
+extern SourceBuffer srcBuf;
+
+int openSourceBuffer(SourceBuffer* sb, const char* filename);
+void closeSourceBuffer(SourceBuffer* sb);
+char* sliceStr(Slice s);
+
+// pointer to the first character of a slice (NOT null terminated)
+#define slicePtr(s) (srcBuf.base + (s).off)
+
+#endif
@@ -0,0 +1,664 @@
+//
+// SSA Form Module
+// - see ssa.h; the analyses here need the blocks' predecessor lists
+//   to be current (computeIRPreds())
+//
+#include <stdlib.h>
+#include <string.h>
+#include "ssa.h"
+
+//
+// Dominators
+//
+
+// Reachable blocks in reverse postorder, by an iterative depth first
+// search from the entry
+static void reversePostorder(IRFunc* fn, IRDom* dom)
+{
+   int* stack = (int*) malloc(fn->numBlocks * sizeof(int));
+   int* next = (int*) calloc(fn->numBlocks, sizeof(int)); // succ to visit
+   int top = 0, b, s, n = 0;
+   dom->order[0] = 0; // seen
+   stack[top++] = 0;
+   while (top > 0) {
+      b = stack[top-1];
+      if (next[b] < 2) {
+         s = fn->blocks[b].succ[next[b]++];
+         if (s >= 0 && dom->order[s] < 0) {
+            dom->order[s] = 0;
+            stack[top++] = s;
+         }
+         continue;
+      }
+      dom->rpo[n++] = b; // postorder for now
+      top--;
+   }
+   dom->numRPO = n;
+   for (b=0; b < n/2; b++) {
+      s = dom->rpo[b];
+      dom->rpo[b] = dom->rpo[n-1-b];
+      dom->rpo[n-1-b] = s;
+   }
+   for (b=0; b < n; b++)
+      dom->order[dom->rpo[b]] = b;
+   free(stack);
+   free(next);
+}
+
+// Nearest common dominator of a and b, going up the tree built so far
+static int intersect(IRDom* dom, int a, int b)
+{
+   while (a != b) {
+      while (dom->order[a] > dom->order[b])
+         a = dom->idom[a];
+      while (dom->order[b] > dom->order[a])
+         b = dom->idom[b];
+   }
+   return a;
+}
+
+static void addFrontier(IRDom* dom, int block, int f)
+{
+   int n = dom->numFrontier[block];
+   if (n > 0 && dom->frontier[block][n-1] == f)
+      return; // just added it, from another predecessor
+   if ((n & (n-1)) == 0) // grow at powers of two
+      dom->frontier[block] = (int*) realloc(dom->frontier[block], (n ? n*2 : 1) * sizeof(int));
+   dom->frontier[block][dom->numFrontier[block]++] = f;
+}
+
+// Dominator tree and dominance frontiers of fn's blocks
+// - the tree is refined over the blocks in reverse postorder until
+//   it stops changing, walking up from each predecessor to where
+//   they meet; a join block is in the frontier of every block on
+//   the way up from its predecessors to its dominator
+IRDom* computeDominators(IRFunc* fn)
+{
+   IRDom* dom = (IRDom*) calloc(1, sizeof(IRDom));
+   IRBlock* b;
+   int i, j, n, p, d, changed, runner;
+   n = dom->numBlocks = fn->numBlocks;
+   dom->idom = (int*) malloc(n * sizeof(int));
+   dom->rpo = (int*) malloc(n * sizeof(int));
+   dom->order = (int*) malloc(n * sizeof(int));
+   dom->frontier = (int**) calloc(n, sizeof(int*));
+   dom->numFrontier = (int*) calloc(n, sizeof(int));
+   for (i=0; i < n; i++)
+      dom->idom[i] = dom->order[i] = -1;
+   reversePostorder(fn, dom);
+   dom->idom[0] = 0;
+   do {
+      changed = 0;
+      for (i=1; i < dom->numRPO; i++) {
+         b = &fn->blocks[dom->rpo[i]];
+         d = -1;
+         for (j=0; j < b->numPreds; j++) {
+            p = b->preds[j];
+            if (dom->idom[p] < 0)
+               continue; // not done yet, or unreachable
+            d = d < 0 ? p : intersect(dom, p, d);
+         }
+         if (dom->idom[dom->rpo[i]] != d) {
+            dom->idom[dom->rpo[i]] = d;
+            changed = 1;
+         }
+      }
+   } while (changed);
+   for (i=0; i < dom->numRPO; i++) {
+      b = &fn->blocks[dom->rpo[i]];
+      if (b->numPreds < 2)
+         continue;
+      for (j=0; j < b->numPreds; j++) {
+         runner = b->preds[j];
+         if (dom->order[runner] < 0)
+            continue;
+         while (runner != dom->idom[dom->rpo[i]]) {
+            addFrontier(dom, runner, dom->rpo[i]);
+            runner = dom->idom[runner];
+         }
+      }
+   }
+   return dom;
+}
+
+// Does block a dominate block b?
+int irDominates(IRDom* dom, int a, int b)
+{
+   if (dom->idom[b] < 0)
+      return 0;
+   while (b != a && b != 0)
+      b = dom->idom[b];
+   return b == a;
+}
+
+void freeDominators(IRDom* dom)
+{
+   int i;
+   if (!dom)
+      return;
+   for (i=0; i < dom->numBlocks; i++)
+      free(dom->frontier[i]);
+   free(dom->frontier);
+   free(dom->numFrontier);
+   free(dom->idom);
+   free(dom->rpo);
+   free(dom->order);
+   free(dom);
+}
+
+//
+// Liveness
+//
+
+// Is var a parameter or local (or a version of one)?
+int isSSAVar(IRFunc* fn, int var)
+{
+   return fn->vars[var].kind != V_GLOBAL;
+}
+
+// Variables live into and out of each block
+// - a phi defines its variable at the top of its block, and its
+//   arguments are used at the end of the predecessors they come from
+// - solved backward, over the blocks in reverse layout order, until
+//   nothing changes
+IRLiveness* computeLiveness(IRFunc* fn)
+{
+   IRLiveness* lv = (IRLiveness*) calloc(1, sizeof(IRLiveness));
+   int w = lv->words = (fn->numVars + 31) / 32;
+   int n = lv->numBlocks = fn->numBlocks;
+   unsigned int *use, *def, *phiOut, *in, *out, x;
+   IRBlock* b;
+   IRInstr* in1;
+   int i, j, k, s, v, changed;
+   lv->in = (unsigned int*) calloc((size_t) n * w + 1, sizeof(unsigned int));
+   lv->out = (unsigned int*) calloc((size_t) n * w + 1, sizeof(unsigned int));
+   use = (unsigned int*) calloc((size_t) n * w + 1, sizeof(unsigned int));
+   def = (unsigned int*) calloc((size_t) n * w + 1, sizeof(unsigned int));
+   phiOut = (unsigned int*) calloc((size_t) n * w + 1, sizeof(unsigned int));
+   for (i=0; i < n; i++) {
+      b = &fn->blocks[i];
+      for (j=0; j < b->len; j++) {
+         in1 = &b->code[j];
+         v = irReadsVar(in1);
+         if (v >= 0 && isSSAVar(fn, v) && !IRSETHAS(def + i*w, v))
+            IRSETADD(use + i*w, v);
+         else if ((in1->op == IR_STORE || in1->op == IR_PHI) && isSSAVar(fn, in1->var))
+            IRSETADD(def + i*w, in1->var);
+         if (in1->op == IR_PHI)
+            for (k=0; k < in1->imm; k++)
+               IRSETADD(phiOut + in1->args[k].pred*w, in1->args[k].var);
+      }
+   }
+   do {
+      changed = 0;
+      for (i=n-1; i >= 0; i--) {
+         b = &fn->blocks[i];
+         in = lv->in + i*w;
+         out = lv->out + i*w;
+         for (k=0; k < w; k++) {
+            x = phiOut[i*w + k];
+            for (j=0; j < 2; j++) {
+               s = b->succ[j];
+               if (s >= 0)
+                  x |= lv->in[s*w + k];
+            }
+            out[k] = x;
+            x = use[i*w + k] | (x & ~def[i*w + k]);
+            if (x != in[k]) {
+               in[k] = x;
+               changed = 1;
+            }
+         }
+      }
+   } while (changed);
+   free(use);
+   free(def);
+   free(phiOut);
+   return lv;
+}
+
+void freeLiveness(IRLiveness* lv)
+{
+   if (!lv)
+      return;
+   free(lv->in);
+   free(lv->out);
+   free(lv);
+}
+
+//
+// Into SSA form
+//
+
+// Put a phi for variable var at the top of block, with an argument
+// for each predecessor
+static void placePhi(IRFunc* fn, int block, int var)
+{
+   IRBlock* b = &fn->blocks[block];
+   IRInstr* phi = insertIRInstr(fn, block, 0, IR_PHI);
+   int k;
+   phi->var = var;
+   phi->imm = b->numPreds;
+   phi->args = (IRPhiArg*) malloc((b->numPreds + 1) * sizeof(IRPhiArg));
+   for (k=0; k < b->numPreds; k++) {
+      phi->args[k].pred = b->preds[k];
+      phi->args[k].var = var; // until renamed
+   }
+}
+
+// Place phis: for each parameter and local, at the iterated
+// dominance frontier of the blocks that assign it, where it is live
+static void placePhis(IRFunc* fn, IRDom* dom, IRLiveness* lv)
+{
+   int numVars = fn->numVars, n = fn->numBlocks;
+   int* hasPhi = (int*) malloc(n * sizeof(int));   // var+1 that has one
+   int* queued = (int*) malloc(n * sizeof(int));   // var+1 queued for
+   int* work = (int*) malloc(n * sizeof(int));
+   int v, i, j, top, x, y;
+   IRBlock* b;
+   for (i=0; i < n; i++)
+      hasPhi[i] = queued[i] = 0;
+   for (v=0; v < numVars; v++) {
+      if (!isSSAVar(fn, v))
+         continue;
+      top = 0;
+      for (i=0; i < n; i++) {
+         b = &fn->blocks[i];
+         for (j=0; j < b->len; j++)
+            if (b->code[j].op == IR_STORE && b->code[j].var == v)
+               break;
+         if (j < b->len && dom->order[i] >= 0) {
+            queued[i] = v+1;
+            work[top++] = i;
+         }
+      }
+      while (top > 0) {
+         x = work[--top];
+         for (j=0; j < dom->numFrontier[x]; j++) {
+            y = dom->frontier[x][j];
+            if (hasPhi[y] == v+1 || !IRSETHAS(lv->in + y*lv->words, v))
+               continue;
+            placePhi(fn, y, v);
+            hasPhi[y] = v+1;
+            if (queued[y] != v+1) {
+               queued[y] = v+1;
+               work[top++] = y;
+            }
+         }
+      }
+   }
+   free(hasPhi);
+   free(queued);
+   free(work);
+}
+
+// Rename variables to versions, down the dominator tree
+// - cur[v] is the version of v reaching the point renamed; a block
+//   logs what it changed, and the log is undone when its subtree
+//   is done
+static void renameVars(IRFunc* fn, IRDom* dom)
+{
+   int numVars = fn->numVars, n = fn->numBlocks;
+   int* cur = (int*) malloc(numVars * sizeof(int));
+   int* child = (int*) malloc(n * sizeof(int));   // first child
+   int* sibling = (int*) malloc(n * sizeof(int));
+   int* stack = (int*) malloc(n * sizeof(int));
+   int* logMark = (int*) malloc(n * sizeof(int)); // log length at entry
+   int *logVar = 0, *logOld = 0;
+   int logLen = 0, logCap = 0, top = 0;
+   int i, j, k, s, v, b, orig;
+   IRBlock* blk;
+   IRInstr* in;
+   for (v=0; v < numVars; v++)
+      cur[v] = v;
+   for (i=0; i < n; i++)
+      child[i] = sibling[i] = -1;
+   for (i=dom->numRPO-1; i > 0; i--) {
+      b = dom->rpo[i];
+      sibling[b] = child[dom->idom[b]];
+      child[dom->idom[b]] = b;
+   }
+   stack[top++] = 0;
+   logMark[0] = -1;
+   while (top > 0) {
+      b = stack[top-1];
+      if (logMark[b] >= 0) { // subtree done: undo its versions
+         while (logLen > logMark[b]) {
+            logLen--;
+            cur[logVar[logLen]] = logOld[logLen];
+         }
+         top--;
+         continue;
+      }
+      logMark[b] = logLen;
+      blk = &fn->blocks[b];
+      for (j=0; j < blk->len; j++) {
+         in = &blk->code[j];
+         if ((in->op != IR_LOAD && in->op != IR_STORE && in->op != IR_PHI) ||
+             !isSSAVar(fn, in->var))
+            continue;
+         if (in->op == IR_LOAD) {
+            in->var = cur[in->var];
+            continue;
+         }
+         if (logLen == logCap) {
+            logCap = logCap ? logCap * 2 : 64;
+            logVar = (int*) realloc(logVar, logCap * sizeof(int));
+            logOld = (int*) realloc(logOld, logCap * sizeof(int));
+         }
+         logVar[logLen] = in->var;
+         logOld[logLen++] = cur[in->var];
+         cur[in->var] = newIRVar(fn, in->var);
+         in->var = cur[in->var];
+      }
+      for (i=0; i < 2; i++) {
+         s = blk->succ[i];
+         if (s < 0 || (i == 1 && s == blk->succ[0]))
+            continue;
+         for (j=0; j < fn->blocks[s].len && fn->blocks[s].code[j].op == IR_PHI; j++) {
+            in = &fn->blocks[s].code[j];
+            orig = fn->vars[in->var].orig;
+            for (k=0; k < in->imm; k++)
+               if (in->args[k].pred == b)
+                  in->args[k].var = cur[orig];
+         }
+      }
+      for (s=child[b]; s >= 0; s = sibling[s]) {
+         logMark[s] = -1;
+         stack[top++] = s;
+      }
+   }
+   free(cur);
+   free(child);
+   free(sibling);
+   free(stack);
+   free(logMark);
+   free(logVar);
+   free(logOld);
+}
+
+// Put fn into SSA form
+void buildSSA(IRFunc* fn)
+{
+   IRDom* dom;
+   IRLiveness* lv;
+   computeIRPreds(fn);
+   dom = computeDominators(fn);
+   lv = computeLiveness(fn);
+   placePhis(fn, dom, lv);
+   freeLiveness(lv);
+   renameVars(fn, dom);
+   freeDominators(dom);
+}
+
+//
+// Out of SSA form
+//
+
+// Versions that are live at the same time, as a bit matrix, found
+// by walking each block backward from what is live out of it
+typedef struct {
+   int n, words;
+   unsigned int* bits;  // row v at bits + v*words
+} Interference;
+
+static void interfere(Interference* g, int a, int b)
+{
+   IRSETADD(g->bits + (size_t) a*g->words, b);
+   IRSETADD(g->bits + (size_t) b*g->words, a);
+}
+
+static void buildInterference(IRFunc* fn, IRLiveness* lv, Interference* g)
+{
+   unsigned int* live = (unsigned int*) malloc((lv->words + 1) * sizeof(unsigned int));
+   IRBlock* b;
+   IRInstr* in;
+   int i, j, k, w;
+   g->n = fn->numVars;
+   g->words = lv->words;
+   g->bits = (unsigned int*) calloc((size_t) g->n * g->words + 1, sizeof(unsigned int));
+   for (i=0; i < fn->numBlocks; i++) {
+      b = &fn->blocks[i];
+      memcpy(live, lv->out + i*lv->words, lv->words * sizeof(unsigned int));
+      for (j=b->len-1; j >= 0; j--) {
+         in = &b->code[j];
+         if (in->op == IR_LOAD && isSSAVar(fn, in->var)) {
+            IRSETADD(live, in->var);
+         } else if ((in->op == IR_STORE || in->op == IR_PHI) && isSSAVar(fn, in->var)) {
+            for (k=0; k < lv->words; k++)
+               if (live[k])
+                  for (w=0; w < 32; w++)
+                     if (((live[k] >> w) & 1) && k*32+w != in->var)
+                        interfere(g, in->var, k*32+w);
+            IRSETDEL(live, in->var);
+         }
+      }
+   }
+   free(live);
+}
+
+// Webs of versions that will share a variable: union-find sets,
+// each with a circular list of its members, whose root's row of
+// the matrix is what any member interferes with
+typedef struct {
+   int* parent;
+   int* next;
+   int* storage;   // a root's variable, or -1 if not picked yet
+} Webs;
+
+static int findWeb(Webs* webs, int v)
+{
+   while (webs->parent[v] != v)
+      v = webs->parent[v] = webs->parent[webs->parent[v]];
+   return v;
+}
+
+// Join the webs of a and b unless they interfere; returns if joined
+static int joinWebs(Webs* webs, Interference* g, int a, int b)
+{
+   unsigned int *ra, *rb;
+   int m, k;
+   a = findWeb(webs, a);
+   b = findWeb(webs, b);
+   if (a == b)
+      return 1;
+   ra = g->bits + (size_t) a*g->words;
+   m = b;
+   do {
+      if (IRSETHAS(ra, m))
+         return 0;
+      m = webs->next[m];
+   } while (m != b);
+   rb = g->bits + (size_t) b*g->words;
+   for (k=0; k < g->words; k++)
+      ra[k] |= rb[k];
+   webs->parent[b] = a;
+   m = webs->next[a];
+   webs->next[a] = webs->next[b];
+   webs->next[b] = m;
+   if (webs->storage[a] < 0)
+      webs->storage[a] = webs->storage[b];
+   return 1;
+}
+
+// Give each web a variable to live in: the variable its versions
+// come from, when the web can join that variable's web, and a new
+// frame slot otherwise
+static void pickStorage(IRFunc* fn, Interference* g, Webs* webs)
+{
+   IRBlock* b;
+   IRInstr* in;
+   int i, j, k, n = g->n, r, orig;
+   webs->parent = (int*) malloc(n * sizeof(int));
+   webs->next = (int*) malloc(n * sizeof(int));
+   webs->storage = (int*) malloc(n * sizeof(int));
+   for (i=0; i < n; i++) {
+      webs->parent[i] = webs->next[i] = i;
+      webs->storage[i] = isSSAVar(fn, i) && fn->vars[i].version == 0 ? i : -1;
+   }
+   for (i=0; i < fn->numBlocks; i++) {
+      b = &fn->blocks[i];
+      for (j=0; j < b->len && b->code[j].op == IR_PHI; j++) {
+         in = &b->code[j];
+         for (k=0; k < in->imm; k++)
+            joinWebs(webs, g, in->var, in->args[k].var);
+      }
+   }
+   for (i=0; i < n; i++) {
+      r = findWeb(webs, i);
+      if (!isSSAVar(fn, i) || webs->storage[r] >= 0)
+         continue;
+      orig = fn->vars[i].orig;
+      if (webs->storage[findWeb(webs, orig)] == orig && joinWebs(webs, g, orig, i))
+         continue;
+      webs->storage[r] = newIRSlot(fn, orig);
+   }
+}
+
+// Variable a version lives in
+static int storageOf(IRFunc* fn, Webs* webs, int n, int var)
+{
+   if (var >= n || !isSSAVar(fn, var))
+      return var;
+   return webs->storage[findWeb(webs, var)];
+}
+
+// Copy variable src to dst with two instructions, before instruction
+// at of block; returns the position after them
+static int insertCopy(IRFunc* fn, int block, int at, int dst, int src)
+{
+   IRInstr* in = insertIRInstr(fn, block, at, IR_LOAD);
+   in->dst = ++fn->numTemps;
+   in->var = src;
+   in = insertIRInstr(fn, block, at+1, IR_STORE);
+   in->a.kind = IV_TEMP;
+   in->a.val = fn->numTemps;
+   in->var = dst;
+   return at+2;
+}
+
+// Do the parallel copies dst[i] = src[i] (distinct dsts) one at a
+// time, before instruction at of block
+// - a copy is safe once no other copy still to be done reads its
+//   destination; when none is, the rest are cycles, and one of them
+//   is broken by saving a destination in *spare (made if need be)
+static void sequentialize(IRFunc* fn, int block, int at, int* dst, int* src,
+                          int n, int* spare)
+{
+   int i, j, done = 0, ready;
+   while (done < n) {
+      ready = -1;
+      for (i=0; i < n && ready < 0; i++) {
+         if (dst[i] < 0)
+            continue;
+         for (j=0; j < n; j++)
+            if (j != i && dst[j] >= 0 && src[j] == dst[i])
+               break;
+         if (j == n)
+            ready = i;
+      }
+      if (ready < 0) { // all cycles: free the first one's destination
+         for (i=0; dst[i] < 0; i++)
+            ;
+         if (*spare < 0)
+            *spare = newIRSlot(fn, dst[i]);
+         at = insertCopy(fn, block, at, *spare, dst[i]);
+         for (j=0; j < n; j++)
+            if (dst[j] >= 0 && src[j] == dst[i])
+               src[j] = *spare;
+         continue;
+      }
+      at = insertCopy(fn, block, at, dst[ready], src[ready]);
+      dst[ready] = -1;
+      done++;
+   }
+}
+
+// Where the copies for the edge from pred into block go: the end of
+// pred (before its jump) if block is its only successor, and a new
+// block on the edge otherwise; the new block goes right after pred,
+// so *block may move
+static int copyPlace(IRFunc* fn, int pred, int* block, int* at)
+{
+   IRBlock* p = &fn->blocks[pred];
+   IRInstr* phi;
+   int split, j, k;
+   if (p->len == 0 || !irIsBranch(p->code[p->len-1].op)) {
+      *at = p->len > 0 && p->code[p->len-1].op == IR_JUMP ? p->len-1 : p->len;
+      return pred;
+   }
+   split = insertIRBlock(fn, pred+1);
+   if (*block >= split)
+      (*block)++;
+   p = &fn->blocks[pred];
+   for (j=0; j < 2; j++)
+      if (p->succ[j] == *block)
+         p->succ[j] = split;
+   fn->blocks[split].succ[0] = *block;
+   for (j=0; j < fn->blocks[*block].len; j++) {
+      phi = &fn->blocks[*block].code[j];
+      if (phi->op == IR_PHI)
+         for (k=0; k < phi->imm; k++)
+            if (phi->args[k].pred == pred)
+               phi->args[k].pred = split;
+   }
+   *at = 0;
+   return split;
+}
+
+// Take fn out of SSA form
+void leaveSSA(IRFunc* fn)
+{
+   IRLiveness* lv;
+   Interference g;
+   Webs webs;
+   IRBlock* b;
+   IRInstr* in;
+   int *dst, *src;
+   int i, j, k, n, numPhis, copies, pred, place, at, spare = -1;
+   computeIRPreds(fn);
+   lv = computeLiveness(fn);
+   buildInterference(fn, lv, &g);
+   freeLiveness(lv);
+   n = g.n;
+   pickStorage(fn, &g, &webs);
+   free(g.bits);
+   for (i=0; i < fn->numBlocks; i++) {
+      b = &fn->blocks[i];
+      for (numPhis=0; numPhis < b->len && b->code[numPhis].op == IR_PHI; numPhis++)
+         ;
+      if (numPhis == 0)
+         continue;
+      dst = (int*) malloc(numPhis * sizeof(int));
+      src = (int*) malloc(numPhis * sizeof(int));
+      for (k=0; k < fn->blocks[i].code[0].imm; k++) {
+         pred = fn->blocks[i].code[0].args[k].pred;
+         copies = 0;
+         for (j=0; j < numPhis; j++) {
+            in = &fn->blocks[i].code[j];
+            dst[copies] = storageOf(fn, &webs, n, in->var);
+            src[copies] = storageOf(fn, &webs, n, in->args[k].var);
+            if (dst[copies] != src[copies])
+               copies++;
+         }
+         if (copies == 0)
+            continue;
+         place = copyPlace(fn, pred, &i, &at);
+         sequentialize(fn, place, at, dst, src, copies, &spare);
+      }
+      free(dst);
+      free(src);
+      while (fn->blocks[i].len > 0 && fn->blocks[i].code[0].op == IR_PHI)
+         removeIRInstr(fn, i, 0);
+   }
+   for (i=0; i < fn->numBlocks; i++) {
+      b = &fn->blocks[i];
+      for (j=0; j < b->len; j++)
+         if (b->code[j].op == IR_LOAD || b->code[j].op == IR_STORE)
+            b->code[j].var = storageOf(fn, &webs, n, b->code[j].var);
+   }
+   free(webs.parent);
+   free(webs.next);
+   free(webs.storage);
+   computeIRPreds(fn);
+}
@@ -0,0 +1,54 @@
+//
+// SSA Form Interface
+// - dominators, by Cooper, Harvey and Kennedy's "A Simple, Fast
+//   Dominance Algorithm", dominance frontiers, and the liveness of
+//   an IR function's parameters and locals
+// - buildSSA() gives each parameter and local a new version (a
+//   variable of its own, see ir.h) at every assignment, with phis
+//   where versions meet, placed at the dominance frontiers of the
+//   assignments where the variable is live
+// - leaveSSA() puts the versions back into frame slots, sharing the
+//   variable's own slot wherever their lifetimes allow, and turns
+//   the phis into parallel copies on the incoming edges, done one
+//   at a time in an order that reads every source before it is
+//   overwritten
+// - globals are left alone: calls and array stores may change them
+//
+#ifndef SSA_H
+#define SSA_H
+
+#include "ir.h"
+
+typedef struct {
+   int numBlocks;
+   int* idom;         // immediate dominator of each block; the entry
+                      // is its own, and an unreachable block's is -1
+   int* rpo;          // the reachable blocks in reverse postorder
+   int numRPO;
+   int* order;        // each block's place in rpo, or -1
+   int** frontier;    // dominance frontier of each block
+   int* numFrontier;
+} IRDom;
+
+IRDom* computeDominators(IRFunc* fn);
+int irDominates(IRDom* dom, int a, int b);
+void freeDominators(IRDom* dom);
+
+// Sets of variables are bit sets, words unsigned ints long
+#define IRSETHAS(set, v) (((set)[(v) >> 5] >> ((v) & 31)) & 1)
+#define IRSETADD(set, v) ((set)[(v) >> 5] |= 1u << ((v) & 31))
+#define IRSETDEL(set, v) ((set)[(v) >> 5] &= ~(1u << ((v) & 31)))
+
+typedef struct {
+   int numBlocks, words;
+   unsigned int* in;  // variables live into block b, at in + b*words
+   unsigned int* out; // and live out of it
+} IRLiveness;
+
+int isSSAVar(IRFunc* fn, int var);
+IRLiveness* computeLiveness(IRFunc* fn);
+void freeLiveness(IRLiveness* lv);
+void buildSSA(IRFunc* fn);
+void leaveSSA(IRFunc* fn);
+
+#endif
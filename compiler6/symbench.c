@@ -0,0 +1,81 @@
+//
+// Symbol Table Microbenchmark
+// - fills a symbol table with N globals and times findSymbol() for
+//   names that are in the table (hits) and names that are not (misses)
+// - N grows by 10x each round, so the output shows how lookup cost
+//   changes with table size (it should stay about flat), and how
+//   much arena memory the symbols take
+// - build with "make symbench", run as "./symbench [maxsymbols]"
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "atoms.h"
+#include "symtable.h"
+
+#define LOOKUPS 4000000
+
+static double now()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Time LOOKUPS lookups of names picked from atoms[0..n-1]
+// - returns nanoseconds per lookup; *found counts the hits
+static double timeLookups(SymbolTable* table, Atom* atoms, int n, long* found)
+{
+   unsigned int r = 12345;
+   double start;
+   long i;
+   *found = 0;
+   start = now();
+   for (i=0; i < LOOKUPS; i++) {
+      r = r * 1103515245 + 12345; // cheap LCG so the order is not sequential
+      if (findSymbol(table, atoms[(r >> 8) % n]))
+         (*found)++;
+   }
+   return (now() - start) * 1e9 / LOOKUPS;
+}
+
+int main(int argc, char* argv[])
+{
+   int maxSymbols = argc > 1 ? atoi(argv[1]) : 1000000;
+   char name[32];
+   Atom *names, *missing;
+   SymbolTable* table;
+   double tAdd, tHit, tMiss;
+   long hits, misses;
+   int n, i, len;
+   printf("%9s %9s %6s %10s %10s %10s %10s %7s\n", "symbols", "slots", "load",
+          "add ns", "hit ns", "miss ns", "sym bytes", "chunks");
+   for (n = 1000; n <= maxSymbols; n *= 10) {
+      names = (Atom*) malloc(n * sizeof(Atom));
+      missing = (Atom*) malloc(n * sizeof(Atom));
+      for (i=0; i < n; i++) {
+         len = sprintf(name, "var%d", i);
+         names[i] = internAtom(name, len);
+         len = sprintf(name, "nosuch%d", i);
+         missing[i] = internAtom(name, len);
+      }
+      table = newSymbolTable();
+      tAdd = now();
+      for (i=0; i < n; i++)
+         addSymbol(table, names[i], 0, T_INT, 0, 0, V_GLOBAL);
+      tAdd = (now() - tAdd) * 1e9 / n;
+      tHit = timeLookups(table, names, n, &hits);
+      tMiss = timeLookups(table, missing, n, &misses);
+      if (hits != LOOKUPS || misses != 0)
+         printf("Error: wrong lookup results (%ld hits, %ld misses found)\n",
+                hits, misses);
+      printf("%9d %9u %6.3f %10.1f %10.1f %10.1f %10lu %7u\n", n, table->size,
+             (double) table->used / table->size, tAdd, tHit, tMiss,
+             (unsigned long) symbolBytesUsed(table), symbolChunkCount(table));
+      freeSymbolTable(table);
+      free(names);
+      free(missing);
+   }
+   freeAtoms();
+   return 0;
+}
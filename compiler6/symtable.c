@@ -1,93 +1,247 @@
 //
 // Symbol Table Module
-// - the symbol table is implemented as a hash table that uses
-//   chaining (linked lists) to resolve collisions. Thus, each
-//   table entry is a pointer to a linked list of symbols that 
-//   hashed to that entry (index value).
+// - the symbol table is a hash table that uses open addressing
+//   with linear probing: each slot holds the most recent symbol
+//   with one name, plus the hash of that name (stored so that
+//   probing and growing never have to rehash a name)
+// - older symbols with the same name (shadowed by a declaration
+//   at a deeper scope level) hang off the slot's symbol through
+//   their next pointers, newest first
+// - the slot count is a power of two and doubles whenever the
+//   table gets half full, so probe sequences stay short
+// - deleting a slot uses backward-shift deletion (no tombstones)
+// - scopes nest: pushScope() starts one and popScope() ends it;
+//   every added symbol is appended to an undo log, so ending a
+//   scope only touches the symbols added since it started, and
+//   uncovers whatever symbols they shadowed
+// - symbols are allocated from an arena (see arena.h) for the scope
+//   level they are added at, so ending a scope frees its symbols a
+//   chunk at a time instead of one at a time
+// - compiling with -DSYMSTATS adds counters for lookups, probes,
+//   load factor and scope pops; printSymbolStats() reports them
 //
 #include <stdlib.h>
 #include <string.h>
+#ifdef SYMSTATS
+#include <time.h>
+#endif
 #include "symtable.h"
 
-// odd and especially prime values are best for hash tables
-#define TABLESIZE 97
+// initial number of slots; must be a power of two
+#define INITSIZE 64
+// initial undo log and scope stack sizes
+#define INITLOG 64
+#define INITLEVELS 8
+// arena chunk sizes for global symbols and for nested scopes
+#define GLOBALCHUNKSIZE 65536
+#define SCOPECHUNKSIZE 4096
+
+#ifdef SYMSTATS
+// load factor samples kept; when full, every other one is dropped
+// and the sampling interval doubles
+#define LOADSAMPLES 64
+
+struct symstats_s {
+   unsigned long finds, findProbes, adds, addProbes, redeclared;
+   unsigned int maxFindProbes, maxAddProbes, grows;
+   unsigned long pops;
+   double popSeconds, maxPopSeconds;
+   unsigned long ops, sampleEvery;  // finds+adds, interval of samples
+   unsigned int numSamples;
+   float load[LOADSAMPLES];         // sample i is at op (i+1)*sampleEvery
+};
+
+static unsigned int lastProbes; // slots looked at by the last findSlot()
+#define STAT(x) x
+#else
+#define STAT(x)
+#endif
 
 // Table hash function
-// - just adds up all chars in the string and then 
-//   mods by table size to get 0 to (size-1) index value
-static int hash(char *str)
+// - uses the atom's FNV-1a hash, which the atom table computed
+//   once when the name was interned
+static unsigned int hash(Atom name)
 {
-   int h = 0;
-   int i;
-   for (i=0; i < strlen(str); i++)
-      h += str[i];
-   h = h % TABLESIZE;
-   return h;
+   return atomHash(name);
 }
 
-// Create a new symbol table and return pointer to it
-// - each table entry will be a pointer to a linked list
-//   of symbols that hashed to that entry; a NULL entry
-//   means no symbols have yet hashed to that entry
-Symbol** newSymbolTable()
+// Find the slot that holds name, or the empty slot where name
+// would go if it is not in the table
+static SymbolSlot* findSlot(SymbolTable* table, Atom name, unsigned int h)
 {
-   int i;
-   Symbol** table; 
-   table = (Symbol**) malloc(sizeof(Symbol*)*TABLESIZE);
-   for (i=0; i < TABLESIZE; i++)
-      table[i] = 0;
+   unsigned int mask = table->size - 1;
+   unsigned int i = h & mask;
+   STAT(lastProbes = 1);
+   while (table->slots[i].sym) {
+      if (table->slots[i].hash == h && table->slots[i].sym->name == name)
+         break;
+      i = (i+1) & mask;
+      STAT(lastProbes++);
+   }
+   return &table->slots[i];
+}
+
+// Double the number of slots and reinsert every slot
+static void growTable(SymbolTable* table)
+{
+   SymbolSlot* old = table->slots;
+   unsigned int oldSize = table->size;
+   unsigned int i, j, mask;
+   table->size *= 2;
+   table->slots = (SymbolSlot*) calloc(table->size, sizeof(SymbolSlot));
+   mask = table->size - 1;
+   for (i=0; i < oldSize; i++) {
+      if (!old[i].sym)
+         continue;
+      for (j = old[i].hash & mask; table->slots[j].sym; j = (j+1) & mask)
+         ;
+      table->slots[j] = old[i];
+   }
+   free(old);
+}
+
+// Empty slot i, moving later slots of its probe run back so
+// that every remaining name can still be found
+static void deleteSlot(SymbolTable* table, unsigned int i)
+{
+   unsigned int mask = table->size - 1;
+   unsigned int j = i, home;
+   for (;;) {
+      j = (j+1) & mask;
+      if (!table->slots[j].sym)
+         break;
+      home = table->slots[j].hash & mask;
+      // leave slot j alone if its home is cyclically in (i,j]
+      if (i <= j ? (i < home && home <= j) : (i < home || home <= j))
+         continue;
+      table->slots[i] = table->slots[j];
+      i = j;
+   }
+   table->slots[i].sym = 0;
+   table->slots[i].hash = 0;
+   table->used--;
+}
+
+#ifdef SYMSTATS
+// Count a findSymbol() or addSymbol() call and sample the load
+// factor if one is due
+static void countOp(SymbolTable* table, int isAdd)
+{
+   struct symstats_s* st = table->stats;
+   unsigned int i;
+   if (isAdd) {
+      st->adds++;
+      st->addProbes += lastProbes;
+      if (lastProbes > st->maxAddProbes)
+         st->maxAddProbes = lastProbes;
+   } else {
+      st->finds++;
+      st->findProbes += lastProbes;
+      if (lastProbes > st->maxFindProbes)
+         st->maxFindProbes = lastProbes;
+   }
+   if (++st->ops % st->sampleEvery)
+      return;
+   if (st->numSamples == LOADSAMPLES) {
+      for (i=0; i < LOADSAMPLES/2; i++)
+         st->load[i] = st->load[2*i+1];
+      st->numSamples = LOADSAMPLES/2;
+      st->sampleEvery *= 2;
+      if (st->ops % st->sampleEvery)
+         return;
+   }
+   st->load[st->numSamples++] = (float) table->used / table->size;
+}
+
+static double seconds()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+#endif
+
+// Create a new, empty symbol table and return pointer to it
+SymbolTable* newSymbolTable()
+{
+   SymbolTable* table = (SymbolTable*) malloc(sizeof(SymbolTable));
+   table->size = INITSIZE;
+   table->used = 0;
+   table->slots = (SymbolSlot*) calloc(table->size, sizeof(SymbolSlot));
+   table->logLen = 0;
+   table->logCap = INITLOG;
+   table->undoLog = (Symbol**) malloc(table->logCap * sizeof(Symbol*));
+   table->level = 0;
+   table->levelCap = INITLEVELS;
+   table->scopeStart = (unsigned int*) malloc(table->levelCap * sizeof(unsigned int));
+   table->regions = (Arena*) malloc(table->levelCap * sizeof(Arena));
+   initArena(&table->regions[0], GLOBALCHUNKSIZE);
+   table->stats = 0;
+#ifdef SYMSTATS
+   table->stats = (struct symstats_s*) calloc(1, sizeof(struct symstats_s));
+   table->stats->sampleEvery = 16;
+#endif
    return table;
 }
 
 // Add a new symbol to the given symbol table
-// - name is the symbol name string (must strdup() it in here to store)
+// - name is the symbol name atom (the atom table owns the text)
 // - scopeLevel is the scoping level of the symbol (0 is global)
 // - type is its data type 
-// - this function must hash the symbol name to find the correct
-//   table entry to put it on; each table entry is a pointer to a linked
-//   list of symbols that hash to that index; symbols must be added to
-//   the head of the list
-// - this function must allocate a new Symbol structure, it must 
-//   strdup() the name to save its own copy, and must set all structure
-//   fields appropiately
-// - return 0 on success, any other on failure (generally, negative)
-int addSymbol(Symbol** table, char* name, int scopeLevel, DataType type,
+// - if the name is already in the table, the new symbol goes in
+//   its slot and the old one is linked behind it (shadowed)
+// - this function allocates a new Symbol structure (in the arena
+//   of the current scope) and sets all structure fields appropiately
+// - return 0 on success, 1 if the name is already declared at
+//   this scope level (nothing is added), negative on other failure
+int addSymbol(SymbolTable* table, Atom name, int scopeLevel, DataType type,
               unsigned int size, int offset, VariableKind varKind)
 {
-   // your implementation should be less than 10 lines long -- keep it simple!
-   Symbol* cur = (Symbol*) malloc(sizeof(Symbol));
-   cur->name = strdup(name);
+   unsigned int h = hash(name);
+   SymbolSlot* slot = findSlot(table, name, h);
+   Symbol* cur;
+   STAT(countOp(table, 1));
+   // only the newest symbol with a name can be at the same level
+   if (slot->sym && slot->sym->scopeLevel == scopeLevel) {
+      STAT(table->stats->redeclared++);
+      return 1;
+   }
+   if (table->logLen == table->logCap) {
+      table->logCap *= 2;
+      table->undoLog = (Symbol**) realloc(table->undoLog,
+                                          table->logCap * sizeof(Symbol*));
+   }
+   if (!slot->sym && 2*(table->used+1) > table->size) {
+      growTable(table);
+      STAT(table->stats->grows++);
+      slot = findSlot(table, name, h);
+   }
+   cur = (Symbol*) arenaAlloc(&table->regions[table->level], sizeof(Symbol));
+   if (!cur)
+      return -1;
+   cur->name = name;
    cur->scopeLevel = scopeLevel;
    cur->type = type;
    cur->size = size;
    cur->offset = offset;
    cur->varKind = varKind;
-   cur->next = table[hash(name)];
-   table[hash(name)] = cur;
+   cur->next = slot->sym;
+   if (!slot->sym)
+      table->used++;
+   slot->hash = h;
+   slot->sym = cur;
+   table->undoLog[table->logLen++] = cur;
    return 0;
 }
 
 // Lookup a symbol name to see if it is in the symbol table
 // - returns a pointer to the symbol record, or NULL if not found
-// - it should return the first symbol record that exists with the
-//   given name; there is no need to look further once you find one
-// - pseudocode: hash the name to get table index, then look through
-//               linked list to see if the name exists as a symbol
-Symbol* findSymbol(Symbol** table, char* name)
+// - the slot's symbol is the most recently added one with the name
+Symbol* findSymbol(SymbolTable* table, Atom name)
 {
-   int index = hash(name);
-   Symbol *cur = table[index];  // Start at the head of the linked list at that index
-
-    // Traverse the linked list to find the symbol
-    while (cur != NULL) {
-        if (strcmp(cur->name, name) == 0) {  // Check if names match
-            return cur;  // Found the symbol, return a pointer to it
-        }
-        cur = cur->next;  // Move to the next symbol in the list
-    }
-
-    // Symbol not found, return NULL
-    return NULL;
+   SymbolSlot* slot = findSlot(table, name, hash(name));
+   STAT(countOp(table, 0));
+   return slot->sym;
 }
 
 // Iterator over entire symbol table
@@ -96,94 +250,196 @@ Symbol* findSymbol(Symbol** table, char* name)
 // - caller then calls this function until it returns NULL, meaning end 
 //   of all symbols; each return value is a pointer to a symbol in the table
 // - parameter scopeLevel is not currently used (just pass a 0 in)
-Symbol* iterSymbolTable(Symbol** table, int scopeLevel, SymbolTableIter* iter)
+Symbol* iterSymbolTable(SymbolTable* table, int scopeLevel, SymbolTableIter* iter)
 {
    Symbol* cur;
    if (iter->index == -1) {
       // start at index 0
       iter->index = 0;
-      cur = table[iter->index];
+      cur = table->slots[iter->index].sym;
    } else {
       // start where we left off
       cur = iter->lastsym->next;
    }
    // if we have another symbol already, use it (loop will be skipped)
    // otherwise, search for next index that has symbols (is not empty)
-   while (!cur && iter->index < TABLESIZE-1) {
+   while (!cur && iter->index < (int) table->size-1) {
       iter->index++;
-      cur = table[iter->index];
+      cur = table->slots[iter->index].sym;
    }
    // update iterator position and return current symbol
    iter->lastsym = cur;
    return cur;
 }
 
-// Walk the table and the lists and free all symbol names
-// and symbol structs
-// - does not free the table (array) itself
-//  - caller should probably free the table after this!
-// - zeroing pointers in next and table elements makes memory
-//   a bit safe, cannot accidentally follow and old pointer
-void freeAllSymbols(Symbol** table)
+// Free all symbol structs, ending every open scope
+// - leaves an empty table, which can still be used
+// - use freeSymbolTable() to free the table itself too
+void freeAllSymbols(SymbolTable* table)
 {
    int i;
-   Symbol *cur, *stmp;
-   for (i=0; i < TABLESIZE; i++) {
-      cur = table[i];
-      while (cur) {
-         stmp = cur;
-         cur = cur->next;
-         stmp->next = 0; // safety
-         free(stmp->name);
-         free(stmp);
-      }
-      table[i] = 0; // safety
+   for (i=0; i <= table->level; i++)
+      freeArena(&table->regions[i]);
+   memset(table->slots, 0, table->size * sizeof(SymbolSlot));
+   table->used = 0;
+   table->logLen = 0;
+   table->level = 0;
+}
+
+// Free all symbols and the table itself
+void freeSymbolTable(SymbolTable* table)
+{
+   freeAllSymbols(table);
+   free(table->slots);
+   free(table->undoLog);
+   free(table->scopeStart);
+   free(table->regions);
+   free(table->stats);
+   free(table);
+}
+
+// Start a new (nested) scope
+// - returns the new scope level
+int pushScope(SymbolTable* table)
+{
+   if (table->level+1 == table->levelCap) {
+      table->levelCap *= 2;
+      table->scopeStart = (unsigned int*) realloc(table->scopeStart,
+                                   table->levelCap * sizeof(unsigned int));
+      table->regions = (Arena*) realloc(table->regions,
+                                        table->levelCap * sizeof(Arena));
+   }
+   table->scopeStart[table->level++] = table->logLen;
+   initArena(&table->regions[table->level], SCOPECHUNKSIZE);
+   return table->level;
+}
+
+// End the current scope, deleting every symbol added since the
+// matching pushScope() and uncovering the symbols they shadowed
+// - works back through the undo log, so each deleted symbol is
+//   still the newest one with its name when its turn comes
+// - then frees the scope's arena, which holds exactly those symbols
+// - returns the new (outer) scope level, or -1 if at global level
+int popScope(SymbolTable* table)
+{
+   SymbolSlot* slot;
+   Symbol* t;
+   unsigned int start;
+#ifdef SYMSTATS
+   double t0 = seconds();
+#endif
+   if (table->level == 0)
+      return -1;
+   start = table->scopeStart[--table->level];
+   while (table->logLen > start) {
+      t = table->undoLog[--table->logLen];
+      slot = findSlot(table, t->name, hash(t->name));
+      slot->sym = t->next;
+      if (!slot->sym)
+         deleteSlot(table, slot - table->slots);
    }
+   freeArena(&table->regions[table->level+1]);
+#ifdef SYMSTATS
+   t0 = seconds() - t0;
+   table->stats->pops++;
+   table->stats->popSeconds += t0;
+   if (t0 > table->stats->maxPopSeconds)
+      table->stats->maxPopSeconds = t0;
+#endif
+   return table->level;
 }
 
 // Deletes all symbols that are at a given scope level and above
-// - both the symbol string and the structure
-// - relinks the linked list so that nothing is lost
-int delScopeLevel(Symbol** table, int scopeLevel)
+// - ends (pops) every open scope at or above that level
+int delScopeLevel(SymbolTable* table, int scopeLevel)
 {
+   while (table->level >= scopeLevel && table->level > 0)
+      popScope(table);
+   return 0;
+}
+
+// Bytes of symbol structs the table holds (in all scope arenas)
+size_t symbolBytesUsed(SymbolTable* table)
+{
+   size_t bytes = 0;
+   int i;
+   for (i=0; i <= table->level; i++)
+      bytes += arenaBytesUsed(&table->regions[i]);
+   return bytes;
+}
+
+// Number of arena chunks the table's symbols are in
+unsigned int symbolChunkCount(SymbolTable* table)
+{
+   unsigned int chunks = 0;
    int i;
-   Symbol *prev=0, *cur=0, *t;
-   for (i=0; i < TABLESIZE; i++) {
-      prev = 0;
-      cur = table[i];
-      while (cur) {
-         if (cur->scopeLevel >= scopeLevel) {
-            t = cur;
-            if (prev)
-               prev->next = cur->next;
-            else
-               table[i] = cur->next;
-            cur = cur->next;
-            free(t->name);
-            t->name = 0; // safety
-            t->next = 0; // safety
-            free(t);
-         } else {
-            prev = cur;
-            cur = cur->next;
-         }
+   for (i=0; i <= table->level; i++)
+      chunks += arenaChunkCount(&table->regions[i]);
+   return chunks;
+}
+
+// Print the statistics gathered by a -DSYMSTATS build
+// - the slot occupancy and probe run counts describe the table as it
+//   is now; call this before ending the scopes of interest
+void printSymbolStats(SymbolTable* table, FILE* out)
+{
+#ifdef SYMSTATS
+   struct symstats_s* st = table->stats;
+   unsigned long perSlot[5] = {0}, runs[5] = {0};
+   unsigned int i, n, run = 0;
+   Symbol* sym;
+   fprintf(out, "Symbol table statistics:\n");
+   fprintf(out, "  findSymbol calls: %lu, avg probes %.2f, max probes %u\n",
+           st->finds, st->finds ? (double) st->findProbes / st->finds : 0.0,
+           st->maxFindProbes);
+   fprintf(out, "  addSymbol calls: %lu (%lu redeclared), avg probes %.2f, max probes %u\n",
+           st->adds, st->redeclared,
+           st->adds ? (double) st->addProbes / st->adds : 0.0, st->maxAddProbes);
+   fprintf(out, "  slots: %u, used %u, load %.3f, grew %u times\n",
+           table->size, table->used, (double) table->used / table->size, st->grows);
+   fprintf(out, "  symbol memory: %lu bytes in %u chunks\n",
+           (unsigned long) symbolBytesUsed(table), symbolChunkCount(table));
+   fprintf(out, "  scope pops (delScopeLevel): %lu, total %.3f ms, max %.3f ms\n",
+           st->pops, st->popSeconds * 1e3, st->maxPopSeconds * 1e3);
+   fprintf(out, "  load factor every %lu calls:", st->sampleEvery);
+   for (i=0; i < st->numSamples; i++)
+      fprintf(out, "%s %.3f", i % 8 ? "" : "\n   ", st->load[i]);
+   fprintf(out, "\n");
+   // symbols per slot (shadow list lengths), and the lengths of runs
+   // of consecutive used slots, which is what probing has to cross
+   for (i=0; i <= table->size; i++) {
+      if (i < table->size && table->slots[i].sym) {
+         for (n=0, sym = table->slots[i].sym; sym; sym = sym->next)
+            n++;
+         perSlot[n < 4 ? n : 4]++;
+         run++;
+         continue;
       }
+      if (i < table->size)
+         perSlot[0]++;
+      if (run)
+         runs[run < 2 ? 0 : run < 4 ? 1 : run < 8 ? 2 : run < 16 ? 3 : 4]++;
+      run = 0;
    }
-   return 0;
+   fprintf(out, "  symbols per slot:  0: %lu  1: %lu  2: %lu  3: %lu  4+: %lu\n",
+           perSlot[0], perSlot[1], perSlot[2], perSlot[3], perSlot[4]);
+   fprintf(out, "  used slot runs:  1: %lu  2-3: %lu  4-7: %lu  8-15: %lu  16+: %lu\n",
+           runs[0], runs[1], runs[2], runs[3], runs[4]);
+#else
+   fprintf(out, "Symbol table statistics not compiled in (build with -DSYMSTATS)\n");
+#endif
 }
 
 /*** NOT USED SO REMOVED WITHOUT DELETING CODE
 // Delete a specific symbol at a specific scope level
 // from the symbol table
-int delSymbol(Symbol** table, char* name, int scopeLevel)
+// - would also have to take the symbol out of the undo log
+int delSymbol(SymbolTable* table, Atom name, int scopeLevel)
 {
-   int i;
-   Symbol *prev=0, *cur=0;
-   i = hash(name);
-   cur = table[i];
+   SymbolSlot* slot = findSlot(table, name, hash(name));
+   Symbol *prev=0, *cur=slot->sym;
    while (cur) {
-      if (!strcmp(cur->name, name) &&
-          cur->scopeLevel == scopeLevel)
+      if (cur->scopeLevel == scopeLevel)
          break;
       prev = cur;
       cur = cur->next;
@@ -193,13 +449,10 @@ int delSymbol(Symbol** table, char* name, int scopeLevel)
    if (prev)
       prev->next = cur->next;
    else
-      table[i] = cur->next;
-   free(cur->name);
-   cur->name = 0;
-   cur->next = 0;
-   free(cur);
+      slot->sym = cur->next;
+   if (!slot->sym)
+      deleteSlot(table, slot - table->slots);
+   cur->next = 0; // cur stays in its scope's arena until the scope ends
    return 0;
 }
 ***/
-
-
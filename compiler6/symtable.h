@@ -4,6 +4,10 @@
 #ifndef SYMTABLE_H
 #define SYMTABLE_H
 
+#include <stdio.h>
+#include "atoms.h"
+#include "arena.h"
+
 typedef enum { T_STRING, T_INT, T_LONG, T_RETURNVAL } DataType;
 typedef enum { V_GLOBAL, V_PARAM, V_LOCAL, V_GLARRAY } VariableKind;
 
@@ -13,25 +17,51 @@ typedef struct symbol_s {
    VariableKind varKind; //not used yet...
    unsigned int size;  // 0 if simple var, N if array (N is num elems)
    int offset;         // stack offset for local vars and params
-   char* name;
-   struct symbol_s* next;
+   Atom name;          // interned name (see atoms.h)
+   struct symbol_s* next; // older symbol with the same name (shadowed)
 } Symbol;
 
+// one slot of the open-addressing table; sym is the most recent
+// symbol with its name (NULL if the slot is empty), hash is the
+// hash of that name
+typedef struct {
+   unsigned int hash;
+   Symbol* sym;
+} SymbolSlot;
+
+typedef struct {
+   SymbolSlot* slots;
+   unsigned int size;  // number of slots, always a power of two
+   unsigned int used;  // number of non-empty slots
+   Symbol** undoLog;   // every symbol added, oldest first
+   unsigned int logLen, logCap;
+   unsigned int* scopeStart; // undoLog length when each scope was pushed
+   Arena* regions;     // where the symbols of each scope level live
+   int level, levelCap; // current scope level (0 is global)
+   struct symstats_s* stats; // NULL unless built with -DSYMSTATS
+} SymbolTable;
+
 typedef struct {
    int index;
    Symbol* lastsym;
 } SymbolTableIter;
 
-Symbol** newSymbolTable();
-int addSymbol(Symbol** table, char* name, int scopeLevel, DataType type,
+SymbolTable* newSymbolTable();
+int addSymbol(SymbolTable* table, Atom name, int scopeLevel, DataType type,
               unsigned int size, int offset, VariableKind varKind);
-Symbol* findSymbol(Symbol** table, char* name);
-Symbol* iterSymbolTable(Symbol** table, int scopeLevel, SymbolTableIter* iter);
-void freeAllSymbols(Symbol** table);
-int delScopeLevel(Symbol** table, int scopeLevel);
+Symbol* findSymbol(SymbolTable* table, Atom name);
+Symbol* iterSymbolTable(SymbolTable* table, int scopeLevel, SymbolTableIter* iter);
+void freeAllSymbols(SymbolTable* table);
+void freeSymbolTable(SymbolTable* table);
+int pushScope(SymbolTable* table);
+int popScope(SymbolTable* table);
+int delScopeLevel(SymbolTable* table, int scopeLevel);
+size_t symbolBytesUsed(SymbolTable* table);
+unsigned int symbolChunkCount(SymbolTable* table);
+void printSymbolStats(SymbolTable* table, FILE* out);
 /* 
 NOT USED
-int delSymbol(Symbol** table, char* name, int scopeLevel);
+int delSymbol(SymbolTable* table, Atom name, int scopeLevel);
 */
 
 #endif
@@ -0,0 +1,451 @@
+//
+// Token Cache Module
+// - see tokcache.h for the file layout
+// - recording: the parser's yylex() hands every token it gets from a
+//   live scanner to tokCacheRecord(), which appends it to an in-memory
+//   byte buffer; tokCacheWrite() then saves the whole cache file
+// - replaying: tokCacheOpen() maps a cache file, checks that it was
+//   made from the current source text, interns its names and decodes
+//   its tokens once to find any corruption up front; after
+//   that tokCacheNext() stands in for the scanner
+// - STRING tokens are slices of the source buffer, so the source is
+//   still needed (and is always mapped, since it has to be hashed)
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "srcbuf.h"
+#include "atoms.h"
+#include "y.tab.h"
+#include "tokcache.h"
+
+#define TCMAGIC    0x0143544A   // "JTC\1" in little-endian byte order
+#define TCVERSION  1
+#define FIRSTTOKEN LPAREN       // first token declared in parser.y
+#define KINDBITS   5            // low bits of a token's first varint
+#define NUMKINDS   (STRING - FIRSTTOKEN + 1)
+
+// compile error here means token kinds no longer fit in KINDBITS
+typedef char tokenKindsFit[NUMKINDS <= (1 << KINDBITS) ? 1 : -1];
+
+extern int yylineno; // from lex
+
+typedef struct {
+   unsigned int magic, version;
+   unsigned int firstToken, numKinds; // token codes the cache was made with
+   unsigned long long srcSize, srcHash;
+   unsigned int numTokens, numNames, numNumbers, lastLine;
+   unsigned long long namesOff, numbersOff, tokensOff, fileSize;
+} TokCacheHeader;
+
+typedef struct {
+   unsigned char* data;
+   size_t len, cap;
+} ByteBuf;
+
+// recording state
+static ByteBuf tokens, namesBuf, numbersBuf;
+static unsigned int* nameOfAtom = 0; // cache name index+1 of each atom
+static unsigned int nameOfAtomSize = 0;
+static int* numberKeys = 0;          // open-addressing set of numbers,
+static unsigned int* numberIds = 0;  // with each one's index+1
+static unsigned int numberSetSize = 0;
+static unsigned int numTokens = 0, numNames = 0, numNumbers = 0;
+static unsigned int recLine = 1, recLastLine = 1, recStrOff = 0;
+static int recordFailed = 0;
+
+// replay state
+static unsigned char* map = 0;
+static size_t mapSize = 0;
+static const unsigned char *tp, *tend;
+static Atom* replayNames = 0;
+static int* replayNumbers = 0;
+static unsigned int replayCounts[2]; // numNames, numNumbers
+static unsigned int replayStrOff, replayLastLine;
+
+// Hash of the whole source text
+// - mixes a 64-bit word at a time so that checking a big cache is
+//   much cheaper than scanning the source again
+static unsigned long long sourceHash()
+{
+   static int done = 0;
+   static unsigned long long h;
+   const unsigned char* p = (const unsigned char*) srcBuf.base;
+   unsigned long long w;
+   size_t i, n = srcBuf.size;
+   if (done)
+      return h;
+   h = 0x9E3779B97F4A7C15ull ^ n;
+   for (i=0; i+8 <= n; i += 8) {
+      memcpy(&w, p+i, 8);
+      h = (h ^ w) * 0x100000001B3ull;
+      h ^= h >> 29;
+   }
+   for (; i < n; i++)
+      h = (h ^ p[i]) * 0x100000001B3ull;
+   done = 1;
+   return h;
+}
+
+// Append len bytes to a byte buffer, growing it by doubling
+static void putBytes(ByteBuf* b, const void* bytes, size_t len)
+{
+   if (b->len + len > b->cap) {
+      while (b->len + len > b->cap)
+         b->cap = b->cap ? b->cap * 2 : 65536;
+      b->data = (unsigned char*) realloc(b->data, b->cap);
+   }
+   memcpy(b->data + b->len, bytes, len);
+   b->len += len;
+}
+
+// Append an unsigned LEB128 varint (7 bits per byte, low bits first)
+static void putVarint(ByteBuf* b, unsigned long long v)
+{
+   unsigned char bytes[10];
+   int n = 0;
+   while (v >= 0x80) {
+      bytes[n++] = (v & 0x7F) | 0x80;
+      v >>= 7;
+   }
+   bytes[n++] = v;
+   putBytes(b, bytes, n);
+}
+
+// Read a varint, advancing *p; never reads at or past tend
+static unsigned long long getVarint(const unsigned char** p)
+{
+   unsigned long long v = 0;
+   int shift = 0;
+   while (*p < tend && shift < 64) {
+      unsigned char c = *(*p)++;
+      v |= (unsigned long long) (c & 0x7F) << shift;
+      if (!(c & 0x80))
+         break;
+      shift += 7;
+   }
+   return v;
+}
+
+// Cache name index of an atom, adding it to the names section if new
+static unsigned int nameIndex(Atom atom)
+{
+   const char* name;
+   if (atom >= nameOfAtomSize) {
+      unsigned int old = nameOfAtomSize;
+      while (atom >= nameOfAtomSize)
+         nameOfAtomSize = nameOfAtomSize ? nameOfAtomSize * 2 : 1024;
+      nameOfAtom = (unsigned int*) realloc(nameOfAtom,
+                                      nameOfAtomSize * sizeof(unsigned int));
+      memset(nameOfAtom + old, 0, (nameOfAtomSize-old) * sizeof(unsigned int));
+   }
+   if (!nameOfAtom[atom]) {
+      name = atomName(atom);
+      putVarint(&namesBuf, strlen(name));
+      putBytes(&namesBuf, name, strlen(name));
+      nameOfAtom[atom] = ++numNames;
+   }
+   return nameOfAtom[atom] - 1;
+}
+
+// Cache number index of a value, adding it to the numbers section if new
+static unsigned int numberIndex(int value)
+{
+   unsigned int i, j, mask;
+   if (2*(numNumbers+1) > numberSetSize) {
+      int* oldKeys = numberKeys;
+      unsigned int* oldIds = numberIds;
+      unsigned int oldSize = numberSetSize;
+      numberSetSize = numberSetSize ? numberSetSize * 2 : 1024;
+      numberKeys = (int*) malloc(numberSetSize * sizeof(int));
+      numberIds = (unsigned int*) calloc(numberSetSize, sizeof(unsigned int));
+      mask = numberSetSize - 1;
+      for (i=0; i < oldSize; i++) {
+         if (!oldIds[i])
+            continue;
+         for (j = (oldKeys[i] * 2654435761u) & mask; numberIds[j]; j = (j+1) & mask)
+            ;
+         numberKeys[j] = oldKeys[i];
+         numberIds[j] = oldIds[i];
+      }
+      free(oldKeys);
+      free(oldIds);
+   }
+   mask = numberSetSize - 1;
+   for (j = (value * 2654435761u) & mask; numberIds[j]; j = (j+1) & mask)
+      if (numberKeys[j] == value)
+         return numberIds[j] - 1;
+   numberKeys[j] = value;
+   numberIds[j] = ++numNumbers;
+   putVarint(&numbersBuf, ((unsigned int) value << 1) ^ (unsigned int) (value >> 31));
+   return numNumbers - 1;
+}
+
+// Record a token just returned by a live scanner (0 is end of input)
+// - yylval and yylineno must still hold that token's values
+void tokCacheRecord(int tok)
+{
+   unsigned int kind = tok - FIRSTTOKEN;
+   if (recordFailed)
+      return;
+   if (tok == 0) {
+      recLastLine = yylineno;
+      return;
+   }
+   if (tok < FIRSTTOKEN || kind >= NUMKINDS || yylineno < recLine) {
+      recordFailed = 1; // not representable; just don't write a cache
+      return;
+   }
+   putVarint(&tokens, (unsigned long long) (yylineno - recLine) << KINDBITS | kind);
+   recLine = yylineno;
+   numTokens++;
+   switch (tok) {
+    case ID:
+       putVarint(&tokens, nameIndex(yylval.atom));
+       break;
+    case NUMBER:
+       putVarint(&tokens, numberIndex(yylval.ival));
+       break;
+    case STRING:
+       putVarint(&tokens, yylval.slice.off - recStrOff);
+       putVarint(&tokens, yylval.slice.len);
+       recStrOff = yylval.slice.off;
+       break;
+    case ADDOP:
+    case RELOP: {
+       unsigned char c = yylval.ival;
+       putBytes(&tokens, &c, 1);
+       break;
+    }
+   }
+}
+
+// Write the recorded token stream to a cache file
+// - returns 0 on success, any other on failure
+int tokCacheWrite(const char* cacheFile)
+{
+   TokCacheHeader hdr;
+   FILE* f;
+   int err;
+   if (recordFailed)
+      return -1;
+   memset(&hdr, 0, sizeof(hdr));
+   hdr.magic = TCMAGIC;
+   hdr.version = TCVERSION;
+   hdr.firstToken = FIRSTTOKEN;
+   hdr.numKinds = NUMKINDS;
+   hdr.srcSize = srcBuf.size;
+   hdr.srcHash = sourceHash();
+   hdr.numTokens = numTokens;
+   hdr.numNames = numNames;
+   hdr.numNumbers = numNumbers;
+   hdr.lastLine = recLastLine;
+   hdr.namesOff = sizeof(hdr);
+   hdr.numbersOff = hdr.namesOff + namesBuf.len;
+   hdr.tokensOff = hdr.numbersOff + numbersBuf.len;
+   hdr.fileSize = hdr.tokensOff + tokens.len;
+   f = fopen(cacheFile, "wb");
+   if (!f)
+      return -1;
+   err = fwrite(&hdr, sizeof(hdr), 1, f) != 1;
+   if (namesBuf.len)
+      err |= fwrite(namesBuf.data, namesBuf.len, 1, f) != 1;
+   if (numbersBuf.len)
+      err |= fwrite(numbersBuf.data, numbersBuf.len, 1, f) != 1;
+   if (tokens.len)
+      err |= fwrite(tokens.data, tokens.len, 1, f) != 1;
+   err |= fclose(f) != 0;
+   if (err)
+      unlink(cacheFile);
+   return err;
+}
+
+// The char value the scanner gives yylval for a fixed-text token
+// (the first char of its text)
+static int tokenChar(int tok)
+{
+   switch (tok) {
+    case LPAREN: return '(';
+    case RPAREN: return ')';
+    case LBRACE: return '{';
+    case RBRACE: return '}';
+    case LBRACKET: return '[';
+    case RBRACKET: return ']';
+    case SEMICOLON: return ';';
+    case COMMA: return ',';
+    case EQUALS: return '=';
+    case KWPROGRAM: return 'p';
+    case KWCALL: return 'c';
+    case KWFUNCTION: return 'f';
+    case KWGLOBAL: return 'g';
+    case KWINT: return 'i';
+    case KWIF: return 'i';
+    case KWSTRING: return 's';
+    case KWRETURNVAL: return 'r';
+    case KWWHILE: return 'w';
+    case KWDO: return 'd';
+    case KWTHEN: return 't';
+    case KWELSE: return 'e';
+   }
+   return 0;
+}
+
+// Decode the token at tp, setting yylval and yylineno as the
+// scanner would
+// - returns the token code, or -1 if the bytes are not a valid token
+static int decodeToken(void)
+{
+   unsigned long long v;
+   unsigned int i;
+   int tok;
+   v = getVarint(&tp);
+   yylineno += v >> KINDBITS;
+   tok = FIRSTTOKEN + (v & ((1 << KINDBITS) - 1));
+   switch (tok) {
+    case ID:
+       i = getVarint(&tp);
+       if (i >= replayCounts[0])
+          return -1;
+       yylval.atom = replayNames[i];
+       return tok;
+    case NUMBER:
+       i = getVarint(&tp);
+       if (i >= replayCounts[1])
+          return -1;
+       yylval.ival = replayNumbers[i];
+       return tok;
+    case STRING:
+       replayStrOff += getVarint(&tp);
+       yylval.slice.off = replayStrOff;
+       yylval.slice.len = getVarint(&tp);
+       if (yylval.slice.off + (size_t) yylval.slice.len > srcBuf.size)
+          return -1;
+       return tok;
+    case ADDOP:
+    case RELOP:
+       if (tp >= tend)
+          return -1;
+       yylval.ival = *tp++;
+       return tok;
+    default:
+       if (tok > STRING)
+          return -1;
+       yylval.ival = tokenChar(tok);
+       return tok;
+   }
+}
+
+// Open a cache file for replay
+// - returns 0 if the file is a valid cache for the current source
+//   buffer (and replay is ready to start), any other if it is not
+// - the token stream is decoded once here, so that a corrupt cache
+//   is found before the parser has taken any of its tokens; such a
+//   file is removed, and the caller scans the source instead
+int tokCacheOpen(const char* cacheFile)
+{
+   struct stat st;
+   TokCacheHeader* hdr;
+   const unsigned char* p;
+   unsigned int i, len;
+   int ok = 1;
+   int fd = open(cacheFile, O_RDONLY);
+   if (fd < 0)
+      return -1;
+   if (fstat(fd, &st) < 0 || st.st_size < (off_t) sizeof(TokCacheHeader)) {
+      close(fd);
+      return -1;
+   }
+   mapSize = st.st_size;
+   map = mmap(0, mapSize, PROT_READ, MAP_PRIVATE, fd, 0);
+   close(fd);
+   if (map == MAP_FAILED) {
+      map = 0;
+      return -1;
+   }
+   hdr = (TokCacheHeader*) map;
+   if (hdr->magic != TCMAGIC || hdr->version != TCVERSION ||
+       hdr->firstToken != FIRSTTOKEN || hdr->numKinds != NUMKINDS ||
+       hdr->fileSize != mapSize || hdr->namesOff > hdr->numbersOff ||
+       hdr->numbersOff > hdr->tokensOff || hdr->tokensOff > mapSize ||
+       hdr->srcSize != srcBuf.size || hdr->srcHash != sourceHash()) {
+      tokCacheClose();
+      return -1;
+   }
+   // intern the names and decode the numbers once, up front
+   replayNames = (Atom*) malloc((hdr->numNames+1) * sizeof(Atom));
+   replayNumbers = (int*) malloc((hdr->numNumbers+1) * sizeof(int));
+   p = map + hdr->namesOff;
+   tend = map + hdr->numbersOff;
+   for (i=0; i < hdr->numNames; i++) {
+      len = getVarint(&p);
+      if (len > tend - p) {
+         tokCacheClose();
+         return -1;
+      }
+      replayNames[i] = internAtom((const char*) p, len);
+      p += len;
+   }
+   tend = map + hdr->tokensOff;
+   for (i=0; i < hdr->numNumbers; i++) {
+      unsigned int z = getVarint(&p);
+      replayNumbers[i] = (int) (z >> 1) ^ -(int) (z & 1);
+   }
+   replayCounts[0] = hdr->numNames;
+   replayCounts[1] = hdr->numNumbers;
+   replayLastLine = hdr->lastLine;
+   replayStrOff = 0;
+   tp = map + hdr->tokensOff;
+   tend = map + mapSize;
+   while (ok && tp < tend)
+      ok = decodeToken() >= 0;
+   yylineno = 1;
+   if (!ok) {
+      tokCacheClose();
+      unlink(cacheFile);
+      return -1;
+   }
+   replayStrOff = 0;
+   tp = map + hdr->tokensOff;
+   return 0;
+}
+
+// Replay the next cached token: same contract as yylex()
+// - tokCacheOpen() has decoded the whole stream once already, so
+//   every token here is valid
+int tokCacheNext(void)
+{
+   if (tp >= tend) {
+      yylineno = replayLastLine;
+      return 0;
+   }
+   return decodeToken();
+}
+
+// Release the replay mapping and all recording buffers
+void tokCacheClose()
+{
+   if (map)
+      munmap(map, mapSize);
+   map = 0;
+   free(replayNames);
+   free(replayNumbers);
+   replayNames = 0;
+   replayNumbers = 0;
+   free(tokens.data);
+   free(namesBuf.data);
+   free(numbersBuf.data);
+   memset(&tokens, 0, sizeof(tokens));
+   memset(&namesBuf, 0, sizeof(namesBuf));
+   memset(&numbersBuf, 0, sizeof(numbersBuf));
+   free(nameOfAtom);
+   free(numberKeys);
+   free(numberIds);
+   nameOfAtom = 0;
+   numberKeys = 0;
+   numberIds = 0;
+   nameOfAtomSize = numberSetSize = 0;
+}
@@ -0,0 +1,31 @@
+//
+// Token Cache Interface
+// - saves the token stream of a source file in a compact binary file
+//   (file.jtc next to file.s) so that a later compile of the same,
+//   unchanged source can replay the tokens instead of scanning again
+// - the cache records a hash of the source text; a cache whose hash
+//   does not match the current source is ignored, and one whose
+//   tokens do not decode is removed, and the source scanned again
+//
+// File layout:
+//   header: a fixed struct (host byte order) with the magic "JTC\1",
+//           version, source size and hash, counts and byte offsets of
+//           the three sections that follow
+//   names:  one entry per distinct ID, as varint length then the bytes
+//   numbers: one varint (zigzag encoded) per distinct NUMBER value
+//   tokens: per token, varint (lineDelta*32 + kind) where kind is the
+//           token code minus the first token code; then, by kind,
+//           ID: varint name index, NUMBER: varint number index,
+//           STRING: varint offset delta and varint length (a slice of
+//           the source), ADDOP/RELOP: the operator char byte
+//
+#ifndef TOKCACHE_H
+#define TOKCACHE_H
+
+int tokCacheOpen(const char* cacheFile);
+int tokCacheNext(void);
+void tokCacheClose();
+void tokCacheRecord(int tok);
+int tokCacheWrite(const char* cacheFile);
+
+#endif
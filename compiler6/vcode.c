@@ -0,0 +1,348 @@
+//
+// Virtual Register Code Module
+// - see vcode.h; each instruction's operand roles come from the
+//   opcode table below, which both the allocator and the printer
+//   work from
+// - allocation is the classic linear scan: live intervals in order
+//   of their start, each given the first free register in pool
+//   preference order (t0-t6, then a0-a7); when none is free, the
+//   interval that ends last is spilled
+// - a spilled value is stored to its stack slot right after it is
+//   made and loaded just before each use, through two scratch
+//   registers; the scratch registers are only set aside (and the
+//   scan redone) in a buffer that needs to spill at all
+//
+#include <stdlib.h>
+#include "vcode.h"
+
+#define INITVCODE 64
+#define SPILLED -1
+
+// operand roles
+#define NONE    0
+#define USE     1   // read by the instruction
+#define DEF     2   // written, after the reads
+#define CLOBBER 3   // written before the reads are done (a temp)
+
+// operand print formats
+enum { F_RI, F_RSYM, F_RSTR, F_SWG, F_LOAD, F_STORE, F_RR, F_RRR, F_RRI, F_BR };
+
+typedef struct {
+   const char* name;
+   char rd, rs1, rs2;  // role of each operand
+   char fmt;
+} VOpInfo;
+
+static const VOpInfo vopInfo[] = {
+   { "li",   DEF,  NONE, NONE,    F_RI },    // VI_LI    rd, imm
+   { "la",   DEF,  NONE, NONE,    F_RSYM },  // VI_LA    rd, name
+   { "la",   DEF,  NONE, NONE,    F_RSTR },  // VI_LASTR rd, .SCimm
+   { "lw",   DEF,  NONE, NONE,    F_RSYM },  // VI_LWG   rd, name
+   { "sw",   NONE, USE,  CLOBBER, F_SWG },   // VI_SWG   rs1, name, rs2
+   { "lw",   DEF,  USE,  NONE,    F_LOAD },  // VI_LW    rd, imm(rs1)
+   { "sw",   NONE, USE,  USE,     F_STORE }, // VI_SW    rs1, imm(rs2)
+   { "mv",   DEF,  USE,  NONE,    F_RR },    // VI_MV    rd, rs1
+   { "add",  DEF,  USE,  USE,     F_RRR },   // VI_ADD   rd, rs1, rs2
+   { "sub",  DEF,  USE,  USE,     F_RRR },   // VI_SUB   rd, rs1, rs2
+   { "slli", DEF,  USE,  NONE,    F_RRI },   // VI_SLLI  rd, rs1, imm
+   { "addi", DEF,  USE,  NONE,    F_RRI },   // VI_ADDI  rd, rs1, imm
+   { "beq",  NONE, USE,  USE,     F_BR },    // VI_BEQ   rs1, rs2, .LLimm
+   { "bne",  NONE, USE,  USE,     F_BR },
+   { "bgt",  NONE, USE,  USE,     F_BR },
+   { "blt",  NONE, USE,  USE,     F_BR },
+};
+
+static const char* regNames[32] = {
+   "zero", "ra", "sp", "gp", "tp", "t0", "t1", "t2",
+   "fp", "s1", "a0", "a1", "a2", "a3", "a4", "a5",
+   "a6", "a7", "s2", "s3", "s4", "s5", "s6", "s7",
+   "s8", "s9", "s10", "s11", "t3", "t4", "t5", "t6"
+};
+
+// allocation preference order
+static const int regOrder[] = { 5, 6, 7, 28, 29, 30, 31, 10, 11, 12, 13, 14, 15, 16, 17 };
+#define NUMREGORDER (sizeof(regOrder) / sizeof(regOrder[0]))
+
+void initVCode(VCode* vc)
+{
+   vc->code = 0;
+   vc->len = vc->cap = 0;
+   vc->numVRegs = 0;
+   vc->spillSlots = 0;
+}
+
+// Empty the buffer (keeping its memory) for the next statement
+void resetVCode(VCode* vc)
+{
+   vc->len = 0;
+   vc->numVRegs = 0;
+   vc->spillSlots = 0;
+}
+
+void freeVCode(VCode* vc)
+{
+   free(vc->code);
+   initVCode(vc);
+}
+
+// Return a new virtual register
+int newVReg(VCode* vc)
+{
+   return VREG0 + vc->numVRegs++;
+}
+
+// Append an instruction (unused operands should be 0)
+void emitVInstr(VCode* vc, VOp op, int rd, int rs1, int rs2, int imm, Atom name)
+{
+   VInstr* in;
+   if (vc->len == vc->cap) {
+      vc->cap = vc->cap ? vc->cap * 2 : INITVCODE;
+      vc->code = (VInstr*) realloc(vc->code, vc->cap * sizeof(VInstr));
+   }
+   in = &vc->code[vc->len++];
+   in->op = op;
+   in->rd = rd;
+   in->rs1 = rs1;
+   in->rs2 = rs2;
+   in->imm = imm;
+   in->name = name;
+}
+
+// Real registers the buffer names directly (as a register set)
+// - these should be left out of the pool given to allocVRegs()
+unsigned int vcodeRealRegs(VCode* vc)
+{
+   unsigned int regs = 0;
+   const VOpInfo* info;
+   int i;
+   for (i=0; i < vc->len; i++) {
+      info = &vopInfo[vc->code[i].op];
+      if (info->rd && vc->code[i].rd < VREG0)
+         regs |= REGBIT(vc->code[i].rd);
+      if (info->rs1 && vc->code[i].rs1 < VREG0)
+         regs |= REGBIT(vc->code[i].rs1);
+      if (info->rs2 && vc->code[i].rs2 < VREG0)
+         regs |= REGBIT(vc->code[i].rs2);
+   }
+   return regs;
+}
+
+// Note operand r (with the given role) of instruction i in the live
+// intervals; positions are 2i for reads and early writes and 2i+1
+// for normal writes, so a value read by an instruction can share a
+// register with its result, but not with a temp it clobbers
+static void noteOperand(int r, int role, int i, int* start, int* end)
+{
+   int v = r - VREG0, pos;
+   if (role == NONE || r < VREG0)
+      return;
+   pos = role == DEF ? 2*i+1 : 2*i;
+   if (role != USE)
+      start[v] = pos;
+   if (end[v] < pos)
+      end[v] = pos;
+}
+
+// First register of the free set, in preference order (-1 if none)
+static int pickReg(unsigned int free)
+{
+   unsigned int i;
+   for (i=0; i < NUMREGORDER; i++)
+      if (free & REGBIT(regOrder[i]))
+         return regOrder[i];
+   return -1;
+}
+
+// Linear scan over the intervals (in start order) with the pool
+// - fills reg[] with a register or SPILLED; returns the spill count
+static int linearScan(int n, int* order, int* start, int* end, int* reg,
+                      unsigned int pool)
+{
+   int active[32]; // never more than one per register
+   int numActive = 0, spills = 0, i, j, v, r, cand;
+   unsigned int free = pool;
+   for (i=0; i < n; i++) {
+      v = order[i];
+      for (j=0; j < numActive; ) {
+         if (end[active[j]] < start[v]) {
+            free |= REGBIT(reg[active[j]]);
+            active[j] = active[--numActive];
+         } else
+            j++;
+      }
+      r = pickReg(free);
+      if (r >= 0) {
+         reg[v] = r;
+         free &= ~REGBIT(r);
+         active[numActive++] = v;
+         continue;
+      }
+      spills++;
+      cand = -1;
+      for (j=0; j < numActive; j++)
+         if (cand < 0 || end[active[j]] > end[active[cand]])
+            cand = j;
+      if (cand >= 0 && end[active[cand]] > end[v]) {
+         reg[v] = reg[active[cand]];
+         reg[active[cand]] = SPILLED;
+         active[cand] = v;
+      } else
+         reg[v] = SPILLED;
+   }
+   return spills;
+}
+
+// Replace operand *r by its register, or by a scratch register
+// loaded from (or, for a write, stored later to) its spill slot
+// - returns the slot of a spilled write, else -1
+static int rewriteOperand(VCode* vc, short* r, int role, int* reg, int* slot,
+                          int* scratch, int* used)
+{
+   int v;
+   if (role == NONE || *r < VREG0)
+      return -1;
+   v = *r - VREG0;
+   if (reg[v] != SPILLED) {
+      *r = reg[v];
+      return -1;
+   }
+   if (role == USE) {
+      emitVInstr(vc, VI_LW, scratch[*used], R_SP, 0, 4*slot[v], 0);
+      *r = scratch[(*used)++];
+      return -1;
+   }
+   *r = role == DEF ? scratch[0] : scratch[*used];
+   return role == DEF ? slot[v] : -1;
+}
+
+// Give every virtual register a real one from the pool
+// - pool is a register set; leave out registers named directly in
+//   the code (vcodeRealRegs) and any that hold live values
+// - rewrites the buffer; returns the number of values spilled
+int allocVRegs(VCode* vc, unsigned int pool)
+{
+   int n = vc->numVRegs, i, j, v, spills, last, used, store, freed = 0;
+   int *start, *end, *reg, *order, *slot;
+   int scratch[2];
+   VInstr *old, in;
+   const VOpInfo* info;
+   if (n == 0)
+      return 0;
+   start = (int*) malloc(5 * n * sizeof(int));
+   end = start + n;
+   reg = end + n;
+   order = reg + n;
+   slot = order + n;
+   for (v=0; v < n; v++) {
+      start[v] = end[v] = -1;
+      slot[v] = -1;
+   }
+   for (i=0; i < vc->len; i++) {
+      info = &vopInfo[vc->code[i].op];
+      noteOperand(vc->code[i].rs1, info->rs1, i, start, end);
+      noteOperand(vc->code[i].rs2, info->rs2, i, start, end);
+      noteOperand(vc->code[i].rd, info->rd, i, start, end);
+   }
+   // order by start: virtual registers are mostly made in order,
+   // so an insertion sort is about linear
+   for (v=0; v < n; v++) {
+      for (j=v; j > 0 && start[order[j-1]] > start[v]; j--)
+         order[j] = order[j-1];
+      order[j] = v;
+   }
+   spills = linearScan(n, order, start, end, reg, pool);
+   if (spills) {
+      // set aside the last two pool registers and scan again
+      for (i=NUMREGORDER-1, j=0; i >= 0 && j < 2; i--) {
+         if (pool & REGBIT(regOrder[i])) {
+            scratch[j++] = regOrder[i];
+            pool &= ~REGBIT(regOrder[i]);
+         }
+      }
+      spills = linearScan(n, order, start, end, reg, pool);
+      for (v=0; v < n; v++)
+         if (reg[v] == SPILLED)
+            slot[v] = vc->spillSlots++;
+   }
+   // rewrite the code, with spill code and the slots' stack space
+   old = vc->code;
+   last = vc->len;
+   vc->code = 0;
+   vc->len = vc->cap = 0;
+   if (vc->spillSlots)
+      emitVInstr(vc, VI_ADDI, R_SP, R_SP, 0, -4*vc->spillSlots, 0);
+   for (i=0; i < last; i++) {
+      in = old[i];
+      info = &vopInfo[in.op];
+      used = 0;
+      rewriteOperand(vc, &in.rs1, info->rs1, reg, slot, scratch, &used);
+      rewriteOperand(vc, &in.rs2, info->rs2, reg, slot, scratch, &used);
+      store = rewriteOperand(vc, &in.rd, info->rd, reg, slot, scratch, &used);
+      if (vc->spillSlots && i == last-1 && info->fmt == F_BR) {
+         // free the slots before a final branch, so both ways do
+         emitVInstr(vc, VI_ADDI, R_SP, R_SP, 0, 4*vc->spillSlots, 0);
+         freed = 1;
+      }
+      emitVInstr(vc, in.op, in.rd, in.rs1, in.rs2, in.imm, in.name);
+      if (store >= 0)
+         emitVInstr(vc, VI_SW, 0, scratch[0], R_SP, 4*store, 0);
+   }
+   if (vc->spillSlots && !freed)
+      emitVInstr(vc, VI_ADDI, R_SP, R_SP, 0, 4*vc->spillSlots, 0);
+   free(old);
+   free(start);
+   return spills;
+}
+
+// Assembly name of a real register ("v?" for a virtual one)
+const char* vcodeRegName(int r)
+{
+   return r >= 0 && r < VREG0 ? regNames[r] : "v?";
+}
+
+// Print the (allocated) code as assembly
+void printVCode(VCode* vc, FILE* out)
+{
+   const VOpInfo* info;
+   VInstr* in;
+   int i;
+   for (i=0; i < vc->len; i++) {
+      in = &vc->code[i];
+      info = &vopInfo[in->op];
+      fprintf(out, "\t%s\t", info->name);
+      switch (info->fmt) {
+       case F_RI:
+          fprintf(out, "%s, %d\n", vcodeRegName(in->rd), in->imm);
+          break;
+       case F_RSYM:
+          fprintf(out, "%s, %s\n", vcodeRegName(in->rd), atomName(in->name));
+          break;
+       case F_RSTR:
+          fprintf(out, "%s, .SC%d\n", vcodeRegName(in->rd), in->imm);
+          break;
+       case F_SWG:
+          fprintf(out, "%s, %s, %s\n", vcodeRegName(in->rs1), atomName(in->name),
+                  vcodeRegName(in->rs2));
+          break;
+       case F_LOAD:
+          fprintf(out, "%s, %d(%s)\n", vcodeRegName(in->rd), in->imm, vcodeRegName(in->rs1));
+          break;
+       case F_STORE:
+          fprintf(out, "%s, %d(%s)\n", vcodeRegName(in->rs1), in->imm, vcodeRegName(in->rs2));
+          break;
+       case F_RR:
+          fprintf(out, "%s, %s\n", vcodeRegName(in->rd), vcodeRegName(in->rs1));
+          break;
+       case F_RRR:
+          fprintf(out, "%s, %s, %s\n", vcodeRegName(in->rd), vcodeRegName(in->rs1),
+                  vcodeRegName(in->rs2));
+          break;
+       case F_RRI:
+          fprintf(out, "%s, %s, %d\n", vcodeRegName(in->rd), vcodeRegName(in->rs1), in->imm);
+          break;
+       case F_BR:
+          fprintf(out, "%s, %s, .LL%d\n", vcodeRegName(in->rs1), vcodeRegName(in->rs2), in->imm);
+          break;
+      }
+   }
+}
@@ -0,0 +1,62 @@
+//
+// Virtual Register Code Interface
+// - a buffer of RISC-V instructions whose register operands are
+//   either real registers (numbers 0-31, the RISC-V numbering) or
+//   virtual registers (VREG0 and up), each of which is written once
+// - the code generator lowers an expression statement into a
+//   buffer, allocVRegs() maps its virtual registers to real ones
+//   with a linear scan, and printVCode() writes the assembly
+// - the allocator only spills when every register it may use is
+//   taken; spilled values live in stack slots below sp, which the
+//   buffer then allocates and frees around its code
+//
+#ifndef VCODE_H
+#define VCODE_H
+
+#include <stdio.h>
+#include "atoms.h"
+
+// RISC-V register numbers used by the code generator
+#define R_ZERO 0
+#define R_SP   2
+#define R_FP   8
+#define R_T0   5
+#define R_A(n) (10+(n))
+#define VREG0  32   // first virtual register
+
+// Register sets are bit masks over the 32 real registers
+#define REGBIT(r) (1u << (r))
+#define TREGS (REGBIT(5)|REGBIT(6)|REGBIT(7)|REGBIT(28)|REGBIT(29)|REGBIT(30)|REGBIT(31))
+#define AREGS (0xFFu << 10)
+
+// Instructions; see vcode.c for the operands each one uses
+typedef enum {
+   VI_LI, VI_LA, VI_LASTR, VI_LWG, VI_SWG, VI_LW, VI_SW, VI_MV,
+   VI_ADD, VI_SUB, VI_SLLI, VI_ADDI, VI_BEQ, VI_BNE, VI_BGT, VI_BLT
+} VOp;
+
+typedef struct {
+   unsigned char op;  // VOp
+   short rd, rs1, rs2;
+   int imm;           // immediate, offset, string id or label id
+   Atom name;         // symbol, for VI_LA, VI_LWG and VI_SWG
+} VInstr;
+
+typedef struct {
+   VInstr* code;
+   int len, cap;
+   int numVRegs;      // virtual registers are VREG0..VREG0+numVRegs-1
+   int spillSlots;    // stack slots the allocator used (words)
+} VCode;
+
+void initVCode(VCode* vc);
+void resetVCode(VCode* vc);
+void freeVCode(VCode* vc);
+int newVReg(VCode* vc);
+void emitVInstr(VCode* vc, VOp op, int rd, int rs1, int rs2, int imm, Atom name);
+unsigned int vcodeRealRegs(VCode* vc);
+int allocVRegs(VCode* vc, unsigned int pool);
+void printVCode(VCode* vc, FILE* out);
+const char* vcodeRegName(int r);
+
+#endif